@@ -41,7 +41,7 @@ std::string trot_help = "The horses, they be trotting in some 'mode ...'\n";
 // gallop: action callback
 int gallop(const Arguments& arguments) {
     for (int i = 0; i < GetFlag<int>("ponies"); i++) {
-        if (!GetFlag<int>("tired")) {
+        if (!GetFlag<bool>("tired")) {
             std::cout << "Galloping into the night!" << std::endl;
         } else {
             std::cout << "The pony is too tired to gallop." << std::endl;
@@ -2,6 +2,14 @@
 #define HORSEWHISPERER_INCLUDE_HORSE_WHISPERER_H_
 
 #include <string>
+#include <cerrno>
+#include <cfloat>
+#include <clocale>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
 #include <map>
 #include <vector>
 #include <functional>
@@ -10,9 +18,38 @@
 #include <iomanip>
 #include <cctype>
 #include <algorithm>
+#include <bitset>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <fstream>
 #include <functional>
+#include <future>
+#include <iterator>
 #include <memory>
+#include <mutex>
+#include <new>
+#include <set>
 #include <stdexcept>
+#include <thread>
+
+#ifndef _WIN32
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#ifdef __linux__
+#include <sys/inotify.h>
+#endif
+#endif
 
 // To disable assert()
 #define NDEBUG
@@ -31,6 +68,12 @@ class horsewhisperer_error : public std::runtime_error {
             std::runtime_error(msg) {}
 };
 
+class sealed_error : public horsewhisperer_error {
+  public:
+    explicit sealed_error(std::string const& msg) :
+            horsewhisperer_error(msg) {}
+};
+
 class undefined_flag_error : public horsewhisperer_error {
   public:
     explicit undefined_flag_error(std::string const& msg) :
@@ -53,6 +96,9 @@ static const std::string VERSION_STRING = "0.8.0";
 static const int GLOBAL_CONTEXT_IDX = 0;
 static const int NO_CONTEXT_IDX = -1;
 
+// Sealed lookup results
+static const int NAME_NOT_FOUND = -1;
+
 // Parse results
 static const int PARSE_OK = 0;
 static const int PARSE_HELP = -1;
@@ -60,6 +106,40 @@ static const int PARSE_VERSION = -2;
 static const int PARSE_ERROR = 1;
 static const int PARSE_INVALID_FLAG = 2;
 
+// Daemon results
+static const int DAEMON_UNAVAILABLE = -1;
+
+// Step results
+static const int STEP_RUNNING = -1;
+
+// Exit code of the actions that were cancelled, as a shell reports an
+// interrupted command
+static const int ACTION_CANCELLED = 130;
+
+// Polling period of the signal count by the Watchdog
+static const int SIGNAL_POLL_MS = 10;
+
+// Command line tokenizer results
+static const int TOKEN_OK = 0;
+static const int TOKEN_END = 1;
+static const int TOKEN_UNTERMINATED_QUOTE = 2;
+
+// Maximum nesting of response files
+static const size_t RESPONSE_FILE_MAX_DEPTH = 16;
+
+// Records buffered between two actions of a pipeline (a power of 2)
+static const size_t PIPE_CAPACITY = 1024;
+
+// Times an action of a pipeline waiting for the next or the previous one
+// spins, then yields, before blocking until woken up
+static const size_t PIPE_SPINS = 64;
+static const size_t PIPE_YIELDS = 64;
+
+// Watch mode: time without further change after which changed inputs are
+// acted upon, and polling period where inotify is not available
+static const unsigned int WATCH_DEBOUNCE_MS_DEFAULT = 100;
+static const int WATCH_POLL_MS = 50;
+
 // Margins for help descriptions
 static const unsigned int DESCRIPTION_MARGIN_LEFT_DEFAULT = 30;
 static const unsigned int DESCRIPTION_MARGIN_RIGHT_DEFAULT = 80;
@@ -68,673 +148,5435 @@ static const unsigned int DESCRIPTION_MARGIN_RIGHT_DEFAULT = 80;
 // Types
 //
 
-enum FlagType { Bool, Int, Double, String };
+enum FlagType { Bool, Int, Double, String, Int64, UInt64, Float };
 
 template <typename Type>
 using FlagCallback = std::function<bool(Type&)>;
 
 using Arguments = std::vector<std::string>;
 
+// Non owning reference to a sequence of characters (a subset of the
+// C++17 std::string_view interface)
+class StringView {
+  public:
+    enum : size_t { npos = static_cast<size_t>(-1) };
+
+    StringView() : data_ { nullptr }, size_ { 0 } {}
+    StringView(const char* data, size_t size) : data_ { data }, size_ { size } {}
+    StringView(const char* str) : data_ { str }, size_ { std::strlen(str) } {}
+    StringView(const std::string& str) : data_ { str.data() }, size_ { str.size() } {}
+
+    const char* data() const { return data_; }
+    size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    char operator[](size_t i) const { return data_[i]; }
+    const char* begin() const { return data_; }
+    const char* end() const { return data_ + size_; }
+
+    size_t find(char c, size_t pos = 0) const {
+        if (pos >= size_) {
+            return npos;
+        }
+        // memchr scans a word or a vector register at a time
+        const void* found = std::memchr(data_ + pos, c, size_ - pos);
+        return found ? static_cast<size_t>(static_cast<const char*>(found) - data_)
+                     : static_cast<size_t>(npos);
+    }
+
+    StringView substr(size_t pos, size_t count = npos) const {
+        return StringView { data_ + pos, std::min(count, size_ - pos) };
+    }
+
+    std::string str() const {
+        return std::string(data_, size_);
+    }
+
+  private:
+    const char* data_;
+    size_t size_;
+};
+
+static bool operator==(const StringView& lhs, const StringView& rhs) __attribute__ ((unused));
+static bool operator==(const StringView& lhs, const StringView& rhs) {
+    return lhs.size() == rhs.size()
+           && std::memcmp(lhs.data(), rhs.data(), lhs.size()) == 0;
+}
+
+static bool operator!=(const StringView& lhs, const StringView& rhs) __attribute__ ((unused));
+static bool operator!=(const StringView& lhs, const StringView& rhs) {
+    return !(lhs == rhs);
+}
+
+static std::ostream& operator<<(std::ostream& os, const StringView& sv) __attribute__ ((unused));
+static std::ostream& operator<<(std::ostream& os, const StringView& sv) {
+    return os.write(sv.data(), sv.size());
+}
+
+// Read only sequence of action arguments. The referenced characters belong
+// to the argv passed to Parse, which must outlive the callbacks, or to the
+// response files read by Parse, which are kept until the next Reset.
+class ArgumentsView {
+  public:
+    ArgumentsView() : begin_ { nullptr }, end_ { nullptr } {}
+    ArgumentsView(const StringView* begin, const StringView* end)
+            : begin_ { begin }, end_ { end } {}
+    explicit ArgumentsView(const std::vector<StringView>& arguments)
+            : begin_ { arguments.data() },
+              end_ { arguments.data() + arguments.size() } {}
+
+    size_t size() const { return end_ - begin_; }
+    bool empty() const { return begin_ == end_; }
+    const StringView& operator[](size_t i) const { return begin_[i]; }
+    const StringView* begin() const { return begin_; }
+    const StringView* end() const { return end_; }
+
+    // Copy the arguments
+    Arguments toArguments() const {
+        Arguments arguments {};
+        arguments.reserve(size());
+        for (auto& arg : *this) {
+            arguments.push_back(arg.str());
+        }
+        return arguments;
+    }
+
+  private:
+    const StringView* begin_;
+    const StringView* end_;
+};
+
 using ArgumentsCallback = std::function<bool(const Arguments& arguments)>;
 
 using ActionCallback = std::function<int(const Arguments& arguments)>;
 
+// Callbacks receiving the action arguments without copying them
+using ArgumentsViewCallback = std::function<bool(const ArgumentsView& arguments)>;
+
+using ActionViewCallback = std::function<int(const ArgumentsView& arguments)>;
+
+// Callback of a streaming action, reading its arguments while they are
+// produced (see ArgumentStream)
+class ArgumentStream;
+
+using ActionStreamCallback = std::function<int(ArgumentStream& arguments)>;
+
+// Callback receiving the context the action runs in (see ActionContext)
+class ActionContext;
+
+using ActionContextCallback = std::function<int(const ActionContext& context)>;
+
+// Asynchronous action: the callback starts the action and returns, and the
+// action calls done with its exit code once complete, from any thread
+using ActionCompletion = std::function<void(int exit_code)>;
+
+using AsyncActionCallback = std::function<void(ActionContext context,
+                                               ActionCompletion done)>;
+
+// Paths of the files an action reads, given the context it is about to run
+// in (see SetActionInputs)
+using ActionInputsCallback = std::function<std::vector<std::string>(
+    const ActionContext& context)>;
+
 struct FlagBase {
+    explicit FlagBase(FlagType flag_type) : type { flag_type } {}
     virtual ~FlagBase() {};
+    // Type of the flag value, set by Flag
+    const FlagType type;
     std::string aliases;
     std::string description;
 };
 
+template <typename Type>
+struct FlagTraits;
+
 template <typename Type>
 struct Flag : FlagBase {
+    Flag() : FlagBase { FlagTraits<Type>::type }, value {} {}
+    // Default value; the values set are stored in the contexts
     Type value;
     FlagCallback<Type> flag_callback;
 };
 
-struct Action {
-    ~Action() {
-        for (auto& flag : flags) {
-            delete flag.second;
-        }
+// Value of a flag set in a given context
+struct FlagValue {
+    const FlagBase* flag;
+    union {
+        bool b;
+        int i;
+        double d;
+        int64_t i64;
+        uint64_t u64;
+        float f;
+    } scalar;
+    std::string str;
+};
+
+// Selects the member of the static definition unions for a flag type
+template <typename Type>
+struct StaticTag {};
+
+// Default value of a flag defined at compile time (see StaticFlag)
+union StaticFlagValue {
+    constexpr StaticFlagValue(StaticTag<bool>, bool v) : b(v) {}
+    constexpr StaticFlagValue(StaticTag<int>, int v) : i(v) {}
+    constexpr StaticFlagValue(StaticTag<double>, double v) : d(v) {}
+    constexpr StaticFlagValue(StaticTag<int64_t>, int64_t v) : i64(v) {}
+    constexpr StaticFlagValue(StaticTag<uint64_t>, uint64_t v) : u64(v) {}
+    constexpr StaticFlagValue(StaticTag<float>, float v) : f(v) {}
+    constexpr StaticFlagValue(StaticTag<std::string>, const char* v) : str(v) {}
+
+    bool b;
+    int i;
+    double d;
+    int64_t i64;
+    uint64_t u64;
+    float f;
+    const char* str;
+};
+
+// Callback of a flag defined at compile time
+union StaticFlagCallback {
+    constexpr StaticFlagCallback(StaticTag<bool>, bool (*v)(bool&)) : b(v) {}
+    constexpr StaticFlagCallback(StaticTag<int>, bool (*v)(int&)) : i(v) {}
+    constexpr StaticFlagCallback(StaticTag<double>, bool (*v)(double&)) : d(v) {}
+    constexpr StaticFlagCallback(StaticTag<int64_t>, bool (*v)(int64_t&)) : i64(v) {}
+    constexpr StaticFlagCallback(StaticTag<uint64_t>, bool (*v)(uint64_t&)) : u64(v) {}
+    constexpr StaticFlagCallback(StaticTag<float>, bool (*v)(float&)) : f(v) {}
+    constexpr StaticFlagCallback(StaticTag<std::string>, bool (*v)(std::string&)) : str(v) {}
+
+    bool (*b)(bool&);
+    bool (*i)(int&);
+    bool (*d)(double&);
+    bool (*i64)(int64_t&);
+    bool (*u64)(uint64_t&);
+    bool (*f)(float&);
+    bool (*str)(std::string&);
+};
+
+//
+// Output
+//
+
+// Destination of the help, of the diagnostics and of the records written
+// by the last action of a pipeline. Writes may come from several threads;
+// the library flushes only through Flush() and around daemon sessions.
+class OutputSink {
+  public:
+    virtual ~OutputSink() {}
+
+    // Write text, which is a whole message or record
+    virtual void write(StringView text) = 0;
+
+    virtual void flush() = 0;
+};
+
+// Writes each message to a stream, whole, without flushing it; the
+// stream buffers the messages (std::cout through the stdio buffer). This
+// is the default sink, on std::cout, so that the messages stay in order
+// with what the application writes to std::cout.
+class StreamSink : public OutputSink {
+  public:
+    explicit StreamSink(std::ostream& out) : out_ ( out ) {}
+
+    void write(StringView text) override {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        out_.write(text.data(), text.size());
     }
-    // Action name
-    std::string name;
-    // Keys local to the action
-    std::map<std::string, FlagBase*> flags;
-    // Action description
-    std::string description;
-    // Arity of the action
-    int arity;
-    // Function called when we invoke the action
-    ActionCallback action_callback;
-    // Function called when we validate action arguments
-    ArgumentsCallback arguments_callback;
-    // Context sensitive action help
-    std::string help_string_;
-    // Wheter the action succeded
-    bool success;
-    // Whenter the action can be chained with other actions
-    bool chainable;
+
+    void flush() override {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        out_.flush();
+    }
+
+  private:
+    std::ostream& out_;
+    std::mutex mutex_;
 };
 
-static FlagType getTypeOfFlag(const FlagBase* flagp);
+// Collects the messages and writes them to a stream together, when
+// capacity bytes are pending, on flush() and when destroyed
+class BufferedSink : public OutputSink {
+  public:
+    explicit BufferedSink(std::ostream& out, size_t capacity = 65536)
+            : out_ ( out ), capacity_ { capacity } {
+        buffer_.reserve(capacity);
+    }
 
-struct Context {
-    // Flags defined for the given context
-    std::map<std::string, FlagBase*> flags;
-    // What this context is doing
-    Action* action;
-    // Action arguments
-    Arguments arguments;
+    ~BufferedSink() {
+        flush();
+    }
 
-    std::string toString() {
-        std::stringstream ss {};
-        ss << "Action " << action->name;
-        if (arguments.size() > 0) {
-            ss << "  - arguments:";
-            for (auto& arg : arguments) {
-                ss << " " << arg;
-            }
+    void write(StringView text) override {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        if (buffer_.size() + text.size() > capacity_) {
+            writeBuffer();
         }
-        if (flags.size() > 0) {
-            for (auto& k_v : flags) {
-                ss << "\n  flag " << k_v.first << ": ";
-                switch (getTypeOfFlag(k_v.second)) {
-                    case FlagType::Bool:
-                        ss << static_cast<Flag<bool>*>(k_v.second)->value;
-                        break;
-                    case FlagType::String:
-                        ss << static_cast<Flag<std::string>*>(k_v.second)->value;
-                        break;
-                    case FlagType::Int:
-                        ss << static_cast<Flag<int>*>(k_v.second)->value;
-                        break;
-                    case FlagType::Double:
-                        ss << static_cast<Flag<double>*>(k_v.second)->value;
-                }
-            }
-        }
-        return ss.str();
+        buffer_.append(text.data(), text.size());
+    }
+
+    void flush() override {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        writeBuffer();
+        out_.flush();
+    }
+
+  private:
+    std::ostream& out_;
+    size_t capacity_;
+    std::string buffer_;
+    std::mutex mutex_;
+
+    void writeBuffer() {
+        out_.write(buffer_.data(), buffer_.size());
+        buffer_.clear();
     }
 };
 
-typedef std::unique_ptr<Context> ContextPtr;
+// What a diagnostic is about
+enum class DiagnosticCode {
+    UnknownAction,
+    UnknownFlag,
+    MissingFlagValue,
+    InvalidFlagValue,
+    MissingArguments,
+    UnexpectedAction,
+    UnexpectedDelimiter,
+    InvalidPipe,
+    InvalidResponseFile,
+    NoAction,
+    ActionNotStarted,
+    InvalidBatch,
+    ActionCancelled,
+    ActionSkipped,
+    InvalidWatch
+};
+
+// Error found while parsing or starting a command line
+struct Diagnostic {
+    DiagnosticCode code;
+    // Message, also written to the output sink
+    std::string message;
+    // Token the diagnostic is about, if any, and its position on the
+    // command line: argv[1] is at position 1, and the tokens of response
+    // files follow the position of their @path token; 0 if the diagnostic
+    // is about no token
+    std::string token;
+    size_t position;
+};
+
+using DiagnosticCallback = std::function<void(const Diagnostic& diagnostic)>;
+
+// Concatenate the parts of a message
+template <typename... Parts>
+static std::string formatMessage(const Parts&... parts) {
+    std::ostringstream message {};
+    using expand = int[];
+    (void) expand { 0, ((void) (message << parts), 0)... };
+    return message.str();
+}
 
 //
-// API Declarations
+// Number parsing
 //
 
+// Parse a base 10 integer with an optional sign, failing on any other
+// character and on values out of the range of Type. Does not allocate and
+// does not depend on the locale.
 template <typename Type>
-static void DefineGlobalFlag(std::string aliases,
-                             std::string description,
-                             Type default_value,
-                             FlagCallback<Type> flag_callback) __attribute__ ((unused));
-template <typename Type>
-static void DefineActionFlag(std::string action_name,
-                             std::string aliases,
-                             std::string description,
-                             Type default_value,
-                             FlagCallback<Type> flag_callback) __attribute__ ((unused));
-static bool IsActionFlag(std::string action, std::string flagname) __attribute__ ((unused));
-template <typename Type>
-static Type GetFlag(std::string flag_name) __attribute__ ((unused));
-// Throws undefined_flag_error in case the specified flag is unknown
-static FlagType GetFlagType(std::string flag_name) __attribute__ ((unused));
-template <typename Type>
-static void SetFlag(std::string flag_name, Type value) __attribute__ ((unused));
-static void DefineAction(std::string action_name,
-                         int arity,
-                         bool chainable,
-                         std::string description,
-                         std::string help_string,
-                         ActionCallback action_callback,
-                         ArgumentsCallback arguments_callback) __attribute__ ((unused));
-static void SetAppName(std::string name) __attribute__ ((unused));
-static void SetHelpBanner(std::string banner) __attribute__ ((unused));
-static void SetVersion(std::string version) __attribute__ ((unused));
-static void SetDelimiters(std::vector<std::string> delimiters) __attribute__ ((unused));
-static int Parse(int argc, char** argv) __attribute__ ((unused));
-static bool ValidateActionArguments() __attribute__ ((unused));
-static void ShowHelp() __attribute__ ((unused));
-static void ShowVersion() __attribute__ ((unused));
-static std::vector<std::string> GetParsedActions() __attribute__ ((unused));
-static int Start() __attribute__ ((unused));
-static void Reset() __attribute__ ((unused));
-static void SetHelpMargins(unsigned int left_margin,
-                           unsigned int right_margin) __attribute__ ((unused));
+static bool parseInteger(StringView text, Type& result) {
+    const char* p { text.begin() };
+    const char* end { text.end() };
+    bool negative { false };
+
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    if (p == end || (negative && !std::numeric_limits<Type>::is_signed)) {
+        return false;
+    }
 
-//
-// Auxiliary Functions
-//
+    // Largest magnitude allowed, given the sign
+    uint64_t limit { negative
+        ? static_cast<uint64_t>(-(std::numeric_limits<Type>::min() + 1)) + 1
+        : static_cast<uint64_t>(std::numeric_limits<Type>::max()) };
+    uint64_t magnitude { 0 };
 
-// Because regex is busted on a lot of versions of libstdc++ I'm rolling
-// my own integer validation.
-static bool validateInteger(const std::string& val) {
-    for (size_t i = 0; i < val.size(); i++) {
-        if ((val[i] < '0') || (val[i] > '9')) {
+    for (; p != end; ++p) {
+        unsigned int digit { static_cast<unsigned int>(
+            static_cast<unsigned char>(*p) - '0') };
+        if (digit > 9) {
             return false;
         }
+        if (magnitude > limit / 10
+                || (magnitude == limit / 10 && digit > limit % 10)) {
+            return false;
+        }
+        magnitude = magnitude * 10 + digit;
     }
-    return true;
-}
 
-static bool validateDouble(const std::string& val) {
-    std::istringstream i_s { val };
-    double x {};
-    char c;
-    if (!(i_s >> x) || i_s.get(c)) {
-        return false;
+    if (negative && magnitude > 0) {
+        // Avoids negating the magnitude of the minimum value
+        result = -static_cast<Type>(magnitude - 1) - 1;
+    } else {
+        result = static_cast<Type>(magnitude);
     }
     return true;
 }
 
-static std::vector<std::string> wordWrap(const std::string& txt,
-                                         const unsigned int width) {
-    std::istringstream input { txt };
-    std::vector<std::string> lines {};
-    std::string current_word {};
-    std::string current_line {};
+// Fallback of parseDouble for numbers that cannot be converted exactly by
+// the fast path; strtod is made locale independent by replacing the '.'
+static bool parseDoubleWithStrtod(StringView text, double& result) {
+    const char* decimal_point { std::localeconv()->decimal_point };
+    char stack_buffer[128];
+    std::string heap_buffer {};
+    char* buffer { stack_buffer };
+
+    if (text.size() >= sizeof(stack_buffer) || std::strlen(decimal_point) != 1) {
+        for (char c : text) {
+            if (c == '.') {
+                heap_buffer += decimal_point;
+            } else {
+                heap_buffer += c;
+            }
+        }
+        buffer = &heap_buffer[0];
+    } else {
+        for (size_t i = 0; i < text.size(); i++) {
+            stack_buffer[i] = text[i] == '.' ? decimal_point[0] : text[i];
+        }
+        stack_buffer[text.size()] = '\0';
+    }
 
-    while (getline(input, current_word, ' ')) {
-        if (current_line.size() + current_word.size() >= width) {
-            lines.push_back(current_line);
-            current_line = current_word;
+    char* end { nullptr };
+    errno = 0;
+    result = std::strtod(buffer, &end);
+    // Reject overflows, as istream does; underflows round to zero
+    return *end == '\0' && !(errno == ERANGE && std::fabs(result) == HUGE_VAL);
+}
+
+// Parse a decimal floating point number: an optional sign, digits with an
+// optional '.', and an optional exponent. Numbers with up to 19
+// significant digits and a small exponent are converted exactly in a
+// single pass; the others fall back to strtod. Does not allocate (for
+// numbers shorter than 128 characters) and does not depend on the locale.
+static bool parseDouble(StringView text, double& result) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+    const char* p { text.begin() };
+    const char* end { text.end() };
+    bool negative { false };
+    uint64_t mantissa { 0 };
+    int significant_digits { 0 };
+    bool any_digit { false };
+    bool inexact { false };
+    long exponent { 0 };
+
+    auto isDigit = [](const char* c) { return *c >= '0' && *c <= '9'; };
+    auto addDigit = [&](unsigned int digit, bool fractional) {
+        any_digit = true;
+        if (mantissa == 0 && digit == 0) {
+            // leading zero
+            exponent -= fractional;
+        } else if (significant_digits < 19) {
+            mantissa = mantissa * 10 + digit;
+            ++significant_digits;
+            exponent -= fractional;
         } else {
-            current_word = (current_line.empty() ? "" : " ") + current_word;
-            current_line += current_word;
+            exponent += !fractional;
+            inexact |= digit != 0;
+        }
+    };
+
+    if (p != end && (*p == '-' || *p == '+')) {
+        negative = *p == '-';
+        ++p;
+    }
+    for (; p != end && isDigit(p); ++p) {
+        addDigit(*p - '0', false);
+    }
+    if (p != end && *p == '.') {
+        for (++p; p != end && isDigit(p); ++p) {
+            addDigit(*p - '0', true);
         }
     }
+    if (!any_digit) {
+        return false;
+    }
 
-    if (!current_line.empty()) {
-        lines.push_back(current_line);
+    if (p != end && (*p == 'e' || *p == 'E')) {
+        ++p;
+        bool negative_exponent { false };
+        if (p != end && (*p == '-' || *p == '+')) {
+            negative_exponent = *p == '-';
+            ++p;
+        }
+        if (p == end) {
+            return false;
+        }
+        long explicit_exponent { 0 };
+        for (; p != end && isDigit(p); ++p) {
+            if (explicit_exponent < 100000) {
+                explicit_exponent = explicit_exponent * 10 + (*p - '0');
+            }
+        }
+        exponent += negative_exponent ? -explicit_exponent : explicit_exponent;
+    }
+    if (p != end) {
+        return false;
     }
 
-    return lines;
-}
+    if (mantissa == 0) {
+        result = negative ? -0.0 : 0.0;
+        return true;
+    }
 
-static FlagType getTypeOfFlag(const FlagBase* flagp) {
-    FlagType flag_type { FlagType::Bool };
-
-    // RTTI to determine the flag value type
-    if (dynamic_cast<const Flag<bool>*>(flagp)) {
-        flag_type = FlagType::Bool;
-    } else if (dynamic_cast<const Flag<std::string>*>(flagp)) {
-        flag_type = FlagType::String;
-    } else if (dynamic_cast<const Flag<int>*>(flagp)) {
-        flag_type = FlagType::Int;
-    } else if (dynamic_cast<const Flag<double>*>(flagp)) {
-        flag_type = FlagType::Double;
-    } else {
-        // We only support the types in the FlagType enum...
-        assert(false);
+    // Exact when both the mantissa and the power of ten are exactly
+    // representable as doubles
+    if (!inexact && mantissa <= (1ULL << 53) && exponent >= -22 && exponent <= 22) {
+        double value { static_cast<double>(mantissa) };
+        if (exponent < 0) {
+            value /= powers_of_ten[-exponent];
+        } else {
+            value *= powers_of_ten[exponent];
+        }
+        result = negative ? -value : value;
+        return true;
     }
 
-    return flag_type;
+    return parseDoubleWithStrtod(text, result);
 }
 
-//
-// HorseWhisperer
-//
+// Properties of the supported flag types. Each trait provides:
+//  - type: the FlagType tag stored in FlagBase
+//  - takes_value: whether the flag consumes the next argv token
+//  - placeholder(): the argument shown in the help text
+//  - expected(): the accepted values, for error messages
+//  - invalid_result: the parse result of an invalid value
+//  - value(): the FlagValue member storing a value of the type
+//  - parse(): the conversion from command line text
+//  - static_type, fromStatic(), staticCallback(): the default value and
+//    the callback of the flags defined at compile time
+// Using an unsupported type is a compile error.
+
+template <>
+struct FlagTraits<bool> {
+    static const FlagType type = FlagType::Bool;
+    static const bool takes_value = false;
+    static const int invalid_result = PARSE_ERROR;
+    static const char* placeholder() { return ""; }
+    static const char* expected() { return "a value of 'true' or 'false'"; }
+    static bool& value(FlagValue& v) { return v.scalar.b; }
+    using static_type = bool;
+    static bool fromStatic(const StaticFlagValue& v) { return v.b; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(bool&) { return c.b; }
+    static bool parse(StringView text, bool& result) {
+        // passed as --true_thing=false|true
+        result = text != "false";
+        return text.empty() || text == "true" || text == "false";
+    }
+};
 
-class HorseWhisperer {
-  public:
-    // Return reference to instance of HorseWhisperer singleton
-    static HorseWhisperer& Instance() {
-        static HorseWhisperer instance;
-        return instance;
+template <>
+struct FlagTraits<int> {
+    static const FlagType type = FlagType::Int;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_INVALID_FLAG;
+    static const char* placeholder() { return " <int>"; }
+    static const char* expected() { return "a value of type integer"; }
+    static int& value(FlagValue& v) { return v.scalar.i; }
+    using static_type = int;
+    static int fromStatic(const StaticFlagValue& v) { return v.i; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(int&) { return c.i; }
+    static bool parse(StringView text, int& result) {
+        return parseInteger<int>(text, result);
     }
+};
 
-    // No args constructor creates the pointer to the root context and
-    // implicitly declares the --help flag.
-    // Initializations are performed by init().
-    HorseWhisperer() {
-        init();
+template <>
+struct FlagTraits<int64_t> {
+    static const FlagType type = FlagType::Int64;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_INVALID_FLAG;
+    static const char* placeholder() { return " <int>"; }
+    static const char* expected() { return "a value of type integer"; }
+    static int64_t& value(FlagValue& v) { return v.scalar.i64; }
+    using static_type = int64_t;
+    static int64_t fromStatic(const StaticFlagValue& v) { return v.i64; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(int64_t&) { return c.i64; }
+    static bool parse(StringView text, int64_t& result) {
+        return parseInteger<int64_t>(text, result);
     }
+};
 
-    void reset() {
-        clean();
-        init();
+template <>
+struct FlagTraits<uint64_t> {
+    static const FlagType type = FlagType::UInt64;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_INVALID_FLAG;
+    static const char* placeholder() { return " <uint>"; }
+    static const char* expected() { return "a value of type unsigned integer"; }
+    static uint64_t& value(FlagValue& v) { return v.scalar.u64; }
+    using static_type = uint64_t;
+    static uint64_t fromStatic(const StaticFlagValue& v) { return v.u64; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(uint64_t&) { return c.u64; }
+    static bool parse(StringView text, uint64_t& result) {
+        return parseInteger<uint64_t>(text, result);
     }
+};
 
-    void setAppName(std::string name) {
-        application_name_ = name;
+template <>
+struct FlagTraits<double> {
+    static const FlagType type = FlagType::Double;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_INVALID_FLAG;
+    static const char* placeholder() { return " <float>"; }
+    static const char* expected() { return "a value of type double"; }
+    static double& value(FlagValue& v) { return v.scalar.d; }
+    using static_type = double;
+    static double fromStatic(const StaticFlagValue& v) { return v.d; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(double&) { return c.d; }
+    static bool parse(StringView text, double& result) {
+        return parseDouble(text, result);
     }
+};
 
-    void setHelpBanner(std::string banner) {
-        help_banner_ = banner;
+template <>
+struct FlagTraits<float> {
+    static const FlagType type = FlagType::Float;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_INVALID_FLAG;
+    static const char* placeholder() { return " <float>"; }
+    static const char* expected() { return "a value of type float"; }
+    static float& value(FlagValue& v) { return v.scalar.f; }
+    using static_type = float;
+    static float fromStatic(const StaticFlagValue& v) { return v.f; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(float&) { return c.f; }
+    static bool parse(StringView text, float& result) {
+        double converted {};
+        if (!parseDouble(text, converted) || std::fabs(converted) > FLT_MAX) {
+            return false;
+        }
+        result = static_cast<float>(converted);
+        return true;
     }
+};
 
-    void setVersionString(std::string version_string) {
-        version_string_ = version_string;
-        defineGlobalFlag<bool>("version", "Display version information", false,
-                               nullptr);
+template <>
+struct FlagTraits<std::string> {
+    static const FlagType type = FlagType::String;
+    static const bool takes_value = true;
+    static const int invalid_result = PARSE_ERROR;
+    static const char* placeholder() { return " <str>"; }
+    static const char* expected() { return "a string value"; }
+    static std::string& value(FlagValue& v) { return v.str; }
+    using static_type = const char*;
+    static std::string fromStatic(const StaticFlagValue& v) { return v.str ? v.str : ""; }
+    static bool (*staticCallback(const StaticFlagCallback& c))(std::string&) { return c.str; }
+    static bool parse(StringView text, std::string& result) {
+        result = text.str();
+        return true;
     }
+};
 
-    void setDelimiters(std::vector<std::string> delimiters) {
-        delimiters_ = delimiters;
+// Call visitor.visit<Type>(), where Type is the type tagged by flag_type.
+// This is the only place mapping FlagType tags to types.
+template <typename Visitor>
+static auto visitFlagType(FlagType flag_type, Visitor& visitor)
+        -> decltype(visitor.template visit<bool>()) {
+    switch (flag_type) {
+        case FlagType::Int:
+            return visitor.template visit<int>();
+        case FlagType::Int64:
+            return visitor.template visit<int64_t>();
+        case FlagType::UInt64:
+            return visitor.template visit<uint64_t>();
+        case FlagType::Float:
+            return visitor.template visit<float>();
+        case FlagType::Double:
+            return visitor.template visit<double>();
+        case FlagType::String:
+            return visitor.template visit<std::string>();
+        case FlagType::Bool:
+        default:
+            return visitor.template visit<bool>();
     }
+}
 
-    bool isDelimiter(const char* argument) {
-        if (std::find(delimiters_.begin(), delimiters_.end(), argument)
-                != delimiters_.end()) {
-            return true;
-        }
-        return false;
+struct FlagPlaceholderVisitor {
+    template <typename Type>
+    const char* visit() {
+        return FlagTraits<Type>::placeholder();
     }
+};
 
-    bool isActionFlag(std::string action, std::string flagname) {
-        for (const auto& flag : actions_[action]->flags) {
-            if (flagname.compare(flag.first) == 0) {
-                return true;
-            }
+//
+// Static definitions
+//
+
+// FNV-1a hash of a NUL terminated name, computed at compile time
+constexpr uint64_t staticNameHash(const char* name,
+                                  uint64_t hash = 14695981039346656037ULL) {
+    return *name == '\0'
+        ? hash
+        : staticNameHash(name + 1,
+                         (hash ^ static_cast<unsigned char>(*name)) * 1099511628211ULL);
+}
+
+// As above, at run time
+static uint64_t nameHash(StringView name) {
+    uint64_t hash { 14695981039346656037ULL };
+    for (char c : name) {
+        hash ^= static_cast<unsigned char>(c);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+constexpr bool staticNamesEqual(const char* lhs, const char* rhs) {
+    return *lhs == *rhs && (*lhs == '\0' || staticNamesEqual(lhs + 1, rhs + 1));
+}
+
+// Flag defined at compile time; see StaticFlag
+struct StaticFlagDefinition {
+    const char* aliases;
+    const char* description;
+    FlagType type;
+    StaticFlagValue default_value;
+    StaticFlagCallback callback;
+};
+
+// Action defined at compile time; see StaticAction. Exactly one of the
+// action callbacks is set.
+struct StaticActionDefinition {
+    const char* name;
+    // staticNameHash of name
+    uint64_t name_hash;
+    int arity;
+    bool chainable;
+    const char* description;
+    const char* help_string;
+    int (*action_callback)(const Arguments&);
+    int (*action_view_callback)(const ArgumentsView&);
+    int (*action_context_callback)(const ActionContext&);
+    bool (*arguments_callback)(const Arguments&);
+    bool (*arguments_view_callback)(const ArgumentsView&);
+    const StaticFlagDefinition* flags;
+    size_t flag_count;
+
+    // Copy of the action with the given action flags
+    template <size_t N>
+    constexpr StaticActionDefinition withFlags(
+            const StaticFlagDefinition (&action_flags)[N]) const {
+        return StaticActionDefinition { name, name_hash, arity, chainable,
+                                        description, help_string,
+                                        action_callback, action_view_callback,
+                                        action_context_callback,
+                                        arguments_callback, arguments_view_callback,
+                                        action_flags, N };
+    }
+
+    // Copy of the action with the given arguments callback
+    constexpr StaticActionDefinition withArgumentsCallback(
+            bool (*callback)(const Arguments&)) const {
+        return StaticActionDefinition { name, name_hash, arity, chainable,
+                                        description, help_string,
+                                        action_callback, action_view_callback,
+                                        action_context_callback,
+                                        callback, nullptr, flags, flag_count };
+    }
+
+    constexpr StaticActionDefinition withArgumentsCallback(
+            bool (*callback)(const ArgumentsView&)) const {
+        return StaticActionDefinition { name, name_hash, arity, chainable,
+                                        description, help_string,
+                                        action_callback, action_view_callback,
+                                        action_context_callback,
+                                        nullptr, callback, flags, flag_count };
+    }
+};
+
+// Flags and actions defined at compile time; see DefineStaticSchema
+struct StaticSchema {
+    const StaticFlagDefinition* global_flags;
+    size_t global_flag_count;
+    const StaticActionDefinition* actions;
+    size_t action_count;
+
+    // Whether action names are distinct. Evaluated at compile time, it
+    // recurses up to twice the number of actions deep, within the default
+    // constexpr depth of compilers for up to 256 actions.
+    constexpr bool hasDistinctActionNames(size_t idx = 0) const {
+        return idx >= action_count
+            || (isFirstNamed(idx, idx + 1) && hasDistinctActionNames(idx + 1));
+    }
+
+    constexpr bool isFirstNamed(size_t idx, size_t other) const {
+        return other >= action_count
+            || ((actions[idx].name_hash != actions[other].name_hash
+                 || !staticNamesEqual(actions[idx].name, actions[other].name))
+                && isFirstNamed(idx, other + 1));
+    }
+};
+
+// Define a flag at compile time, e.g.
+//     constexpr StaticFlagDefinition flags[] = {
+//         StaticFlag<int>("p ponies", "all the ponies", 1) };
+// Callbacks are function pointers, since lambdas are not constexpr.
+template <typename Type>
+constexpr StaticFlagDefinition StaticFlag(
+        const char* aliases, const char* description,
+        typename FlagTraits<Type>::static_type default_value,
+        bool (*flag_callback)(Type&) = nullptr) {
+    return StaticFlagDefinition { aliases, description, FlagTraits<Type>::type,
+                                  StaticFlagValue { StaticTag<Type> {}, default_value },
+                                  StaticFlagCallback { StaticTag<Type> {}, flag_callback } };
+}
+
+// Define an action at compile time; its flags and arguments callback are
+// set with withFlags and withArgumentsCallback
+constexpr StaticActionDefinition StaticAction(
+        const char* name, int arity, bool chainable, const char* description,
+        const char* help_string, int (*action_callback)(const Arguments&)) {
+    return StaticActionDefinition { name, staticNameHash(name), arity, chainable,
+                                    description, help_string, action_callback,
+                                    nullptr, nullptr, nullptr, nullptr, nullptr, 0 };
+}
+
+constexpr StaticActionDefinition StaticAction(
+        const char* name, int arity, bool chainable, const char* description,
+        const char* help_string, int (*action_callback)(const ArgumentsView&)) {
+    return StaticActionDefinition { name, staticNameHash(name), arity, chainable,
+                                    description, help_string, nullptr,
+                                    action_callback, nullptr, nullptr, nullptr,
+                                    nullptr, 0 };
+}
+
+constexpr StaticActionDefinition StaticAction(
+        const char* name, int arity, bool chainable, const char* description,
+        const char* help_string, int (*action_callback)(const ActionContext&)) {
+    return StaticActionDefinition { name, staticNameHash(name), arity, chainable,
+                                    description, help_string, nullptr, nullptr,
+                                    action_callback, nullptr, nullptr, nullptr, 0 };
+}
+
+template <size_t F, size_t A>
+constexpr StaticSchema MakeStaticSchema(const StaticFlagDefinition (&global_flags)[F],
+                                        const StaticActionDefinition (&actions)[A]) {
+    return StaticSchema { global_flags, F, actions, A };
+}
+
+template <size_t A>
+constexpr StaticSchema MakeStaticSchema(const StaticActionDefinition (&actions)[A]) {
+    return StaticSchema { nullptr, 0, actions, A };
+}
+
+//
+// Arena
+//
+
+// Owns objects allocated in blocks and destroys them all at once, by
+// clear() or when destroyed. The blocks outlive clear(), so that filling
+// the arena again with as many objects does not allocate blocks.
+class Arena {
+  public:
+    Arena() : current_block_ { 0 }, used_ { 0 }, objects_ { nullptr } {}
+
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    ~Arena() {
+        clear();
+    }
+
+    template <typename Type, typename... Args>
+    Type* make(Args&&... args) {
+        void* memory = allocate(sizeof(Object<Type>), alignof(Object<Type>));
+        Object<Type>* object = new (memory) Object<Type>(std::forward<Args>(args)...);
+        object->next = objects_;
+        objects_ = object;
+        return &object->value;
+    }
+
+    // Destroy the objects, most recent first
+    void clear() {
+        while (objects_) {
+            ObjectBase* next = objects_->next;
+            objects_->~ObjectBase();
+            objects_ = next;
+        }
+        current_block_ = 0;
+        used_ = 0;
+    }
+
+  private:
+    static const size_t BLOCK_SIZE { 4096 };
+
+    struct ObjectBase {
+        virtual ~ObjectBase() {}
+        ObjectBase* next;
+    };
+
+    template <typename Type>
+    struct Object : ObjectBase {
+        template <typename... Args>
+        explicit Object(Args&&... args) : value(std::forward<Args>(args)...) {}
+        Type value;
+    };
+
+    struct Block {
+        std::unique_ptr<char[]> data;
+        size_t size;
+    };
+
+    std::vector<Block> blocks_;
+    size_t current_block_;
+    // Bytes used in the current block
+    size_t used_;
+    // Objects to destroy, linked from the most recent one
+    ObjectBase* objects_;
+
+    void* allocate(size_t size, size_t alignment) {
+        for (; current_block_ < blocks_.size(); current_block_++, used_ = 0) {
+            size_t offset { (used_ + alignment - 1) / alignment * alignment };
+            if (offset + size <= blocks_[current_block_].size) {
+                used_ = offset + size;
+                return blocks_[current_block_].data.get() + offset;
+            }
+        }
+        // new[] aligns for any fundamental type
+        size_t block_size { size > BLOCK_SIZE ? size : BLOCK_SIZE };
+        blocks_.push_back(Block { std::unique_ptr<char[]>(new char[block_size]),
+                                  block_size });
+        used_ = size;
+        return blocks_.back().data.get();
+    }
+};
+
+// Flags and actions are owned by the definitions arena of their
+// HorseWhisperer
+struct Action {
+    // Action name
+    std::string name;
+    // Keys local to the action
+    std::map<std::string, FlagBase*> flags;
+    // Distinct flags of the action, in definition order
+    std::vector<FlagBase*> flag_list;
+    // Action description
+    std::string description;
+    // Arity of the action
+    int arity;
+    // Function called when we invoke the action
+    ActionCallback action_callback;
+    // Function called when we validate action arguments
+    ArgumentsCallback arguments_callback;
+    // As above, receiving the arguments as views; used instead of the
+    // Arguments flavoured callbacks when set
+    ActionViewCallback action_view_callback;
+    ArgumentsViewCallback arguments_view_callback;
+    // As above, receiving the context of the action; used instead of the
+    // other action callbacks when set
+    ActionContextCallback action_context_callback;
+    // Set for asynchronous actions, instead of the action callbacks above
+    AsyncActionCallback async_callback;
+    // Set for streaming actions, which do not have the callbacks above
+    ActionStreamCallback action_stream_callback;
+    // Whether the action only depends on the actions listed in
+    // dependencies, rather than on all the actions preceding it; see
+    // SetActionDependencies
+    bool has_dependencies;
+    std::vector<std::string> dependencies;
+    // Time after which the running action is cancelled; zero for the
+    // --action-timeout flag value. See SetActionTimeout
+    std::chrono::milliseconds timeout;
+    // Whether the results of the action are cached, keyed by its
+    // arguments, flags and inputs; see SetActionCacheable
+    bool cacheable;
+    // Files read by the action, if declared
+    ActionInputsCallback inputs;
+    // Context sensitive action help
+    std::string help_string_;
+    // Wheter the action succeded
+    bool success;
+    // Whenter the action can be chained with other actions
+    bool chainable;
+};
+
+static FlagType getTypeOfFlag(const FlagBase* flagp);
+
+struct Context;
+
+//
+// Lookup tables
+//
+
+// Minimal perfect hash over a fixed set of distinct keys (hash and
+// displace). Keys are hashed once; each bucket stores either a seed that
+// displaces its keys into free slots or, for single key buckets, the slot
+// itself. A lookup costs one hash, one bucket read and one key compare.
+class PerfectHashTable {
+  public:
+    PerfectHashTable() : salt_ { 0 } {}
+
+    // Return the index of the key in the vector passed to build(), or
+    // NAME_NOT_FOUND
+    int find(const char* key, size_t size) const {
+        if (slots_.empty()) {
+            return NAME_NOT_FOUND;
+        }
+        uint64_t hash { hashKey(key, size, salt_) };
+        const Slot& slot = slots_[slotOf(hash)];
+        if (slot.size == size && std::memcmp(&keys_[slot.offset], key, size) == 0) {
+            return slot.id;
+        }
+        return NAME_NOT_FOUND;
+    }
+
+    void build(const std::vector<std::string>& keys) {
+        for (salt_ = 0; !tryBuild(keys); salt_++);
+    }
+
+    size_t size() const {
+        return slots_.size();
+    }
+
+  private:
+    struct Slot {
+        uint32_t offset;
+        uint32_t size;
+        int id;
+    };
+
+    uint64_t salt_;
+    // Per bucket: >= 0 displacement seed, < 0 direct slot (-slot - 1)
+    std::vector<int64_t> buckets_;
+    std::vector<Slot> slots_;
+    // Keys, stored contiguously
+    std::string keys_;
+
+    static uint64_t hashKey(const char* key, size_t size, uint64_t salt) {
+        // FNV-1a
+        uint64_t hash { 14695981039346656037ULL ^ salt };
+        for (size_t i = 0; i < size; i++) {
+            hash ^= static_cast<unsigned char>(key[i]);
+            hash *= 1099511628211ULL;
+        }
+        return hash;
+    }
+
+    static uint64_t mix(uint64_t hash, uint64_t seed) {
+        // splitmix64 finalizer
+        uint64_t z { hash + (seed + 1) * 0x9E3779B97F4A7C15ULL };
+        z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+        return z ^ (z >> 31);
+    }
+
+    size_t slotOf(uint64_t hash) const {
+        int64_t bucket { buckets_[hash % buckets_.size()] };
+        if (bucket < 0) {
+            return static_cast<size_t>(-bucket - 1);
+        }
+        return mix(hash, bucket) % slots_.size();
+    }
+
+    bool tryBuild(const std::vector<std::string>& keys) {
+        size_t n { keys.size() };
+        std::vector<uint64_t> hashes(n);
+        std::vector<std::vector<size_t>> members(n / 2 + 1);
+
+        for (size_t i = 0; i < n; i++) {
+            hashes[i] = hashKey(keys[i].data(), keys[i].size(), salt_);
+            members[hashes[i] % members.size()].push_back(i);
+        }
+
+        // Place the largest buckets first, while most slots are free
+        std::vector<size_t> order(members.size());
+        for (size_t b = 0; b < order.size(); b++) {
+            order[b] = b;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [&members](size_t a, size_t b) {
+                            return members[a].size() > members[b].size(); });
+
+        buckets_.assign(members.size(), 0);
+        std::vector<int> taken(n, -1);
+        std::vector<size_t> candidate {};
+        size_t next_free { 0 };
+
+        for (size_t b : order) {
+            const std::vector<size_t>& bucket = members[b];
+            if (bucket.empty()) {
+                break;
+            } else if (bucket.size() == 1) {
+                while (taken[next_free] >= 0) {
+                    next_free++;
+                }
+                taken[next_free] = static_cast<int>(bucket[0]);
+                buckets_[b] = -static_cast<int64_t>(next_free) - 1;
+                continue;
+            }
+
+            bool placed { false };
+            for (int64_t seed = 0; seed < (1 << 20) && !placed; seed++) {
+                candidate.clear();
+                placed = true;
+                for (size_t key : bucket) {
+                    size_t slot { mix(hashes[key], seed) % n };
+                    if (taken[slot] >= 0 || std::find(candidate.begin(),
+                            candidate.end(), slot) != candidate.end()) {
+                        placed = false;
+                        break;
+                    }
+                    candidate.push_back(slot);
+                }
+                if (placed) {
+                    for (size_t k = 0; k < bucket.size(); k++) {
+                        taken[candidate[k]] = static_cast<int>(bucket[k]);
+                    }
+                    buckets_[b] = seed;
+                }
+            }
+
+            if (!placed) {
+                // Identical hashes; retry with another salt
+                return false;
+            }
+        }
+
+        keys_.clear();
+        slots_.assign(n, Slot {});
+        for (size_t slot = 0; slot < n; slot++) {
+            const std::string& key = keys[taken[slot]];
+            slots_[slot] = Slot { static_cast<uint32_t>(keys_.size()),
+                                  static_cast<uint32_t>(key.size()),
+                                  taken[slot] };
+            keys_ += key;
+        }
+
+        return true;
+    }
+};
+
+// Small set of tokens, such as the delimiters. A table of the first bytes
+// of the tokens rejects most other tokens without comparing them.
+class TokenSet {
+  public:
+    TokenSet() : has_empty_ { false } {}
+
+    void assign(const std::vector<std::string>& tokens) {
+        tokens_ = tokens;
+        first_bytes_.reset();
+        has_empty_ = false;
+        for (const auto& token : tokens_) {
+            if (token.empty()) {
+                has_empty_ = true;
+            } else {
+                first_bytes_.set(static_cast<unsigned char>(token[0]));
+            }
+        }
+    }
+
+    void clear() {
+        assign(std::vector<std::string> {});
+    }
+
+    bool contains(StringView token) const {
+        if (token.empty()) {
+            return has_empty_;
+        } else if (!first_bytes_[static_cast<unsigned char>(token[0])]) {
+            return false;
+        }
+        for (const auto& candidate : tokens_) {
+            if (token == StringView { candidate }) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+  private:
+    std::vector<std::string> tokens_;
+    std::bitset<256> first_bytes_;
+    bool has_empty_;
+};
+
+//
+// Pipelines
+//
+
+// Bounded queue of the records written by an action of a pipeline for the
+// next one, with a single writer thread and a single reader thread, which
+// don't lock while records flow. Writes wait while the queue is full, so
+// that an action can't run ahead of the next one by more than the
+// capacity, and reads while it is empty. A waiting side spins, yields,
+// then blocks on a condition variable, so that waiting for a slow or I/O
+// bound neighbour doesn't burn a core; the other side only locks to wake
+// it up when it is blocked.
+class RecordQueue {
+  public:
+    explicit RecordQueue(size_t capacity)
+            : slots_(capacity),
+              mask_ { capacity - 1 },
+              head_ { 0 },
+              tail_ { 0 },
+              writer_done_ { false },
+              reader_done_ { false },
+              sleepers_ { 0 } {
+        assert((capacity & mask_) == 0);
+    }
+
+    // Return false, dropping the record, once the reader is done
+    bool write(std::string& record) {
+        size_t tail { tail_.load(std::memory_order_relaxed) };
+        auto full = [this, tail]() {
+            return tail - head_.load(std::memory_order_acquire) == slots_.size();
+        };
+        for (size_t spins = 0; full(); spins++) {
+            if (reader_done_.load(std::memory_order_acquire)) {
+                return false;
+            }
+            backOff(spins, [this, &full]() {
+                return !full() || reader_done_.load(std::memory_order_acquire); });
+        }
+        // The reader left the buffer of the record it read in the slot
+        slots_[tail & mask_].swap(record);
+        tail_.store(tail + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    // Return false once the writer is done and every record has been read
+    bool read(std::string& record) {
+        size_t head { head_.load(std::memory_order_relaxed) };
+        auto empty = [this, head]() {
+            return tail_.load(std::memory_order_acquire) == head;
+        };
+        for (size_t spins = 0; empty(); spins++) {
+            // Records written before closing are visible once closed
+            if (writer_done_.load(std::memory_order_acquire) && empty()) {
+                return false;
+            }
+            backOff(spins, [this, &empty]() {
+                return !empty() || writer_done_.load(std::memory_order_acquire); });
+        }
+        record.swap(slots_[head & mask_]);
+        head_.store(head + 1, std::memory_order_release);
+        wake();
+        return true;
+    }
+
+    void closeWriter() {
+        writer_done_.store(true, std::memory_order_release);
+        wake();
+    }
+
+    void closeReader() {
+        reader_done_.store(true, std::memory_order_release);
+        wake();
+    }
+
+  private:
+    std::vector<std::string> slots_;
+    const size_t mask_;
+    // Next record to read, written by the reader, and next record to write,
+    // written by the writer; padded apart so that they don't share a cache
+    // line
+    std::atomic<size_t> head_;
+    char head_padding_[64];
+    std::atomic<size_t> tail_;
+    char tail_padding_[64];
+    std::atomic<bool> writer_done_;
+    std::atomic<bool> reader_done_;
+    // Threads blocked in backOff, woken up through ready_
+    std::atomic<int> sleepers_;
+    std::mutex mutex_;
+    std::condition_variable ready_;
+
+    // Wait after spins unsuccessful attempts, blocking until ready() once
+    // spinning and yielding didn't do
+    template <typename Ready>
+    void backOff(size_t spins, Ready ready) {
+        if (spins < PIPE_SPINS) {
+            return;
+        } else if (spins < PIPE_SPINS + PIPE_YIELDS) {
+            std::this_thread::yield();
+            return;
+        }
+        std::unique_lock<std::mutex> lock { mutex_ };
+        sleepers_.fetch_add(1);
+        // Pairs with the fence of wake(): either wake() sees the sleeper,
+        // or ready() sees the change made before wake()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        ready_.wait(lock, ready);
+        sleepers_.fetch_sub(1);
+    }
+
+    // Wake up the other side if it is blocked in backOff
+    void wake() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (sleepers_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            ready_.notify_all();
+        }
+    }
+};
+
+//
+// Cancellation
+//
+
+// Why an action was cancelled
+enum class CancelReason { None, Deadline, Interrupted };
+
+// Cancellation of a running action, shared by the action, its ActionContext
+// and the Watchdog. The first cancel() wins; it runs the callbacks
+// registered with onCancel on the cancelling thread.
+class Cancellation {
+  public:
+    Cancellation() : reason_ { static_cast<int>(CancelReason::None) } {}
+
+    // Return false if already cancelled
+    bool cancel(CancelReason reason) {
+        std::vector<std::function<void()>> callbacks {};
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            int none { static_cast<int>(CancelReason::None) };
+            if (!reason_.compare_exchange_strong(none, static_cast<int>(reason))) {
+                return false;
+            }
+            callbacks.swap(callbacks_);
+        }
+        for (auto& callback : callbacks) {
+            callback();
+        }
+        return true;
+    }
+
+    bool cancelled() const {
+        return reason() != CancelReason::None;
+    }
+
+    CancelReason reason() const {
+        return static_cast<CancelReason>(reason_.load(std::memory_order_acquire));
+    }
+
+    // Call callback once cancelled; right away if already cancelled
+    void onCancel(std::function<void()> callback) {
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            if (!cancelled()) {
+                callbacks_.push_back(std::move(callback));
+                return;
+            }
+        }
+        callback();
+    }
+
+  private:
+    std::atomic<int> reason_;
+    std::mutex mutex_;
+    std::vector<std::function<void()>> callbacks_;
+};
+
+// What an action checks to stop early, as returned by
+// ActionContext::cancellation(). Actions that are never cancelled, because
+// they have no deadline and signals are not handled, get an empty token.
+class CancellationToken {
+  public:
+    CancellationToken() {}
+
+    explicit CancellationToken(std::shared_ptr<Cancellation> cancellation)
+            : cancellation_ { std::move(cancellation) } {}
+
+    bool cancelled() const {
+        return cancellation_ && cancellation_->cancelled();
+    }
+
+    CancelReason reason() const {
+        return cancellation_ ? cancellation_->reason() : CancelReason::None;
+    }
+
+    // Call callback, e.g. to abort a blocking call, once cancelled
+    void onCancel(std::function<void()> callback) const {
+        if (cancellation_) {
+            cancellation_->onCancel(std::move(callback));
+        }
+    }
+
+  private:
+    std::shared_ptr<Cancellation> cancellation_;
+};
+
+// Cancels the watched actions once their deadline passes or, while
+// signals are handled (see HorseWhisperer::setCancelOnSignals), once
+// SIGINT or SIGTERM is received. Its thread starts with the first watched
+// action; it sleeps until the next deadline, polling the signal count
+// while signals are handled, as the signal handler can do nothing but
+// count.
+class Watchdog {
+  public:
+    typedef std::chrono::steady_clock Clock;
+
+    Watchdog() : next_id_ { 0 }, stopping_ { false } {}
+
+    ~Watchdog() {
+        {
+            std::lock_guard<std::mutex> lock { mutex_ };
+            stopping_ = true;
+        }
+        changed_.notify_one();
+        if (thread_.joinable()) {
+            thread_.join();
+        }
+    }
+
+    // Cancel cancellation at deadline (Clock::time_point::max() for none),
+    // or when a signal is received, until unwatch(id)
+    size_t watch(std::shared_ptr<Cancellation> cancellation,
+                 Clock::time_point deadline) {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        if (!thread_.joinable()) {
+            thread_ = std::thread { [this]() { run(); } };
+        }
+        size_t id { next_id_++ };
+        watched_.emplace(id, Watched { std::move(cancellation), deadline,
+                                       signalCount().load() });
+        changed_.notify_one();
+        return id;
+    }
+
+    void unwatch(size_t id) {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        watched_.erase(id);
+    }
+
+    // Number of SIGINT and SIGTERM received while handled; constant
+    // initialized, so that the signal handler can use it
+    static std::atomic<unsigned>& signalCount() {
+        static std::atomic<unsigned> count { 0 };
+        return count;
+    }
+
+    static std::atomic<bool>& handlingSignals() {
+        static std::atomic<bool> handling { false };
+        return handling;
+    }
+
+#ifndef _WIN32
+    // Count SIGINT and SIGTERM, cancelling the watched actions, instead of
+    // terminating; restore the previous handlers unless enable
+    static void handleSignals(bool enable) {
+        SignalHandlers& handlers = signalHandlers();
+        std::lock_guard<std::mutex> lock { handlers.mutex };
+        if (enable == handlingSignals().load()) {
+            return;
+        }
+        if (enable) {
+            installSignalHandlers(handlers.previous);
+            handlingSignals().store(true);
+        } else {
+            handlingSignals().store(false);
+            sigaction(SIGINT, &handlers.previous[0], nullptr);
+            sigaction(SIGTERM, &handlers.previous[1], nullptr);
+        }
+    }
+
+    // Handle the next signal, if signals are handled; the handlers are
+    // reset by the signal they handle, so that a second signal terminates
+    // the process as usual. Sessions start their chains on any thread:
+    // the first one seeing a signal since the handlers were installed
+    // reinstalls them, under the lock of handleSignals.
+    static void rearmSignalHandlers() {
+        SignalHandlers& handlers = signalHandlers();
+        if (!handlingSignals().load()
+                || signalCount().load() == handlers.armed_count.load()) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock { handlers.mutex };
+        if (handlingSignals().load()
+                && signalCount().load() != handlers.armed_count.load()) {
+            installSignalHandlers(nullptr);
+        }
+    }
+#endif
+
+  private:
+#ifndef _WIN32
+    struct SignalHandlers {
+        // Handlers of SIGINT and SIGTERM before handleSignals
+        struct sigaction previous[2];
+        // Signal count when the handlers were installed
+        std::atomic<unsigned> armed_count;
+        // Held while installing or restoring the handlers
+        std::mutex mutex;
+    };
+
+    static SignalHandlers& signalHandlers() {
+        static SignalHandlers handlers {};
+        return handlers;
+    }
+
+    static void installSignalHandlers(struct sigaction* previous) {
+        // Counted before installing, so that a signal received meanwhile
+        // rearms the handlers again
+        unsigned count { signalCount().load() };
+        struct sigaction action {};
+        action.sa_handler = [](int) {
+            signalCount().fetch_add(1);
+        };
+        sigemptyset(&action.sa_mask);
+        action.sa_flags = SA_RESETHAND | SA_RESTART;
+        sigaction(SIGINT, &action, previous);
+        sigaction(SIGTERM, &action, previous ? previous + 1 : nullptr);
+        signalHandlers().armed_count.store(count);
+    }
+#endif
+
+    struct Watched {
+        std::shared_ptr<Cancellation> cancellation;
+        Clock::time_point deadline;
+        // Signal count when watched
+        unsigned signals;
+    };
+
+    std::map<size_t, Watched> watched_;
+    size_t next_id_;
+    bool stopping_;
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    std::thread thread_;
+
+    void run() {
+        std::unique_lock<std::mutex> lock { mutex_ };
+        while (!stopping_) {
+            Clock::time_point wake { Clock::time_point::max() };
+            for (auto& k_v : watched_) {
+                wake = std::min(wake, k_v.second.deadline);
+            }
+            if (!watched_.empty() && handlingSignals().load()) {
+                wake = std::min(wake, Clock::now()
+                                      + std::chrono::milliseconds(SIGNAL_POLL_MS));
+            }
+            if (wake == Clock::time_point::max()) {
+                changed_.wait(lock);
+            } else {
+                changed_.wait_until(lock, wake);
+            }
+
+            // Cancel outside the lock, as the callbacks may unwatch
+            std::vector<std::pair<std::shared_ptr<Cancellation>, CancelReason>> due {};
+            Clock::time_point now { Clock::now() };
+            unsigned signals { signalCount().load() };
+            for (auto it = watched_.begin(); it != watched_.end();) {
+                if (it->second.signals != signals) {
+                    due.emplace_back(it->second.cancellation, CancelReason::Interrupted);
+                } else if (it->second.deadline <= now) {
+                    due.emplace_back(it->second.cancellation, CancelReason::Deadline);
+                } else {
+                    ++it;
+                    continue;
+                }
+                it = watched_.erase(it);
+            }
+            if (!due.empty()) {
+                lock.unlock();
+                for (auto& cancellation : due) {
+                    cancellation.first->cancel(cancellation.second);
+                }
+                lock.lock();
+            }
+        }
+    }
+};
+
+// A flag definition together with the context holding its value: the
+// global context of the session for global flags
+struct FlagRef {
+    FlagBase* flag;
+    Context* context;
+};
+
+// What a name stands for, once definitions are sealed
+struct Symbol {
+    // Action with this name, if any
+    Action* action;
+    // Global flag with this alias, if any
+    FlagBase* global_flag;
+    // Action flags with this alias and their actions
+    std::vector<std::pair<const Action*, FlagBase*>> action_flags;
+};
+
+struct Context {
+    // Flags set in this context: global flags in the global context, action
+    // flags in action contexts. Flags that are not listed keep the default
+    // value stored in their definition, so that chaining an action does not
+    // copy its flags.
+    std::vector<FlagValue> values;
+    // What this context is doing; nullptr for the global context
+    Action* action;
+    // Action arguments, referring to the parsed argv
+    std::vector<StringView> argument_views;
+    // Copy of the action arguments, filled only for actions having an
+    // Arguments flavoured callback
+    Arguments arguments;
+    // Arguments of a streaming action, which also owns the rest of the
+    // command line, parsed once the action has read its arguments
+    std::unique_ptr<ArgumentStream> argument_stream;
+    // Queues from the previous action and to the next action of the
+    // pipeline of the context, if any
+    std::shared_ptr<RecordQueue> input;
+    std::shared_ptr<RecordQueue> output;
+    // Cancellation of the running action, if it can be cancelled
+    std::shared_ptr<Cancellation> cancellation;
+    // Output written by the running action, while its result is cached
+    std::unique_ptr<std::string> captured_output;
+
+    std::string toString() {
+        std::stringstream ss {};
+        ss << "Action " << action->name;
+        if (argument_views.size() > 0) {
+            ss << "  - arguments:";
+            for (auto& arg : argument_views) {
+                ss << " " << arg;
+            }
+        }
+        for (auto& k_v : action->flags) {
+            ss << "\n  flag " << k_v.first << ": ";
+            ValuePrinter printer { ss, *this, k_v.second };
+            visitFlagType(getTypeOfFlag(k_v.second), printer);
+        }
+        return ss.str();
+    }
+
+    struct ValuePrinter {
+        std::ostream& os;
+        Context& context;
+        const FlagBase* flag;
+
+        template <typename Type>
+        void visit() {
+            os << context.get(static_cast<const Flag<Type>*>(flag));
+        }
+    };
+
+    // Value of an action flag in this context
+    template <typename Type>
+    const Type& get(const Flag<Type>* flag) {
+        for (auto& v : values) {
+            if (v.flag == flag) {
+                return FlagTraits<Type>::value(v);
+            }
+        }
+        return flag->value;
+    }
+
+    template <typename Type>
+    void set(const Flag<Type>* flag, Type value) {
+        for (auto& v : values) {
+            if (v.flag == flag) {
+                FlagTraits<Type>::value(v) = value;
+                return;
+            }
+        }
+        values.push_back(FlagValue {});
+        values.back().flag = flag;
+        FlagTraits<Type>::value(values.back()) = value;
+    }
+};
+
+// Contexts are owned by the arena of their session
+typedef Context* ContextPtr;
+
+// Outcome of a batch run
+struct BatchResult {
+    // Line number and exit code of each executed command line
+    std::vector<std::pair<size_t, int>> exit_codes;
+    // Number of command lines that exited with a non zero code
+    size_t failures;
+    // Wall time of the run
+    double seconds;
+
+    double commandsPerSecond() const {
+        return seconds > 0 ? exit_codes.size() / seconds : 0;
+    }
+};
+
+class HorseWhisperer;
+struct SessionState;
+
+// Typed reference to a defined flag, as returned by DefineGlobalFlag and
+// DefineActionFlag. Reads and writes resolve directly to the value of the
+// active context, without looking up the flag name. A handle is
+// invalidated by Reset().
+template <typename Type>
+class FlagHandle {
+  public:
+    FlagHandle() : owner_ { nullptr }, action_ { nullptr }, flag_ { nullptr } {}
+
+    FlagHandle(HorseWhisperer* owner, const Action* action, Flag<Type>* flag)
+            : owner_ { owner }, action_ { action }, flag_ { flag } {}
+
+    // Throws undefined_flag_error if the handle refers to an action flag
+    // and the active context belongs to a different action
+    Type get() const;
+
+    // Throws undefined_flag_error as get() and flag_validation_error in
+    // case the flag callback returns false
+    void set(Type value) const;
+
+    bool isValid() const { return flag_ != nullptr; }
+
+    // As get(), reading the flag in the given action context rather than
+    // in the active one
+    Type get(const ActionContext& context) const;
+
+  private:
+    HorseWhisperer* owner_;
+    // Owning action; nullptr for global flags
+    const Action* action_;
+    // Flag definition
+    Flag<Type>* flag_;
+};
+
+// Context an action runs in, as passed to ActionContextCallback. Reads go
+// to the Context of the action rather than to the active context, and
+// take no lock, so that the action may hand them to other threads while
+// other chained actions run. The action context, like the arguments it
+// refers to, is valid until the action callback returns or, for
+// asynchronous actions, until the action calls done.
+class ActionContext {
+  public:
+    ActionContext(SessionState* session, Context* context)
+            : session_ { session },
+              context_ { context },
+              arguments_ { context->argument_views } {}
+
+    const std::string& actionName() const;
+
+    const ArgumentsView& arguments() const { return arguments_; }
+
+    // Value of the action flag, or else of the global flag, named so.
+    // Throws undefined_flag_error in case the flag is unknown.
+    template <typename Type>
+    Type getFlag(const std::string& flag_name) const;
+
+    // Read the next record written by the previous action of the pipeline,
+    // waiting for it. Return false once that action has returned and its
+    // records have been read, or if the action is not piped from another.
+    bool read(std::string& record) const;
+
+    // Write a record for the next action of the pipeline, waiting while its
+    // queue is full; without a next action, write the record to stdout as a
+    // line. Return false if the next action has returned.
+    bool write(std::string record) const;
+
+    // Set once the action must stop: its deadline passed or the command
+    // line was interrupted. read and write then return false. An action
+    // that was cancelled fails with ACTION_CANCELLED, whatever it returns.
+    CancellationToken cancellation() const;
+
+    bool cancelled() const;
+
+  private:
+    template <typename Type>
+    friend class FlagHandle;
+
+    SessionState* session_;
+    Context* context_;
+    ArgumentsView arguments_;
+};
+
+//
+// API Declarations
+//
+
+template <typename Type>
+static FlagHandle<Type> DefineGlobalFlag(std::string aliases,
+                                         std::string description,
+                                         Type default_value,
+                                         FlagCallback<Type> flag_callback) __attribute__ ((unused));
+template <typename Type>
+static FlagHandle<Type> DefineActionFlag(std::string action_name,
+                             std::string aliases,
+                             std::string description,
+                             Type default_value,
+                             FlagCallback<Type> flag_callback) __attribute__ ((unused));
+static bool IsActionFlag(std::string action, std::string flagname) __attribute__ ((unused));
+template <typename Type>
+static Type GetFlag(std::string flag_name) __attribute__ ((unused));
+// Throws undefined_flag_error in case the specified flag is unknown
+static FlagType GetFlagType(std::string flag_name) __attribute__ ((unused));
+template <typename Type>
+static void SetFlag(std::string flag_name, Type value) __attribute__ ((unused));
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionCallback action_callback,
+                         ArgumentsCallback arguments_callback) __attribute__ ((unused));
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionViewCallback action_callback,
+                         ArgumentsViewCallback arguments_callback) __attribute__ ((unused));
+// Throws horsewhisperer_error if arity is not negative
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionStreamCallback action_callback) __attribute__ ((unused));
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionContextCallback action_callback,
+                         ArgumentsViewCallback arguments_callback) __attribute__ ((unused));
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         AsyncActionCallback action_callback,
+                         ArgumentsViewCallback arguments_callback) __attribute__ ((unused));
+// Throws horsewhisperer_error in case the specified action is unknown
+static void SetActionDependencies(std::string action_name,
+                                  std::vector<std::string> dependencies) __attribute__ ((unused));
+// Throws horsewhisperer_error in case the specified action is unknown
+static void SetActionTimeout(std::string action_name,
+                             unsigned int milliseconds) __attribute__ ((unused));
+#ifndef _WIN32
+static void SetCancelOnSignals(bool enable) __attribute__ ((unused));
+#endif
+// Throws horsewhisperer_error in case the specified action is unknown
+static void SetActionCacheable(std::string action_name, bool cacheable) __attribute__ ((unused));
+// Throws horsewhisperer_error in case the specified action is unknown
+static void SetActionInputs(std::string action_name,
+                            ActionInputsCallback inputs) __attribute__ ((unused));
+static void SetCacheDirectory(std::string directory) __attribute__ ((unused));
+static void StopWatching() __attribute__ ((unused));
+static void SetWatchDebounce(unsigned int milliseconds) __attribute__ ((unused));
+// Throws horsewhisperer_error if a static schema is already defined
+static void DefineStaticSchema(const StaticSchema& schema) __attribute__ ((unused));
+static void SetAppName(std::string name) __attribute__ ((unused));
+static void SetHelpBanner(std::string banner) __attribute__ ((unused));
+static void SetVersion(std::string version) __attribute__ ((unused));
+static void SetDelimiters(std::vector<std::string> delimiters) __attribute__ ((unused));
+static void SetPipeDelimiters(std::vector<std::string> delimiters) __attribute__ ((unused));
+static int Parse(int argc, char** argv) __attribute__ ((unused));
+static void Seal() __attribute__ ((unused));
+static bool ValidateActionArguments() __attribute__ ((unused));
+static void ShowHelp() __attribute__ ((unused));
+static void ShowVersion() __attribute__ ((unused));
+static std::vector<std::string> GetParsedActions() __attribute__ ((unused));
+static int Start() __attribute__ ((unused));
+static int StartAsync(std::function<void()> on_progress) __attribute__ ((unused));
+static int Step() __attribute__ ((unused));
+static BatchResult RunBatch(std::istream& input) __attribute__ ((unused));
+static int StartBatch(std::string path) __attribute__ ((unused));
+#ifndef _WIN32
+static int StartDaemon(std::string socket_path) __attribute__ ((unused));
+static int ForwardToDaemon(std::string socket_path,
+                           int argc,
+                           char** argv,
+                           std::vector<std::string> environment) __attribute__ ((unused));
+#endif
+static void Reset() __attribute__ ((unused));
+static void SetHelpMargins(unsigned int left_margin,
+                           unsigned int right_margin) __attribute__ ((unused));
+static void StartTracing() __attribute__ ((unused));
+static void StopTracing() __attribute__ ((unused));
+static void WriteTrace(std::ostream& output) __attribute__ ((unused));
+static bool WriteTraceFile(std::string path) __attribute__ ((unused));
+static void SetOutputSink(OutputSink* sink) __attribute__ ((unused));
+static void Flush() __attribute__ ((unused));
+static std::vector<Diagnostic> GetDiagnostics() __attribute__ ((unused));
+
+//
+// Auxiliary Functions
+//
+
+static bool isCommandLineBlank(char c) {
+    return c == ' ' || c == '\t' || c == '\r' || c == '\n';
+}
+
+// Characters needing no special handling within a command line token,
+// i.e. all but blanks, quotes, backslashes and NUL
+struct CommandLinePlainChars {
+    bool plain[256];
+
+    CommandLinePlainChars() {
+        for (int c = 0; c < 256; c++) {
+            plain[c] = c != 0 && !std::strchr(" \t\r\n'\"\\", c);
+        }
+    }
+
+    bool operator()(char c) const {
+        return plain[static_cast<unsigned char>(c)];
+    }
+
+    // Mark the high bit of the characters of word that may not be plain:
+    // control characters, blanks, quotes and backslashes. The marks are
+    // exact up to the first marked character, in memory order.
+    static uint64_t markSpecial(uint64_t word) {
+        static const uint64_t ONES = 0x0101010101010101ULL;
+        static const uint64_t HIGHS = 0x8080808080808080ULL;
+        auto markZero = [](uint64_t w) { return (w - ONES) & ~w & HIGHS; };
+        return ((word - ONES * 0x21) & ~word & HIGHS)
+               | markZero(word ^ (ONES * '\''))
+               | markZero(word ^ (ONES * '"'))
+               | markZero(word ^ (ONES * '\\'));
+    }
+};
+
+// Read the next token of a command line from [p, end), as a POSIX shell
+// would without expansions: tokens are separated by blanks, characters
+// within single quotes are literal, a backslash escapes the next
+// character, except within single quotes, and within double quotes only
+// escapes a double quote or a backslash. Quotes and escapes are removed
+// in place, so token refers to the buffer, which is only written for
+// tokens containing them; quoted tells whether that was the case.
+// Return TOKEN_OK, TOKEN_END or TOKEN_UNTERMINATED_QUOTE.
+static int nextCommandLineToken(char*& p, char* end, StringView& token,
+                                bool& quoted) {
+    while (p != end && isCommandLineBlank(*p)) {
+        ++p;
+    }
+    if (p == end) {
+        return TOKEN_END;
+    }
+
+    // Fast path: plain characters are left in place
+    static const CommandLinePlainChars is_plain {};
+    char* start = p;
+    uint64_t word;
+    while (end - p >= 8) {
+        std::memcpy(&word, p, sizeof(word));
+        uint64_t marks { CommandLinePlainChars::markSpecial(word) };
+        if (marks) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+            p += __builtin_ctzll(marks) / 8;
+#endif
+            break;
+        }
+        p += 8;
+    }
+    while (p != end && is_plain(*p)) {
+        ++p;
+    }
+    quoted = false;
+    if (p == end || isCommandLineBlank(*p)) {
+        token = StringView { start, static_cast<size_t>(p - start) };
+        return TOKEN_OK;
+    }
+
+    char* w = p;
+    auto put = [&w, &p](char c) {
+        if (w != p) {
+            *w = c;
+        }
+        ++w;
+    };
+    char quote { '\0' };
+    quoted = true;
+
+    for (; p != end; ++p) {
+        char c { *p };
+        if (quote == '\'') {
+            if (c == '\'') {
+                quote = '\0';
+            } else {
+                put(c);
+            }
+        } else if (quote == '"') {
+            if (c == '"') {
+                quote = '\0';
+            } else if (c == '\\' && p + 1 != end && (p[1] == '"' || p[1] == '\\')) {
+                put(*++p);
+            } else {
+                put(c);
+            }
+        } else if (isCommandLineBlank(c)) {
+            break;
+        } else if (c == '\'' || c == '"') {
+            quote = c;
+        } else if (c == '\\' && p + 1 != end) {
+            put(*++p);
+        } else {
+            put(c);
+        }
+    }
+
+    token = StringView { start, static_cast<size_t>(w - start) };
+    return quote == '\0' ? TOKEN_OK : TOKEN_UNTERMINATED_QUOTE;
+}
+
+// Split a command line in tokens with the nextCommandLineToken rules.
+// Return false for unterminated quotes.
+static bool tokenizeCommandLine(const std::string& line,
+                                std::vector<std::string>& tokens) {
+    std::string buffer { line };
+    char* p = &buffer[0];
+    char* end = p + buffer.size();
+    StringView token {};
+    bool quoted { false };
+    int result;
+
+    while ((result = nextCommandLineToken(p, end, token, quoted)) != TOKEN_END) {
+        tokens.push_back(token.str());
+        if (result == TOKEN_UNTERMINATED_QUOTE) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Split txt in lines shorter than width where possible, breaking lines at
+// each space. Consecutive spaces separate empty words.
+static std::vector<std::string> wordWrap(const std::string& txt,
+                                         const unsigned int width) {
+    std::vector<std::string> lines {};
+    std::string current_word {};
+    std::string current_line {};
+
+    for (size_t begin = 0; begin < txt.size();) {
+        size_t end { std::min(txt.find(' ', begin), txt.size()) };
+        current_word.assign(txt, begin, end - begin);
+        begin = end + 1;
+        if (current_line.size() + current_word.size() >= width) {
+            lines.push_back(current_line);
+            current_line = current_word;
+        } else {
+            if (!current_line.empty()) {
+                current_line += ' ';
+            }
+            current_line += current_word;
+        }
+    }
+
+    if (!current_line.empty()) {
+        lines.push_back(current_line);
+    }
+
+    return lines;
+}
+
+static FlagType getTypeOfFlag(const FlagBase* flagp) {
+    return flagp->type;
+}
+
+//
+// Response files
+//
+
+// Contents of a file in memory. Regular files are mapped privately, so
+// that pages are only copied when written, which the tokenizer does just
+// for the tokens containing quotes or escapes; other files (e.g. pipes)
+// and all files on Windows are read.
+class MappedFile {
+  public:
+    MappedFile() : data_ { nullptr }, size_ { 0 }, mapped_ { false } {}
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    ~MappedFile() {
+#ifndef _WIN32
+        if (mapped_) {
+            munmap(data_, size_);
+        }
+#endif
+    }
+
+    bool open(const std::string& path) {
+#ifndef _WIN32
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            return false;
+        }
+        struct stat file_status;
+        if (fstat(fd, &file_status) == 0 && S_ISREG(file_status.st_mode)) {
+            size_ = file_status.st_size;
+            void* data = size_ > 0 ? mmap(nullptr, size_, PROT_READ | PROT_WRITE,
+                                          MAP_PRIVATE, fd, 0)
+                                   : nullptr;
+            close(fd);
+            if (data == MAP_FAILED) {
+                return false;
+            }
+            if (data) {
+                madvise(data, size_, MADV_SEQUENTIAL);
+                data_ = static_cast<char*>(data);
+                mapped_ = true;
+            }
+            return true;
+        }
+        close(fd);
+#endif
+        std::ifstream file { path, std::ios::binary };
+        if (!file) {
+            return false;
+        }
+        buffer_.assign(std::istreambuf_iterator<char>(file),
+                       std::istreambuf_iterator<char>());
+        data_ = buffer_.data();
+        size_ = buffer_.size();
+        return !file.bad();
+    }
+
+    char* begin() { return data_; }
+    char* end() { return data_ + size_; }
+
+  private:
+    char* data_;
+    size_t size_;
+    bool mapped_;
+    std::vector<char> buffer_;
+};
+
+//
+// Result cache
+//
+
+// Hash of file contents, eight bytes at a time
+static uint64_t contentHash(const char* data, size_t size) {
+    uint64_t hash { 14695981039346656037ULL ^ size };
+    size_t idx { 0 };
+    for (; idx + sizeof(uint64_t) <= size; idx += sizeof(uint64_t)) {
+        uint64_t word;
+        std::memcpy(&word, data + idx, sizeof(word));
+        hash = (hash ^ word) * 0x9E3779B97F4A7C15ULL;
+        hash ^= hash >> 29;
+    }
+    for (; idx < size; idx++) {
+        hash ^= static_cast<unsigned char>(data[idx]);
+        hash *= 1099511628211ULL;
+    }
+    return hash;
+}
+
+// Results of actions stored in a directory, one file per key. A key is
+// the description of everything the result depends on; entries are named
+// after its hash and store it whole, so that colliding keys miss. Entries
+// are written to a temporary file and renamed, so that processes sharing
+// the directory never read a partial entry.
+class ResultCache {
+  public:
+    struct Result {
+        int exit_code;
+        // What the action wrote through ActionContext::write
+        std::string output;
+    };
+
+    // Caching is disabled while the directory is empty
+    void setDirectory(const std::string& directory) {
+        directory_ = directory;
+    }
+
+    bool enabled() const {
+        return !directory_.empty();
+    }
+
+    bool load(const std::string& key, Result& result) const {
+        MappedFile file {};
+        if (!file.open(pathOf(key))) {
+            return false;
+        }
+        StringView entry { file.begin(), static_cast<size_t>(file.end() - file.begin()) };
+        size_t offset { 0 };
+        StringView stored_key {};
+        StringView exit_code {};
+        StringView output {};
+        if (!readField(entry, offset, stored_key) || stored_key != key
+                || !readField(entry, offset, exit_code)
+                || !readField(entry, offset, output) || offset != entry.size()) {
+            return false;
+        }
+        result.exit_code = std::atoi(exit_code.str().c_str());
+        result.output = output.str();
+        return true;
+    }
+
+    void store(const std::string& key, const Result& result) const {
+#ifndef _WIN32
+        mkdir(directory_.c_str(), 0777);
+#endif
+        std::string path { pathOf(key) };
+        std::ostringstream suffix {};
+        suffix << ".tmp" << std::hex
+               << std::hash<std::thread::id>()(std::this_thread::get_id())
+               << std::chrono::steady_clock::now().time_since_epoch().count();
+        std::string temporary_path { path + suffix.str() };
+        {
+            std::ofstream file { temporary_path, std::ios::binary };
+            writeField(file, key);
+            writeField(file, std::to_string(result.exit_code));
+            writeField(file, result.output);
+            if (!file) {
+                file.close();
+                std::remove(temporary_path.c_str());
+                return;
+            }
+        }
+        if (std::rename(temporary_path.c_str(), path.c_str()) != 0) {
+            std::remove(temporary_path.c_str());
+        }
+    }
+
+  private:
+    std::string directory_;
+
+    std::string pathOf(const std::string& key) const {
+        std::ostringstream path {};
+        path << directory_ << "/" << std::hex << std::setw(16) << std::setfill('0')
+             << contentHash(key.data(), key.size());
+        return path.str();
+    }
+
+    // Fields are stored as their size, a new line and their bytes
+    static void writeField(std::ostream& out, const std::string& field) {
+        out << field.size() << '\n';
+        out.write(field.data(), field.size());
+    }
+
+    static bool readField(StringView entry, size_t& offset, StringView& field) {
+        size_t end_of_size { entry.find('\n', offset) };
+        if (end_of_size == StringView::npos || end_of_size == offset) {
+            return false;
+        }
+        size_t size { 0 };
+        for (size_t idx = offset; idx < end_of_size; idx++) {
+            if (entry[idx] < '0' || entry[idx] > '9') {
+                return false;
+            }
+            size = size * 10 + (entry[idx] - '0');
+        }
+        offset = end_of_size + 1;
+        if (size > entry.size() - offset) {
+            return false;
+        }
+        field = StringView { entry.data() + offset, size };
+        offset += size;
+        return true;
+    }
+};
+
+//
+// Watch mode
+//
+
+// Hash of the contents of the file at path; false if it can't be read
+static bool hashFile(const std::string& path, uint64_t& hash) {
+    MappedFile file {};
+    if (!file.open(path)) {
+        return false;
+    }
+    hash = contentHash(file.begin(), file.end() - file.begin());
+    return true;
+}
+
+#ifndef _WIN32
+// Waits for changes of a set of files. On Linux, the directories of the
+// files are watched with inotify, so that the files replaced by a rename,
+// as editors save them, are seen too; elsewhere the files are polled.
+// stop() may be called from any thread.
+class FileWatcher {
+  public:
+    FileWatcher() : stopped_ { false } {
+        wake_[0] = wake_[1] = -1;
+        if (pipe(wake_) == 0) {
+            fcntl(wake_[0], F_SETFL, O_NONBLOCK);
+        }
+#ifdef __linux__
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+#endif
+    }
+
+    FileWatcher(const FileWatcher&) = delete;
+    FileWatcher& operator=(const FileWatcher&) = delete;
+
+    ~FileWatcher() {
+#ifdef __linux__
+        if (inotify_fd_ >= 0) {
+            close(inotify_fd_);
+        }
+#endif
+        for (int fd : wake_) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+    }
+
+    // Watch the files at paths; return false if one of their directories
+    // can't be watched
+    bool watch(const std::vector<std::string>& paths) {
+        for (auto& path : paths) {
+            size_t slash { path.rfind('/') };
+            std::string directory { slash == std::string::npos ? "."
+                                    : slash == 0 ? "/" : path.substr(0, slash) };
+            std::string name { slash == std::string::npos ? path : path.substr(slash + 1) };
+#ifdef __linux__
+            int wd { inotify_fd_ < 0 ? -1
+                     : inotify_add_watch(inotify_fd_, directory.c_str(),
+                                         IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM
+                                         | IN_CREATE | IN_DELETE) };
+            if (wd < 0) {
+                return false;
+            }
+            files_.emplace(std::make_pair(wd, name), path);
+#else
+            struct stat directory_status;
+            if (stat(directory.c_str(), &directory_status) != 0) {
+                return false;
+            }
+            states_[path] = fileState(path);
+#endif
+        }
+        return true;
+    }
+
+    // Wait for watched files to change, then for debounce to pass without
+    // another change, and return the changed files in changed. Return
+    // false once stopped, or once signals is not the signal count anymore.
+    bool wait(std::chrono::milliseconds debounce, unsigned signals,
+              std::vector<std::string>& changed) {
+        typedef std::chrono::steady_clock Clock;
+        std::set<std::string> changes {};
+        Clock::time_point last_change {};
+        while (!stopped_.load() && Watchdog::signalCount().load() == signals) {
+            int timeout_ms { -1 };
+            if (!changes.empty()) {
+                auto remaining = debounce - (Clock::now() - last_change);
+                if (remaining <= Clock::duration::zero()) {
+                    changed.assign(changes.begin(), changes.end());
+                    return true;
+                }
+                timeout_ms = static_cast<int>(std::chrono::duration_cast<
+                    std::chrono::milliseconds>(remaining).count()) + 1;
+            }
+#ifndef __linux__
+            timeout_ms = timeout_ms < 0 ? WATCH_POLL_MS : std::min(timeout_ms, WATCH_POLL_MS);
+#endif
+            if (Watchdog::handlingSignals().load()) {
+                timeout_ms = timeout_ms < 0 ? SIGNAL_POLL_MS
+                                            : std::min(timeout_ms, SIGNAL_POLL_MS);
+            }
+
+            struct pollfd fds[2] {};
+            fds[0].fd = wake_[0];
+            fds[0].events = POLLIN;
+#ifdef __linux__
+            fds[1].fd = inotify_fd_;
+            fds[1].events = POLLIN;
+#else
+            fds[1].fd = -1;
+#endif
+            if (poll(fds, 2, timeout_ms) < 0 && errno != EINTR) {
+                return false;
+            }
+            if (readChanges(changes)) {
+                last_change = Clock::now();
+            }
+        }
+        return false;
+    }
+
+    void stop() {
+        stopped_.store(true);
+        if (wake_[1] >= 0) {
+            char wake { 0 };
+            ssize_t written = write(wake_[1], &wake, 1);
+            (void) written;
+        }
+    }
+
+  private:
+    std::atomic<bool> stopped_;
+    // Written by stop(), to wake up wait()
+    int wake_[2];
+#ifdef __linux__
+    int inotify_fd_;
+    // Watched paths by watch descriptor of their directory and file name
+    std::multimap<std::pair<int, std::string>, std::string> files_;
+
+    // Add the watched files changed since the last call to changes; return
+    // whether any was
+    bool readChanges(std::set<std::string>& changes) {
+        bool changed { false };
+        alignas(struct inotify_event) char buffer[4096];
+        ssize_t size {};
+        while ((size = read(inotify_fd_, buffer, sizeof(buffer))) > 0) {
+            for (char* p = buffer; p < buffer + size;) {
+                const struct inotify_event* event =
+                    reinterpret_cast<const struct inotify_event*>(p);
+                if (event->len > 0) {
+                    auto range = files_.equal_range(std::make_pair(event->wd,
+                                                                   std::string { event->name }));
+                    for (auto it = range.first; it != range.second; ++it) {
+                        changes.insert(it->second);
+                        changed = true;
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+        return changed;
+    }
+#else
+    // Modification time and size of the watched files, by path; the
+    // size is -1 for missing files
+    std::map<std::string, std::pair<time_t, off_t>> states_;
+
+    static std::pair<time_t, off_t> fileState(const std::string& path) {
+        struct stat file_status;
+        if (stat(path.c_str(), &file_status) != 0) {
+            return std::make_pair(time_t {}, off_t { -1 });
+        }
+        return std::make_pair(file_status.st_mtime, file_status.st_size);
+    }
+
+    bool readChanges(std::set<std::string>& changes) {
+        bool changed { false };
+        for (auto& k_v : states_) {
+            std::pair<time_t, off_t> state { fileState(k_v.first) };
+            if (state != k_v.second) {
+                k_v.second = state;
+                changes.insert(k_v.first);
+                changed = true;
+            }
+        }
+        return changed;
+    }
+#endif
+};
+#endif
+
+// The tokens read by parse: the argv tokens, where each @path token is
+// replaced by the tokens of the response file at path. Response files are
+// tokenized lazily, as their tokens are read, with the
+// nextCommandLineToken rules; they may contain delimiters and the
+// (unquoted) @path tokens of nested response files. The files are added
+// to files, so that their tokens outlive the stream. Errors are passed to
+// on_error.
+class TokenStream {
+  public:
+    TokenStream(int argc, char** argv,
+                std::vector<std::unique_ptr<MappedFile>>& files,
+                DiagnosticCallback on_error)
+            : argc_ { argc },
+              argv_ { argv },
+              next_idx_ { 1 },
+              files_ ( files ),
+              on_error_ { on_error },
+              failed_ { false },
+              peeked_ { false },
+              peek_result_ { false },
+              read_position_ { 0 },
+              position_ { 0 },
+              peeked_position_ { 0 } {}
+
+    // Read the next token; return false at the end and on errors
+    bool next(StringView& token) {
+        if (peeked_) {
+            peeked_ = false;
+            token = peeked_token_;
+            position_ = peeked_position_;
+            return peek_result_;
+        }
+        bool result { read(token) };
+        position_ = read_position_;
+        return result;
+    }
+
+    // Read the next token without consuming it
+    bool peek(StringView& token) {
+        if (!peeked_) {
+            peek_result_ = read(peeked_token_);
+            peeked_position_ = read_position_;
+            peeked_ = true;
+        }
+        token = peeked_token_;
+        return peek_result_;
+    }
+
+    // Whether the stream ended because of an error, already reported
+    bool failed() const {
+        return failed_;
+    }
+
+    // Position of the last token read by next() (see Diagnostic)
+    size_t position() const {
+        return position_;
+    }
+
+    // Number of the next tokens up to the first one satisfying is_end,
+    // counting only the argv tokens before any response file
+    template <typename Predicate>
+    size_t countArgvTokens(Predicate is_end) const {
+        if (!open_files_.empty()) {
+            return peeked_;
+        }
+        size_t count = peeked_;
+        for (int idx = next_idx_; idx < argc_ && argv_[idx][0] != '@'
+                                  && !is_end(StringView { argv_[idx] }); idx++) {
+            ++count;
+        }
+        return count;
+    }
+
+  private:
+    struct OpenFile {
+        std::string path;
+        char* p;
+        char* end;
+    };
+
+    int argc_;
+    char** argv_;
+    int next_idx_;
+    std::vector<std::unique_ptr<MappedFile>>& files_;
+    DiagnosticCallback on_error_;
+    std::vector<OpenFile> open_files_;
+    bool failed_;
+    bool peeked_;
+    bool peek_result_;
+    StringView peeked_token_;
+    // Number of tokens read, including the @path tokens
+    size_t read_position_;
+    size_t position_;
+    size_t peeked_position_;
+
+    void fail(StringView path, const std::string& message) {
+        failed_ = true;
+        on_error_(Diagnostic { DiagnosticCode::InvalidResponseFile, message,
+                               path.str(), read_position_ });
+    }
+
+    static bool isResponseFile(StringView token) {
+        return token.size() > 1 && token[0] == '@';
+    }
+
+    bool read(StringView& token) {
+        while (!failed_) {
+            if (open_files_.empty()) {
+                if (next_idx_ >= argc_) {
+                    return false;
+                }
+                token = StringView { argv_[next_idx_++] };
+                ++read_position_;
+                if (!isResponseFile(token)) {
+                    return true;
+                }
+                openFile(token.substr(1));
+                continue;
+            }
+
+            OpenFile& file = open_files_.back();
+            bool quoted { false };
+            int result { nextCommandLineToken(file.p, file.end, token, quoted) };
+            if (result == TOKEN_END) {
+                open_files_.pop_back();
+                continue;
+            }
+            ++read_position_;
+            if (result == TOKEN_UNTERMINATED_QUOTE) {
+                fail(file.path, "Unterminated quote in response file: " + file.path);
+            } else if (!quoted && isResponseFile(token)) {
+                openFile(token.substr(1));
+            } else {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void openFile(StringView path) {
+        if (open_files_.size() >= RESPONSE_FILE_MAX_DEPTH) {
+            fail(path, formatMessage("Too many nested response files: ", path));
+            return;
+        }
+        std::unique_ptr<MappedFile> file { new MappedFile() };
+        if (!file->open(path.str())) {
+            fail(path, formatMessage("Cannot read response file: ", path));
+            return;
+        }
+        open_files_.push_back(OpenFile { path.str(), file->begin(), file->end() });
+        files_.push_back(std::move(file));
+    }
+};
+
+// Arguments of a streaming action, read by the action while they are
+// produced: the command line tokens up to the next delimiter, taken
+// literally, where a '-' token stands for the non empty lines read from
+// stdin. Arguments are not stored, except the first ones, which are read
+// ahead by parse to check the arity of the action.
+class ArgumentStream {
+  public:
+    ArgumentStream(std::unique_ptr<TokenStream> tokens,
+                   const TokenSet& delimiters,
+                   const TokenSet& pipe_delimiters)
+            : tokens_ { std::move(tokens) },
+              delimiters_ ( delimiters ),
+              pipe_delimiters_ ( pipe_delimiters ),
+              reading_stdin_ { false },
+              ended_ { false },
+              next_read_ahead_ { 0 },
+              count_ { 0 } {}
+
+    // Read the next argument; return false once all have been read. The
+    // view is valid until the next call.
+    bool next(StringView& argument) {
+        if (next_read_ahead_ < read_ahead_.size()) {
+            argument = StringView { read_ahead_[next_read_ahead_++] };
+        } else if (!read(argument)) {
+            return false;
+        }
+        ++count_;
+        return true;
+    }
+
+    // Number of arguments read so far
+    size_t count() const {
+        return count_;
+    }
+
+  private:
+    friend class HorseWhisperer;
+
+    std::unique_ptr<TokenStream> tokens_;
+    const TokenSet& delimiters_;
+    const TokenSet& pipe_delimiters_;
+    bool reading_stdin_;
+    bool ended_;
+    std::string line_;
+    std::vector<std::string> read_ahead_;
+    size_t next_read_ahead_;
+    size_t count_;
+
+    bool read(StringView& argument) {
+        while (!ended_) {
+            if (reading_stdin_) {
+                if (std::getline(std::cin, line_)) {
+                    if (!line_.empty()) {
+                        argument = StringView { line_ };
+                        return true;
+                    }
+                    continue;
+                }
+                std::cin.clear();
+                reading_stdin_ = false;
+            }
+
+            StringView token {};
+            if (!tokens_->peek(token) || delimiters_.contains(token)
+                    || pipe_delimiters_.contains(token)) {
+                ended_ = true;
+                break;
+            }
+            tokens_->next(token);
+            if (token == "-") {
+                reading_stdin_ = true;
+            } else {
+                argument = token;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // Read (and copy) up to count arguments ahead; return how many could
+    // be read
+    size_t readAhead(size_t count) {
+        StringView argument {};
+        while (read_ahead_.size() < count && read(argument)) {
+            read_ahead_.push_back(argument.str());
+        }
+        return read_ahead_.size();
+    }
+
+    // Skip the arguments the action did not read; return the tokens
+    // following them, if any
+    std::unique_ptr<TokenStream> finish() {
+        StringView argument {};
+        while (read(argument)) {}
+        if (!tokens_->peek(argument)) {
+            return nullptr;
+        }
+        return std::move(tokens_);
+    }
+};
+
+#ifndef _WIN32
+
+//
+// Daemon protocol
+//
+
+// A daemon session is a single request on a Unix domain stream socket. The
+// client sends the payload size (4 bytes) together with its stdin, stdout
+// and stderr descriptors (SCM_RIGHTS), followed by the payload: NUL
+// terminated strings holding the working directory, the argument count,
+// the arguments and the forwarded environment variables ("NAME=value", or
+// "NAME" when unset in the client). The daemon replies with the exit code
+// (4 bytes), once the command line has been executed.
+
+static const int DAEMON_FORWARDED_FDS = 3;
+
+static bool sendAll(int fd, const void* data, size_t size) {
+    const char* p = static_cast<const char*>(data);
+    while (size > 0) {
+        ssize_t sent = send(fd, p, size, MSG_NOSIGNAL);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        } else if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        size -= sent;
+    }
+    return true;
+}
+
+static bool receiveAll(int fd, void* data, size_t size) {
+    char* p = static_cast<char*>(data);
+    while (size > 0) {
+        ssize_t received = recv(fd, p, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        } else if (received <= 0) {
+            return false;
+        }
+        p += received;
+        size -= received;
+    }
+    return true;
+}
+
+static bool makeDaemonAddress(const std::string& socket_path, sockaddr_un& address) {
+    std::memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (socket_path.empty() || socket_path.size() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    std::memcpy(address.sun_path, socket_path.c_str(), socket_path.size());
+    return true;
+}
+
+// Send the payload size and the descriptors to forward
+static bool sendDaemonHeader(int fd, uint32_t payload_size,
+                             const int (&fds)[DAEMON_FORWARDED_FDS]) {
+    char control[CMSG_SPACE(sizeof(fds))];
+    std::memset(control, 0, sizeof(control));
+    iovec iov { &payload_size, sizeof(payload_size) };
+    msghdr message {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    std::memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    ssize_t sent;
+    do {
+        sent = sendmsg(fd, &message, MSG_NOSIGNAL);
+    } while (sent < 0 && errno == EINTR);
+    return sent == sizeof(payload_size);
+}
+
+// Receive the payload size and the forwarded descriptors
+static bool receiveDaemonHeader(int fd, uint32_t& payload_size,
+                                int (&fds)[DAEMON_FORWARDED_FDS]) {
+    char control[CMSG_SPACE(sizeof(fds))];
+    iovec iov { &payload_size, sizeof(payload_size) };
+    msghdr message {};
+    message.msg_iov = &iov;
+    message.msg_iovlen = 1;
+    message.msg_control = control;
+    message.msg_controllen = sizeof(control);
+
+    ssize_t received;
+    do {
+        received = recvmsg(fd, &message, 0);
+    } while (received < 0 && errno == EINTR);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&message);
+    if (received != sizeof(payload_size) || cmsg == nullptr
+            || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+            || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        return false;
+    }
+    std::memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+    return true;
+}
+
+// Execute a command line in the daemon listening on socket_path, with the
+// working directory, the given environment variables and the standard
+// streams of the calling process.
+static int forwardToDaemon(const std::string& socket_path, int argc, char** argv,
+                           const std::vector<std::string>& environment) {
+    sockaddr_un address;
+    if (!makeDaemonAddress(socket_path, address)) {
+        return DAEMON_UNAVAILABLE;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0) {
+        return DAEMON_UNAVAILABLE;
+    }
+    if (connect(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0) {
+        close(fd);
+        return DAEMON_UNAVAILABLE;
+    }
+
+    std::string payload {};
+    char* cwd = getcwd(nullptr, 0);
+    payload.append(cwd ? cwd : "/").push_back('\0');
+    free(cwd);
+    payload.append(std::to_string(argc)).push_back('\0');
+    for (int i = 0; i < argc; i++) {
+        payload.append(argv[i]).push_back('\0');
+    }
+    for (auto& name : environment) {
+        const char* value = getenv(name.c_str());
+        payload.append(name);
+        if (value) {
+            payload.append("=").append(value);
+        }
+        payload.push_back('\0');
+    }
+
+    // Output of the daemon goes straight to our descriptors
+    std::cout.flush();
+    int fds[DAEMON_FORWARDED_FDS] { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    int32_t exit_code { 1 };
+    if (!sendDaemonHeader(fd, payload.size(), fds)
+            || !sendAll(fd, payload.data(), payload.size())
+            || !receiveAll(fd, &exit_code, sizeof(exit_code))) {
+        std::cout << "The daemon session ended without an exit code." << std::endl;
+        exit_code = 1;
+    }
+    close(fd);
+    return exit_code;
+}
+
+#endif  // _WIN32
+
+//
+// Tracing
+//
+
+// Write text as a JSON string
+static void writeJsonString(std::ostream& os, StringView text) {
+    static const char* hex_digits = "0123456789abcdef";
+    os << '"';
+    for (char c : text) {
+        switch (c) {
+            case '"':
+                os << "\\\"";
+                break;
+            case '\\':
+                os << "\\\\";
+                break;
+            case '\n':
+                os << "\\n";
+                break;
+            case '\t':
+                os << "\\t";
+                break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    os << "\\u00" << hex_digits[c >> 4] << hex_digits[c & 0xf];
+                } else {
+                    os << c;
+                }
+        }
+    }
+    os << '"';
+}
+
+// A complete span ("X" event of the Chrome trace event format)
+struct TraceEvent {
+    std::string name;
+    const char* category;
+    // Start and duration, in microseconds since tracing started
+    double start_us;
+    double duration_us;
+    int thread_id;
+    // Argument names and their values, encoded as JSON
+    std::vector<std::pair<const char*, std::string>> args;
+};
+
+// Spans of the parse and execution phases, recorded from any thread while
+// tracing is enabled, and written as a Chrome trace (chrome://tracing,
+// Perfetto). While disabled, a span costs the check of enabled().
+class Tracer {
+  public:
+    using Clock = std::chrono::steady_clock;
+
+    Tracer() : enabled_ { false }, origin_ { 0 } {}
+
+    bool enabled() const {
+        return enabled_.load(std::memory_order_relaxed);
+    }
+
+    // Drop the recorded spans and start recording; times are relative to
+    // this call
+    void start() {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        events_.clear();
+        origin_.store(Clock::now().time_since_epoch().count(),
+                      std::memory_order_relaxed);
+        enabled_.store(true, std::memory_order_relaxed);
+    }
+
+    // Stop recording, keeping the recorded spans
+    void stop() {
+        enabled_.store(false, std::memory_order_relaxed);
+    }
+
+    void reset() {
+        stop();
+        std::lock_guard<std::mutex> lock { mutex_ };
+        events_.clear();
+    }
+
+    // Microseconds since tracing started
+    double now() const {
+        Clock::duration since_origin {
+            Clock::now().time_since_epoch().count()
+            - origin_.load(std::memory_order_relaxed) };
+        return std::chrono::duration<double, std::micro>(since_origin).count();
+    }
+
+    void record(TraceEvent event) {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        events_.push_back(std::move(event));
+    }
+
+    size_t size() const {
+        std::lock_guard<std::mutex> lock { mutex_ };
+        return events_.size();
+    }
+
+    // Write the recorded spans in the Chrome trace event JSON format
+    void write(std::ostream& os) const {
+        std::ostringstream json {};
+        json << std::fixed << std::setprecision(3);
+#ifndef _WIN32
+        int pid { getpid() };
+#else
+        int pid { 0 };
+#endif
+        json << "{\"traceEvents\":[";
+        std::lock_guard<std::mutex> lock { mutex_ };
+        for (size_t i = 0; i < events_.size(); i++) {
+            const TraceEvent& event = events_[i];
+            json << (i == 0 ? "\n" : ",\n") << "{\"name\":";
+            writeJsonString(json, event.name);
+            json << ",\"cat\":";
+            writeJsonString(json, event.category);
+            json << ",\"ph\":\"X\",\"ts\":" << event.start_us
+                 << ",\"dur\":" << event.duration_us
+                 << ",\"pid\":" << pid << ",\"tid\":" << event.thread_id
+                 << ",\"args\":{";
+            for (size_t a = 0; a < event.args.size(); a++) {
+                json << (a == 0 ? "" : ",");
+                writeJsonString(json, event.args[a].first);
+                json << ":" << event.args[a].second;
+            }
+            json << "}}";
+        }
+        json << "\n],\"displayTimeUnit\":\"ns\"}\n";
+        os << json.str();
+    }
+
+    // Small number identifying the calling thread in the trace
+    static int threadId() {
+        static std::atomic<int> next_id { 1 };
+        static thread_local int id { next_id++ };
+        return id;
+    }
+
+  private:
+    std::atomic<bool> enabled_;
+    // Clock::now() when tracing started, in Clock ticks
+    std::atomic<Clock::rep> origin_;
+    mutable std::mutex mutex_;
+    std::vector<TraceEvent> events_;
+};
+
+// Records a span of tracer, from its construction to end() or to its
+// destruction, if tracing is enabled when constructed; otherwise does
+// nothing, without reading the clock or copying the name
+class TraceSpan {
+  public:
+    TraceSpan(Tracer& tracer, const char* category, StringView name)
+            : tracer_ { tracer.enabled() ? &tracer : nullptr } {
+        if (tracer_) {
+            event_.name = name.str();
+            event_.category = category;
+            event_.thread_id = Tracer::threadId();
+            event_.start_us = tracer_->now();
+        }
+    }
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+    ~TraceSpan() {
+        end();
+    }
+
+    void addArgument(const char* name, StringView value) {
+        if (tracer_) {
+            std::ostringstream json {};
+            writeJsonString(json, value);
+            event_.args.emplace_back(name, json.str());
+        }
+    }
+
+    // Record the action arguments as a JSON array
+    void addArguments(const ArgumentsView& arguments) {
+        if (tracer_) {
+            std::ostringstream json {};
+            json << "[";
+            for (size_t i = 0; i < arguments.size(); i++) {
+                json << (i == 0 ? "" : ",");
+                writeJsonString(json, arguments[i]);
+            }
+            json << "]";
+            event_.args.emplace_back("arguments", json.str());
+        }
+    }
+
+    void setResult(int result) {
+        if (tracer_) {
+            event_.args.emplace_back("result", std::to_string(result));
+        }
+    }
+
+    void setResult(bool result) {
+        if (tracer_) {
+            event_.args.emplace_back("result", result ? "true" : "false");
+        }
+    }
+
+    // End the span, from any thread
+    void end() {
+        if (tracer_) {
+            event_.duration_us = tracer_->now() - event_.start_us;
+            tracer_->record(std::move(event_));
+            tracer_ = nullptr;
+        }
+    }
+
+  private:
+    Tracer* tracer_;
+    TraceEvent event_;
+};
+
+//
+// HorseWhisperer
+//
+
+// Execution state of the contexts run in parallel or by Step
+enum ContextState { WAITING, RUNNING, SUCCEEDED, FAILED };
+
+// Actions started by StartAsync and advanced by Step
+struct AsyncRun {
+    AsyncRun() : running { 0 }, failed { false } {}
+
+    std::vector<ContextState> states;
+    // Whether the command line following a streaming context was parsed
+    std::vector<bool> continued;
+    // Number of asynchronous actions running
+    size_t running;
+    bool failed;
+    // Called after an asynchronous action completed
+    std::function<void()> on_progress;
+    // Context indexes and exit codes of the completed asynchronous actions,
+    // posted from any thread until collected by Step
+    std::mutex mutex;
+    std::vector<std::pair<size_t, int>> completed;
+};
+
+// Parse and execution state of command lines, kept apart from the
+// definitions so that sessions can share them (see Session)
+struct SessionState {
+    explicit SessionState(HorseWhisperer* owner_) : owner { owner_ } {
+        reset();
+    }
+
+    // Drop the contexts, including the values of the global flags
+    void reset() {
+        contexts.clear();
+        async_run.reset();
+        context_arena.clear();
+        ContextPtr global_context { context_arena.make<Context>() };
+        global_context->action = nullptr;
+        contexts.push_back(global_context);
+        current_context_idx = GLOBAL_CONTEXT_IDX;
+        parsed = false;
+        running_batch = false;
+        response_files.clear();
+        diagnostics.clear();
+        deadline = Watchdog::Clock::time_point::max();
+        action_timeout = std::chrono::milliseconds::zero();
+        signals = 0;
+    }
+
+    // Definitions the contexts refer to
+    HorseWhisperer* owner;
+
+    // Container of contexts; the global context holds the values of the
+    // global flags
+    std::vector<ContextPtr> contexts;
+    Arena context_arena;
+
+    // Index of the context currently being processed
+    int current_context_idx;
+
+    // Whether CL args have been parsed
+    bool parsed;
+
+    // Whether a batch is being executed
+    bool running_batch;
+
+    // Response files read by parse, referenced by the argument views
+    std::vector<std::unique_ptr<MappedFile>> response_files;
+
+    // Actions run by Step, if any; shared with their completions
+    std::shared_ptr<AsyncRun> async_run;
+
+    // Errors reported by the last parse and execution; actions report
+    // theirs from any thread
+    std::vector<Diagnostic> diagnostics;
+    std::mutex diagnostics_mutex;
+
+    // Set when the actions start: deadline of the whole command line
+    // (--timeout), default timeout of its actions (--action-timeout) and
+    // signal count, for telling whether it was interrupted
+    Watchdog::Clock::time_point deadline;
+    std::chrono::milliseconds action_timeout;
+    unsigned signals;
+};
+
+class HorseWhisperer {
+  public:
+    // Return reference to the HorseWhisperer of the session running on the
+    // calling thread, if any, otherwise to the HorseWhisperer singleton
+    static HorseWhisperer& Instance() {
+        static HorseWhisperer instance;
+        SessionState* active { activeSession() };
+        return active ? *active->owner : instance;
+    }
+
+    // No args constructor creates the pointer to the root context and
+    // implicitly declares the --help flag.
+    // Initializations are performed by init().
+    HorseWhisperer() : session_ { this }, default_output_ { std::cout } {
+        init();
+    }
+
+    void reset() {
+        clean();
+        init();
+    }
+
+    void setAppName(std::string name) {
+        application_name_ = name;
+        invalidateHelp();
+    }
+
+    void setHelpBanner(std::string banner) {
+        help_banner_ = banner;
+        invalidateHelp();
+    }
+
+    void setVersionString(std::string version_string) {
+        version_string_ = version_string;
+        defineGlobalFlag<bool>("version", "Display version information", false,
+                               nullptr);
+    }
+
+    void setDelimiters(std::vector<std::string> delimiters) {
+        delimiters_.assign(delimiters);
+    }
+
+    // Delimiters joining actions into a pipeline, which run together and
+    // pass records to each other (see ActionContext::write)
+    void setPipeDelimiters(std::vector<std::string> delimiters) {
+        pipe_delimiters_.assign(delimiters);
+    }
+
+    // Whether the argument delimits actions, chained or piped
+    bool isDelimiter(StringView argument) {
+        return delimiters_.contains(argument) || isPipeDelimiter(argument);
+    }
+
+    bool isPipeDelimiter(StringView argument) {
+        return pipe_delimiters_.contains(argument);
+    }
+
+    // Kind of a command line token
+    enum class TokenKind { Flag, Delimiter, PipeDelimiter, Action, Argument };
+
+    // Classify the token with one lookup of each table; action is set to
+    // the action named by Action tokens
+    TokenKind classifyToken(StringView token, Action*& action) {
+        TokenKind kind { classifyToken(token) };
+        if (kind != TokenKind::Argument) {
+            return kind;
+        }
+        action = findAction(token);
+        return action ? TokenKind::Action : TokenKind::Argument;
+    }
+
+    // As above, without looking actions up: they are Argument tokens
+    TokenKind classifyToken(StringView token) {
+        if (isFlag(token)) {
+            return TokenKind::Flag;
+        } else if (pipe_delimiters_.contains(token)) {
+            return TokenKind::PipeDelimiter;
+        } else if (delimiters_.contains(token)) {
+            return TokenKind::Delimiter;
+        }
+        return TokenKind::Argument;
+    }
+
+    bool isActionFlag(std::string action, std::string flagname) {
+        Action* actionp = findAction(action);
+        return actionp && actionp->flags.find(flagname) != actionp->flags.end();
+    }
+
+    // Parse the command line; @path tokens are replaced by the tokens of
+    // the response file at path (see TokenStream)
+    int parse(int argc, char* argv[]) {
+        SessionState& session = currentSession();
+        TraceSpan span { tracer_, "phase", "parse" };
+        materializeStaticGlobalFlags();
+        session.diagnostics.clear();
+        std::unique_ptr<TokenStream> tokens {
+            new TokenStream { argc, argv, session.response_files,
+                              [this, &session](const Diagnostic& diagnostic) {
+                                  report(session, diagnostic);
+                              } } };
+        int result { parseTokens(tokens) };
+        if (result == PARSE_OK) {
+            session.parsed = true;
+        }
+        span.setResult(result);
+        return result;
+    }
+
+    // Parse the tokens into new contexts. When a streaming action is found,
+    // its context takes the remaining tokens.
+    int parseTokens(std::unique_ptr<TokenStream>& token_stream) {
+        SessionState& session = currentSession();
+        TokenStream& tokens = *token_stream;
+        StringView token {};
+        // Pipe delimiter preceding the next action, if any
+        std::string pipe {};
+        size_t pipe_position { 0 };
+
+        while (tokens.next(token)) {
+            Action* actionp { nullptr };
+            TokenKind kind { classifyToken(token, actionp) };
+            if (kind == TokenKind::Flag) {
+                int parse_flag_outcome { parseFlag(token, tokens) };
+                if (parse_flag_outcome != PARSE_OK) {
+                    return parse_flag_outcome;
+                }
+            } else if (kind == TokenKind::PipeDelimiter) {
+                TraceSpan span { tracer_, "token", "pipe delimiter" };
+                span.addArgument("token", token);
+                Action* previous = session.contexts.back()->action;
+                if (!previous || !pipe.empty()) {
+                    diagnose(DiagnosticCode::InvalidPipe, token, tokens.position(),
+                             formatMessage("Expected an action before pipe delimiter: ",
+                                           token));
+                    return PARSE_ERROR;
+                } else if (!canPipe(previous, token, tokens.position())) {
+                    return PARSE_ERROR;
+                }
+                pipe = token.str();
+                pipe_position = tokens.position();
+            } else if (kind == TokenKind::Delimiter) {  // skip over delimiter
+                TraceSpan span { tracer_, "token", "delimiter" };
+                span.addArgument("token", token);
+                continue;
+            } else if (kind == TokenKind::Argument) {
+                diagnose(DiagnosticCode::UnknownAction, token, tokens.position(),
+                         formatMessage("Unknown action: ", token));
+                return PARSE_ERROR;
+            } else {
+                // Spans the action arguments and flags
+                TraceSpan span { tracer_, "token", "action" };
+                span.addArgument("token", token);
+                const std::string& action = actionp->name;
+                size_t action_position { tokens.position() };
+                // Each context stores the action flag values set for
+                // it, so that, in case this action has been chained
+                // multiple times, each context can parse and store
+                // different flag values - example:
+                // `app_name action_1 --flag_a foo + action_1 --flag_a bar`
+                ContextPtr action_context { session.context_arena.make<Context>() };
+                action_context->action = actionp;
+                if (!pipe.empty()) {
+                    if (!canPipe(actionp, token, tokens.position())) {
+                        return PARSE_ERROR;
+                    }
+                    action_context->input.reset(new RecordQueue { PIPE_CAPACITY });
+                    session.contexts.back()->output = action_context->input;
+                    pipe.clear();
+                }
+                session.contexts.push_back(action_context);
+                session.current_context_idx++;
+
+                assert(session.current_context_idx == session.contexts.size() - 1);
+
+                // parse arguments and action flags
+                Context& context = *action_context;
+                int arity = actionp->arity;
+                if (actionp->action_stream_callback) {
+                    return startArgumentStream(context, token_stream);
+                } else if (arity > 0) {  // iff read parameters = arity
+                    reserveArguments(context, arity);
+                    while (arity > 0 && tokens.next(token)) {
+                        Action* found_action { nullptr };
+                        TokenKind argument_kind { classifyToken(token, found_action) };
+                        if (argument_kind == TokenKind::Flag) {
+                            int parse_flag_outcome { parseFlag(token, tokens) };
+                            if (parse_flag_outcome != PARSE_OK) {
+                                return parse_flag_outcome;
+                            }
+                        } else if (argument_kind == TokenKind::Action) {
+                            diagnose(DiagnosticCode::UnexpectedAction, token,
+                                     tokens.position(),
+                                     formatMessage("Expected parameter for action: ",
+                                                   action, ". Found action: ", token));
+                            return PARSE_ERROR;
+                        } else if (argument_kind != TokenKind::Argument) {
+                            diagnose(DiagnosticCode::UnexpectedDelimiter, token,
+                                     tokens.position(),
+                                     formatMessage("Expected parameter for action: ",
+                                                   action, ". Found delimiter: ", token));
+                            return PARSE_ERROR;
+                        } else {
+                            addArgument(context, token);
+                            arity--;
+                        }
+                    }
+
+                    if (tokens.failed()) {
+                        return PARSE_ERROR;
+                    } else if (arity > 0) {
+                        diagnose(DiagnosticCode::MissingArguments, action,
+                                 action_position,
+                                 formatMessage("Expected ", actionp->arity,
+                                               " parameters for action ", action,
+                                               ". Only read ", actionp->arity - arity, "."));
+                        return PARSE_ERROR;
+                    }
+                } else if (arity < 0) {  // if read parameters at least = arity
+                    // When arity is an "at least" representation we eat arguments
+                    // until we either run out or until we hit a delimiter.
+
+                    if (!tokens.peek(token)) {
+                        if (tokens.failed()) {
+                            return PARSE_ERROR;
+                        }
+                        diagnose(DiagnosticCode::MissingArguments, action,
+                                 action_position,
+                                 formatMessage("No arguments specified for ", action, "."));
+                        return PARSE_ERROR;
+                    }
+
+                    int abs_arity { -arity };
+
+                    // Reserve for every token up to the next delimiter
+                    reserveArguments(context,
+                                     tokens.countArgvTokens([this](StringView t) {
+                                         return isDelimiter(t); }));
+
+                    // Each token is classified once, when peeked; the
+                    // first one is an argument even if it is a delimiter
+                    TokenKind argument_kind { classifyToken(token) };
+                    do {
+                        tokens.next(token);
+                        if (argument_kind == TokenKind::Flag) {
+                            int parse_flag_outcome { parseFlag(token, tokens) };
+                            if (parse_flag_outcome != PARSE_OK) {
+                                return parse_flag_outcome;
+                            }
+                        } else {
+                            addArgument(context, token);
+                            --abs_arity;
+                        }
+                    } while (tokens.peek(token)
+                             && (argument_kind = classifyToken(token)) != TokenKind::Delimiter
+                             && argument_kind != TokenKind::PipeDelimiter);
+
+                    if (tokens.failed()) {
+                        return PARSE_ERROR;
+                    } else if (abs_arity > 0) {
+                        diagnose(DiagnosticCode::MissingArguments, action,
+                                 action_position,
+                                 formatMessage("Expected at least ", -actionp->arity,
+                                               " parameters for action ", action,
+                                               ". Only read ", -actionp->arity - abs_arity,
+                                               "."));
+                        return PARSE_ERROR;
+                    }
+                }
+            }
+        }
+
+        if (tokens.failed()) {
+            return PARSE_ERROR;
+        } else if (!pipe.empty()) {
+            diagnose(DiagnosticCode::InvalidPipe, pipe, pipe_position,
+                     formatMessage("Expected an action after pipe delimiter: ", pipe));
+            return PARSE_ERROR;
+        }
+
+        return PARSE_OK;
+    }
+
+    // Record the diagnostic in session and write its message
+    void report(SessionState& session, const Diagnostic& diagnostic) {
+        {
+            std::lock_guard<std::mutex> lock { session.diagnostics_mutex };
+            session.diagnostics.push_back(diagnostic);
+        }
+        writeLine(diagnostic.message);
+    }
+
+    // Report an error about the token at position (0 when the error is not
+    // about a token) in the current session
+    void diagnose(DiagnosticCode code, StringView token, size_t position,
+                  const std::string& message) {
+        report(currentSession(),
+               Diagnostic { code, message, token.str(), position });
+    }
+
+    void notStarted(const Action* action) {
+        if (chainCancelled(currentSession())) {
+            diagnose(DiagnosticCode::ActionSkipped, action->name, 0,
+                     formatMessage("Skipping action '", action->name,
+                                   "'. The command line was cancelled."));
+            return;
+        }
+        diagnose(DiagnosticCode::ActionNotStarted, action->name, 0,
+                 formatMessage("Not starting action '", action->name,
+                               "'. Previous action failed to complete ",
+                               "successfully."));
+    }
+
+    // Write message and a new line with a single write
+    void writeLine(std::string message) {
+        message.push_back('\n');
+        output_->write(message);
+    }
+
+    // Whether the action can be part of a pipeline, reporting why not
+    // about the token at position
+    bool canPipe(const Action* action, StringView token, size_t position) {
+        if (!action->action_context_callback && !action->async_callback) {
+            diagnose(DiagnosticCode::InvalidPipe, token, position,
+                     formatMessage("Cannot pipe action ", action->name, ". Only actions ",
+                                   "taking an ActionContext can be piped."));
+            return false;
+        }
+        return true;
+    }
+
+    // Parse the flags preceding the arguments of the streaming action of
+    // context and read ahead as many arguments as its arity requires. The
+    // context takes the remaining tokens.
+    int startArgumentStream(Context& context,
+                            std::unique_ptr<TokenStream>& token_stream) {
+        const std::string& action = context.action->name;
+        size_t action_position { token_stream->position() };
+        StringView token {};
+        while (token_stream->peek(token) && isFlag(token) && token != "-") {
+            token_stream->next(token);
+            int parse_flag_outcome { parseFlag(token, *token_stream) };
+            if (parse_flag_outcome != PARSE_OK) {
+                return parse_flag_outcome;
+            }
+        }
+        if (token_stream->failed()) {
+            return PARSE_ERROR;
+        }
+
+        context.argument_stream.reset(
+            new ArgumentStream { std::move(token_stream), delimiters_,
+                                 pipe_delimiters_ });
+        size_t expected_arity = -context.action->arity;
+        size_t read = context.argument_stream->readAhead(expected_arity);
+        if (context.argument_stream->tokens_->failed()) {
+            return PARSE_ERROR;
+        } else if (read == 0) {
+            diagnose(DiagnosticCode::MissingArguments, action, action_position,
+                     formatMessage("No arguments specified for ", action, "."));
+            return PARSE_ERROR;
+        } else if (read < expected_arity) {
+            diagnose(DiagnosticCode::MissingArguments, action, action_position,
+                     formatMessage("Expected at least ", expected_arity,
+                                   " parameters for action ", action,
+                                   ". Only read ", read, "."));
+            return PARSE_ERROR;
+        }
+        return PARSE_OK;
+    }
+
+    // Parse the command line following the arguments of a streaming action,
+    // once executed, and validate the new contexts
+    bool continueParse(Context& context) {
+        SessionState& session = currentSession();
+        std::unique_ptr<TokenStream> tokens { context.argument_stream->finish() };
+        if (!tokens) {
+            return true;
+        }
+        size_t first_new { session.contexts.size() };
+        session.current_context_idx = session.contexts.size() - 1;
+        if (parseTokens(tokens) != PARSE_OK) {
+            return false;
+        }
+        for (size_t i = first_new; i < session.contexts.size(); i++) {
+            if (!validateContext(*session.contexts[i])) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool validateActionArguments() {
+        SessionState& session = currentSession();
+        if (!session.parsed) {
+            return false;
+        }
+
+        TraceSpan span { tracer_, "phase", "validate" };
+
+        if (session.contexts.size() > 1) {
+            for (auto & context : session.contexts) {
+                if (context->action && !validateContext(*context)) {
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    bool validateContext(Context& context) {
+        if (!context.action->arguments_view_callback
+                && !context.action->arguments_callback) {
+            return true;
+        }
+
+        TraceSpan span { tracer_, "arguments callback", context.action->name };
+        span.addArguments(ArgumentsView { context.argument_views });
+        bool valid { context.action->arguments_view_callback
+            ? context.action->arguments_view_callback(
+                  ArgumentsView { context.argument_views })
+            : context.action->arguments_callback(context.arguments) };
+        span.setResult(valid);
+        return valid;
+    }
+
+    // Dynamically output help information based on registered global and action
+    // specific flags. The help of each context is rendered once, until the
+    // definitions or the margins change, and displayed with a single write.
+    void help() {
+        materializeStaticSchema();
+        SessionState& session = currentSession();
+        const Action* action { session.contexts[session.current_context_idx]->action };
+        std::lock_guard<std::mutex> lock { help_mutex_ };
+        auto it = help_cache_.find(action);
+        if (it == help_cache_.end()) {
+            std::ostringstream out {};
+            if (action) {
+                actionHelp(out, action);
+            } else {
+                globalHelp(out);
+            }
+            it = help_cache_.emplace(action, out.str()).first;
+        }
+        output_->write(it->second);
+    }
+
+    // Display the version information on stdout
+    void version() {
+        output_->write(version_string_);
+    }
+
+    // Run the parsed actions; return true if an action failed
+    bool whisper() {
+        bool failed { false };
+        startChain(currentSession());
+        {
+            TraceSpan span { tracer_, "phase", "start" };
+            failed = whisperChain();
+            span.setResult(failed);
+        }
+        writeRequestedTrace();
+        return failed;
+    }
+
+    bool whisperChain() {
+        SessionState& session = currentSession();
+        if (!session.parsed) {
+            return false;
+        }
+
+        if (!session.running_batch) {
+            std::string batch_path { getFlagValue<std::string>("batch") };
+            if (!batch_path.empty()) {
+                if (session.contexts.size() > 1) {
+                    diagnose(DiagnosticCode::InvalidBatch, "", 0,
+                             "Actions cannot be combined with --batch.");
+                    return true;
+                }
+                return startBatch(batch_path);
+            }
+        }
+
+        int jobs { getFlagValue<int>("jobs") };
+        if (jobs <= 0) {
+            jobs = std::max(1u, std::thread::hardware_concurrency());
+        }
+        if (!session.running_batch && getFlagValue<bool>("watch")) {
+#ifndef _WIN32
+            return watchChain(session);
+#else
+            diagnose(DiagnosticCode::InvalidWatch, "", 0,
+                     "--watch is not supported on this platform.");
+            return true;
+#endif
+        }
+
+        if (jobs > 1 && session.contexts.size() > 2) {
+            return whisperInParallel(jobs);
+        }
+
+        return whisperSequentially(session, GLOBAL_CONTEXT_IDX);
+    }
+
+    // Run the parsed actions from the context at index first, one after
+    // the other
+    bool whisperSequentially(SessionState& session, size_t first) {
+        session.current_context_idx = static_cast<int>(first) - 1;
+        bool previous_result = true;
+
+        if (session.contexts.size() > 1) {
+            for (size_t i = first; i < session.contexts.size(); i++) {
+                session.current_context_idx++;
+                if (session.contexts[i]->action) {
+                    if (!previous_result || chainCancelled(session)) {
+                        notStarted(session.contexts[i]->action);
+                        previous_result = false;
+                    } else {
+                        // Record the current context index. Calling parse inside
+                        // an action_callback allows the context list to grow
+                        // during execution but has the side effect of mutating
+                        // the current_context_index.
+                        int tmp = session.current_context_idx;
+                        // The actions of a pipeline run together
+                        size_t last { pipelineEnd(session, i) };
+                        // Flip it because success is 0
+                        previous_result = !(last == i
+                                            ? invokeAction(*session.contexts[i])
+                                            : invokePipeline(session, i, last));
+                        // The command line following a streaming action
+                        // is parsed once the action has run
+                        if (session.contexts[i]->argument_stream
+                                && !continueParse(*session.contexts[i])) {
+                            previous_result = false;
+                        }
+                        bool chainable { true };
+                        for (; i < last; i++, tmp++) {
+                            chainable = chainable && session.contexts[i]->action->chainable;
+                        }
+                        session.current_context_idx = tmp;
+                        if (!chainable || !session.contexts[i]->action->chainable) {
+                            return !previous_result;
+                        }
+                    }
+                }
+           }
+        } else {
+            diagnose(DiagnosticCode::NoAction, "", 0,
+                     formatMessage("No action specified. See \"", application_name_,
+                                   " --help\" for available actions."));
+        }
+
+        return !previous_result;
+    }
+
+#ifndef _WIN32
+    // Run the parsed actions, then run them again each time the contents
+    // of the files they declare as inputs (see setActionInputs) change,
+    // from the first action whose inputs changed, until stopWatching() or,
+    // if signals are handled, a signal. Changes are acted upon once no
+    // other change happened for the debounce time, so that a burst of
+    // saves triggers a single run. The actions run one after the other,
+    // and the output is flushed after each run. Return whether the last
+    // run failed.
+    bool watchChain(SessionState& session) {
+        for (auto context : session.contexts) {
+            if (context->argument_stream) {
+                diagnose(DiagnosticCode::InvalidWatch, context->action->name, 0,
+                         "Streaming actions cannot be watched.");
+                return true;
+            }
+        }
+
+        // Inputs of each context, and the hashes of their contents;
+        // missing inputs have no hash
+        std::vector<std::vector<std::string>> inputs(session.contexts.size());
+        std::map<std::string, std::pair<bool, uint64_t>> hashes {};
+        std::vector<std::string> paths {};
+        for (size_t idx = GLOBAL_CONTEXT_IDX + 1; idx < session.contexts.size(); idx++) {
+            Context& context = *session.contexts[idx];
+            if (context.action->inputs) {
+                inputs[idx] = context.action->inputs(ActionContext { &session, &context });
+            }
+            for (auto& path : inputs[idx]) {
+                if (hashes.find(path) == hashes.end()) {
+                    uint64_t hash { 0 };
+                    bool readable { hashFile(path, hash) };
+                    hashes[path] = std::make_pair(readable, hash);
+                    paths.push_back(path);
+                }
+            }
+        }
+
+        // Watch before running, so that changes made while running count
+        FileWatcher watcher {};
+        if (!watcher.watch(paths)) {
+            diagnose(DiagnosticCode::InvalidWatch, "", 0,
+                     "Cannot watch the inputs of the actions.");
+            return true;
+        }
+        {
+            std::lock_guard<std::mutex> lock { watch_mutex_ };
+            watcher_ = &watcher;
+        }
+
+        // Hash again the inputs of the actions that ran, so that the inputs
+        // written by earlier actions of the chain don't run it again
+        auto rehash = [&session, &inputs, &hashes](size_t first) {
+            for (size_t idx = first; idx < session.contexts.size(); idx++) {
+                for (auto& path : inputs[idx]) {
+                    uint64_t hash { 0 };
+                    bool readable { hashFile(path, hash) };
+                    hashes[path] = std::make_pair(readable, hash);
+                }
+            }
+        };
+
+        bool failed { whisperSequentially(session, GLOBAL_CONTEXT_IDX) };
+        rehash(GLOBAL_CONTEXT_IDX + 1);
+        while (true) {
+            output_->flush();
+            std::vector<std::string> changed {};
+            if (!watcher.wait(watch_debounce_, session.signals, changed)) {
+                break;
+            }
+
+            size_t first { session.contexts.size() };
+            for (auto& path : changed) {
+                uint64_t hash { 0 };
+                bool readable { hashFile(path, hash) };
+                std::pair<bool, uint64_t>& previous = hashes[path];
+                if (previous == std::make_pair(readable, hash)) {
+                    continue;
+                }
+                previous = std::make_pair(readable, hash);
+                for (size_t idx = GLOBAL_CONTEXT_IDX + 1; idx < first; idx++) {
+                    if (std::find(inputs[idx].begin(), inputs[idx].end(), path)
+                            != inputs[idx].end()) {
+                        first = idx;
+                    }
+                }
+            }
+            if (first == session.contexts.size()) {
+                continue;
+            }
+
+            // Piped actions run with the first action of their pipeline,
+            // through new queues
+            while (session.contexts[first]->input) {
+                first--;
+            }
+            for (size_t idx = first + 1; idx < session.contexts.size(); idx++) {
+                if (session.contexts[idx]->input) {
+                    session.contexts[idx]->input.reset(new RecordQueue { PIPE_CAPACITY });
+                    session.contexts[idx - 1]->output = session.contexts[idx]->input;
+                }
+            }
+            writeLine(formatMessage("Inputs of action '", session.contexts[first]->action->name,
+                                    "' changed: running it again."));
+            startChain(session);
+            failed = whisperSequentially(session, first);
+            rehash(first);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock { watch_mutex_ };
+            watcher_ = nullptr;
+        }
+        return failed;
+    }
+#endif
+
+    // Stop the watch mode, if running; see watchChain
+    void stopWatching() {
+#ifndef _WIN32
+        std::lock_guard<std::mutex> lock { watch_mutex_ };
+        if (watcher_) {
+            watcher_->stop();
+        }
+#endif
+    }
+
+    void setWatchDebounce(std::chrono::milliseconds debounce) {
+        watch_debounce_ = debounce;
+    }
+
+    // Run the parsed actions on up to jobs threads. An action starts once
+    // the actions it depends on have succeeded: by default all the actions
+    // preceding it, otherwise those declared with SetActionDependencies.
+    // Nothing runs after an action that is not chainable, which depends on
+    // all the preceding ones. After a failure no action is started, while
+    // the running ones complete. Actions must not define or set flags, nor
+    // call Parse, as they may run concurrently.
+    bool whisperInParallel(size_t jobs) {
+        SessionState& session = currentSession();
+        std::vector<ContextState> states(session.contexts.size(), WAITING);
+        std::vector<bool> continued(session.contexts.size(), false);
+        std::deque<size_t> queue {};
+        size_t running { 0 };
+        bool failed { false };
+        bool stopping { false };
+        std::exception_ptr error {};
+        std::mutex mutex {};
+        std::condition_variable work_available {};
+        std::condition_variable work_done {};
+
+        auto worker = [&]() {
+            activeSession() = &session;
+            std::unique_lock<std::mutex> lock { mutex };
+            while (true) {
+                work_available.wait(lock, [&]() { return stopping || !queue.empty(); });
+                if (queue.empty()) {
+                    return;
+                }
+                size_t idx { queue.front() };
+                queue.pop_front();
+                Context& context = *session.contexts[idx];
+                size_t last { pipelineEnd(session, idx) };
+                lock.unlock();
+
+                int result { 1 };
+                workerContext() = &context;
+                try {
+                    result = last == idx ? invokeAction(context)
+                                         : invokePipeline(session, idx, last);
+                } catch (...) {
+                    lock.lock();
+                    if (!error) {
+                        error = std::current_exception();
+                    }
+                    lock.unlock();
+                }
+                workerContext() = nullptr;
+
+                lock.lock();
+                for (size_t i = idx; i <= last; i++) {
+                    states[i] = result == 0 ? SUCCEEDED : FAILED;
+                }
+                failed = failed || result != 0;
+                --running;
+                work_done.notify_one();
+            }
+        };
+
+        std::vector<std::thread> threads {};
+        for (size_t i = 0; i < jobs; i++) {
+            threads.emplace_back(worker);
+        }
+
+        std::unique_lock<std::mutex> lock { mutex };
+        states[GLOBAL_CONTEXT_IDX] = SUCCEEDED;
+        while (true) {
+            failed = failed || chainCancelled(session);
+            if (failed) {
+                // Start nothing more
+                running -= queue.size();
+                for (auto idx : queue) {
+                    states[idx] = WAITING;
+                }
+                queue.clear();
+            } else {
+                for (size_t i = GLOBAL_CONTEXT_IDX + 1; i < session.contexts.size(); i++) {
+                    // Piped actions run with the first action of their pipeline
+                    if (states[i] == WAITING && !session.contexts[i]->input
+                            && dependenciesSucceeded(i, states)) {
+                        states[i] = RUNNING;
+                        queue.push_back(i);
+                        ++running;
+                    }
+                    if (!session.contexts[i]->action->chainable) {
+                        break;
+                    }
+                }
+                work_available.notify_all();
+            }
+
+            if (running > 0) {
+                work_done.wait(lock);
+                continue;
+            }
+
+            // The command line following a streaming action is parsed once
+            // the action has run and no other action is running
+            bool parsed_more { false };
+            for (size_t i = GLOBAL_CONTEXT_IDX + 1; !failed && i < session.contexts.size(); i++) {
+                if (states[i] == SUCCEEDED && session.contexts[i]->argument_stream
+                        && !continued[i]) {
+                    continued[i] = true;
+                    failed = !continueParse(*session.contexts[i]);
+                    states.resize(session.contexts.size(), WAITING);
+                    continued.resize(session.contexts.size(), false);
+                    parsed_more = true;
+                }
+            }
+            if (!parsed_more) {
+                break;
+            }
+        }
+        stopping = true;
+        work_available.notify_all();
+        lock.unlock();
+        for (auto& thread : threads) {
+            thread.join();
         }
 
-        return false;
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        for (size_t i = GLOBAL_CONTEXT_IDX + 1; failed && i < session.contexts.size(); i++) {
+            if (states[i] == WAITING) {
+                notStarted(session.contexts[i]->action);
+            }
+        }
+        return failed;
     }
 
-    int parse(int argc, char* argv[]) {
-        for (int arg_idx = 1; arg_idx < argc; arg_idx++) {
-            // Identify if it's a flag
-            if (argv[arg_idx][0] == '-') {
-                int parse_flag_outcome { parseFlag(argv, arg_idx ) };
-                if (parse_flag_outcome != PARSE_OK) {
-                    return parse_flag_outcome;
+    // Start running the parsed actions without blocking; step runs them.
+    // on_progress, if set, is called by the thread completing an
+    // asynchronous action, so that the event loop calls step again.
+    // Return 1 if parse didn't succeed, 0 otherwise.
+    int startAsync(std::function<void()> on_progress) {
+        SessionState& session = currentSession();
+        if (!session.parsed) {
+            return 1;
+        }
+
+        if (!session.running_batch
+                && !getFlagValue<std::string>("batch").empty()) {
+            diagnose(DiagnosticCode::InvalidBatch, "", 0,
+                     "--batch cannot be combined with StartAsync.");
+            return 1;
+        }
+
+        if (getFlagValue<bool>("watch")) {
+            diagnose(DiagnosticCode::InvalidWatch, "", 0,
+                     "--watch cannot be combined with StartAsync.");
+            return 1;
+        }
+
+        if (session.contexts.size() <= 1) {
+            diagnose(DiagnosticCode::NoAction, "", 0,
+                     formatMessage("No action specified. See \"", application_name_,
+                                   " --help\" for available actions."));
+            return 0;
+        }
+
+        std::shared_ptr<AsyncRun> run { new AsyncRun() };
+        run->states.resize(session.contexts.size(), WAITING);
+        run->states[GLOBAL_CONTEXT_IDX] = SUCCEEDED;
+        run->continued.resize(session.contexts.size(), false);
+        run->on_progress = on_progress;
+        session.async_run = run;
+        startChain(session);
+        return 0;
+    }
+
+    // Run the actions started by startAsync as far as possible without
+    // waiting: start the asynchronous actions whose dependencies succeeded,
+    // as whisperInParallel does, and run the other ones. Return STEP_RUNNING
+    // while asynchronous actions are running, otherwise 1 if an action
+    // failed and 0 if all succeeded.
+    int step() {
+        SessionState& session = currentSession();
+        std::shared_ptr<AsyncRun> run { session.async_run };
+        if (!run) {
+            return 0;
+        }
+
+        while (true) {
+            {
+                std::lock_guard<std::mutex> lock { run->mutex };
+                for (const auto& completion : run->completed) {
+                    run->states[completion.first] = completion.second == 0 ? SUCCEEDED
+                                                                          : FAILED;
+                    run->failed = run->failed || completion.second != 0;
+                    --run->running;
                 }
-            } else if (isDelimiter(argv[arg_idx])) {  // skip over delimiter
+                run->completed.clear();
+            }
+
+            run->failed = run->failed || chainCancelled(session);
+            if (!run->failed && stepNextAction(session, run)) {
+                continue;
+            }
+            if (run->running > 0) {
+                return STEP_RUNNING;
+            }
+
+            // The command line following a streaming action is parsed once
+            // the action has run and no other action is running
+            bool parsed_more { false };
+            for (size_t i = GLOBAL_CONTEXT_IDX + 1; !run->failed && i < session.contexts.size(); i++) {
+                if (run->states[i] == SUCCEEDED && session.contexts[i]->argument_stream
+                        && !run->continued[i]) {
+                    run->continued[i] = true;
+                    run->failed = !continueParse(*session.contexts[i]);
+                    run->states.resize(session.contexts.size(), WAITING);
+                    run->continued.resize(session.contexts.size(), false);
+                    parsed_more = true;
+                }
+            }
+            if (!parsed_more) {
+                break;
+            }
+        }
+
+        for (size_t i = GLOBAL_CONTEXT_IDX + 1; run->failed && i < session.contexts.size(); i++) {
+            if (run->states[i] == WAITING) {
+                notStarted(session.contexts[i]->action);
+            }
+        }
+        session.async_run.reset();
+        writeRequestedTrace();
+        return run->failed;
+    }
+
+    // Parse and execute the command lines read from input, one per line,
+    // with the current definitions. Empty lines and lines starting with '#'
+    // are skipped. Each line starts with the global flag values that were
+    // set when the run started.
+    BatchResult runBatch(std::istream& input) {
+        BatchResult result {};
+        SessionState& session = currentSession();
+        std::vector<FlagValue> global_values {
+            session.contexts[GLOBAL_CONTEXT_IDX]->values };
+        std::string line {};
+        std::vector<std::string> tokens {};
+        std::vector<char*> argv {};
+        size_t line_number { 0 };
+        auto start = std::chrono::steady_clock::now();
+
+        session.running_batch = true;
+        while (std::getline(input, line)) {
+            ++line_number;
+            tokens.clear();
+            tokens.push_back(application_name_);
+            if (!tokenizeCommandLine(line, tokens)) {
+                writeLine(formatMessage("Unterminated quote in batch line ",
+                                        line_number, "."));
+                result.exit_codes.push_back(std::make_pair(line_number, 1));
                 continue;
+            } else if (tokens.size() == 1 || tokens[1][0] == '#') {
+                continue;
+            }
+
+            argv.clear();
+            for (auto& token : tokens) {
+                argv.push_back(&token[0]);
+            }
+            argv.push_back(nullptr);
+
+            resetParse();
+            session.contexts[GLOBAL_CONTEXT_IDX]->values = global_values;
+            int exit_code { 1 };
+            try {
+                exit_code = executeCommandLine(tokens.size(), argv.data());
+            } catch (const std::exception& e) {
+                writeLine(formatMessage("Batch line ", line_number, " failed: ",
+                                        e.what()));
+            }
+            result.exit_codes.push_back(std::make_pair(line_number, exit_code));
+        }
+        session.running_batch = false;
+
+        resetParse();
+        session.contexts[GLOBAL_CONTEXT_IDX]->values = global_values;
+
+        for (auto& exit_code : result.exit_codes) {
+            result.failures += exit_code.second != 0;
+        }
+        result.seconds = std::chrono::duration<double>(
+            std::chrono::steady_clock::now() - start).count();
+        return result;
+    }
+
+    // Run the batch read from the file at path ('-' for stdin) and display
+    // a summary. Return 0 if every command line succeeded, 1 otherwise.
+    int startBatch(const std::string& path) {
+        BatchResult result {};
+        if (path == "-") {
+            result = runBatch(std::cin);
+        } else {
+            std::ifstream file { path };
+            if (!file) {
+                writeLine("Cannot open batch file: " + path);
+                return 1;
+            }
+            result = runBatch(file);
+        }
+
+        std::ostringstream summary {};
+        summary << "Batch: " << result.exit_codes.size() << " commands, "
+                << result.failures << " failed, in " << result.seconds
+                << " s (" << result.commandsPerSecond() << " commands/s)\n";
+        for (auto& exit_code : result.exit_codes) {
+            if (exit_code.second != 0) {
+                summary << "  line " << exit_code.first << ": exit code "
+                        << exit_code.second << "\n";
+            }
+        }
+        output_->write(summary.str());
+
+        return result.failures == 0 ? 0 : 1;
+    }
+
+#ifndef _WIN32
+    // Serve the command lines forwarded by ForwardToDaemon on a Unix domain
+    // socket created at socket_path, until the process is terminated. Each
+    // session runs in a child process forked from the daemon, so sessions
+    // share the definitions (and whatever the actions initialised before)
+    // but never each other's parse state. A socket left at socket_path is
+    // replaced, any other file is not. Return 1 if the socket cannot be
+    // set up.
+    int startDaemon(const std::string& socket_path) {
+        sockaddr_un address;
+        if (!makeDaemonAddress(socket_path, address)) {
+            writeLine("Invalid daemon socket path: " + socket_path);
+            return 1;
+        }
+
+        // Replace the socket left by a previous daemon, but nothing else
+        struct stat path_status;
+        if (lstat(socket_path.c_str(), &path_status) == 0) {
+            if (!S_ISSOCK(path_status.st_mode)) {
+                writeLine(formatMessage("Cannot listen on ", socket_path,
+                                        ": the file exists and is not a socket"));
+                return 1;
+            }
+            unlink(socket_path.c_str());
+        }
+
+        int listen_fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (listen_fd < 0
+                || fcntl(listen_fd, F_SETFD, FD_CLOEXEC) != 0
+                || bind(listen_fd, reinterpret_cast<sockaddr*>(&address),
+                        sizeof(address)) != 0
+                || listen(listen_fd, SOMAXCONN) != 0) {
+            writeLine(formatMessage("Cannot listen on ", socket_path, ": ",
+                                    std::strerror(errno)));
+            if (listen_fd >= 0) {
+                close(listen_fd);
+            }
+            return 1;
+        }
+
+        resetParse();
+        // Sessions are forked: nothing must be left to flush
+        output_->flush();
+        std::cout.flush();
+        // Running sessions; only they are reaped, not the other children
+        // of the process
+        std::set<pid_t> sessions {};
+        while (true) {
+            // Reap the finished sessions
+            for (auto it = sessions.begin(); it != sessions.end();) {
+                it = waitpid(*it, nullptr, WNOHANG) != 0 ? sessions.erase(it) : ++it;
+            }
+
+            int session_fd = accept(listen_fd, nullptr, nullptr);
+            if (session_fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) {
+                    continue;
+                }
+                writeLine(formatMessage("Cannot accept daemon sessions: ",
+                                        std::strerror(errno)));
+                close(listen_fd);
+                return 1;
+            }
+
+            pid_t pid = fork();
+            if (pid == 0) {
+                close(listen_fd);
+                _exit(serveDaemonSession(session_fd));
+            } else if (pid < 0) {
+                writeLine(formatMessage("Cannot start a daemon session: ",
+                                        std::strerror(errno)));
             } else {
-                std::string action = argv[arg_idx];
-                if (isActionDefined(action)) {
-                    ContextPtr action_context { new Context() };
-                    action_context->flags = std::map<std::string, FlagBase*> {};
-
-                    // Copy the specific action flags, so that, in case this
-                    // action has been chained multiple times, each context
-                    // will have a different flag instace, thus allowing to
-                    // parse and store different flag values - example:
-                    // `app_name action_1 --flag_a foo + action_1 --flag_a bar`
-                    for (auto& k_v : actions_[argv[arg_idx]]->flags) {
-                        switch (getTypeOfFlag(k_v.second)) {
-                            case FlagType::Bool:
-                                action_context->flags[k_v.first] = new Flag<bool>(
-                                    *(static_cast<Flag<bool>*>(k_v.second)));
-                                break;
-                            case FlagType::String:
-                                action_context->flags[k_v.first] = new Flag<std::string>(
-                                    *(static_cast<Flag<std::string>*>(k_v.second)));
-                                break;
-                            case FlagType::Int:
-                                action_context->flags[k_v.first] = new Flag<int>(
-                                    *(static_cast<Flag<int>*>(k_v.second)));
-                                break;
-                            case FlagType::Double:
-                                action_context->flags[k_v.first] = new Flag<double>(
-                                    *(static_cast<Flag<double>*>(k_v.second)));
-                                break;
-                        }
-                    }
+                sessions.insert(pid);
+            }
+            close(session_fd);
+        }
+    }
+#endif
+
+    template <typename Type>
+    FlagHandle<Type> defineGlobalFlag(std::string aliases, std::string description,
+                                      Type default_value,
+                                      FlagCallback<Type> flag_callback) {
+        checkNotSealed();
+        invalidateHelp();
+        Flag<Type>* flagp = definitions_.make<Flag<Type>>();
+        flagp->aliases = aliases;
+        flagp->value = default_value;
+        flagp->description = description;
+        flagp->flag_callback = flag_callback;
+        // Aliases are space separated
+        std::istringstream iss { aliases };
+        while (iss) {
+            std::string tmp;
+            iss >> tmp;
+            global_flag_aliases_[tmp] = flagp;
+        }
+        global_flags_.push_back(flagp);
+
+        // vlevel is special and we don't want it showing up in the help list
+        if (aliases != "vlevel") {
+            registered_flags_["global"].push_back(flagp);
+        }
+
+        return FlagHandle<Type> { this, nullptr, flagp };
+    }
+
+    template <typename Type>
+    FlagHandle<Type> defineActionFlag(std::string action_name, std::string aliases,
+                                      std::string description, Type default_value,
+                                      FlagCallback<Type> flag_callback) {
+        checkNotSealed();
+        return addActionFlag<Type>(definedAction(action_name), aliases, description,
+                                   default_value, flag_callback);
+    }
+
+    void defineAction(std::string name, int arity, bool chainable,
+                      std::string description, std::string help_string,
+                      ActionCallback action_callback,
+                      ArgumentsCallback arguments_callback) {
+        Action* actionp = newAction(name, arity, chainable, description,
+                                    help_string);
+        actionp->action_callback = action_callback;
+        actionp->arguments_callback = arguments_callback;
+    }
+
+    void defineAction(std::string name, int arity, bool chainable,
+                      std::string description, std::string help_string,
+                      ActionViewCallback action_callback,
+                      ArgumentsViewCallback arguments_callback) {
+        Action* actionp = newAction(name, arity, chainable, description,
+                                    help_string);
+        actionp->action_view_callback = action_callback;
+        actionp->arguments_view_callback = arguments_callback;
+    }
+
+    void defineAction(std::string name, int arity, bool chainable,
+                      std::string description, std::string help_string,
+                      ActionContextCallback action_callback,
+                      ArgumentsViewCallback arguments_callback) {
+        Action* actionp = newAction(name, arity, chainable, description,
+                                    help_string);
+        actionp->action_context_callback = action_callback;
+        actionp->arguments_view_callback = arguments_callback;
+    }
+
+    void defineAction(std::string name, int arity, bool chainable,
+                      std::string description, std::string help_string,
+                      AsyncActionCallback action_callback,
+                      ArgumentsViewCallback arguments_callback) {
+        Action* actionp = newAction(name, arity, chainable, description,
+                                    help_string);
+        actionp->async_callback = action_callback;
+        actionp->arguments_view_callback = arguments_callback;
+    }
+
+    void setActionDependencies(const std::string& action_name,
+                               const std::vector<std::string>& dependencies) {
+        checkNotSealed();
+        Action* actionp = definedAction(action_name);
+        if (!actionp) {
+            throw horsewhisperer_error { "undefined action: " + action_name };
+        }
+        actionp->has_dependencies = true;
+        actionp->dependencies = dependencies;
+    }
+
+    void setActionTimeout(const std::string& action_name,
+                          std::chrono::milliseconds timeout) {
+        checkNotSealed();
+        Action* actionp = definedAction(action_name);
+        if (!actionp) {
+            throw horsewhisperer_error { "undefined action: " + action_name };
+        }
+        actionp->timeout = timeout;
+    }
+
+    void setActionCacheable(const std::string& action_name, bool cacheable) {
+        checkNotSealed();
+        Action* actionp = definedAction(action_name);
+        if (!actionp) {
+            throw horsewhisperer_error { "undefined action: " + action_name };
+        }
+        // Only the output written through the ActionContext is replayed
+        if (cacheable && (actionp->action_callback || actionp->action_view_callback)) {
+            throw horsewhisperer_error { "cacheable action " + action_name
+                                         + " must take an ActionContext" };
+        }
+        actionp->cacheable = cacheable;
+    }
+
+    void setActionInputs(const std::string& action_name, ActionInputsCallback inputs) {
+        checkNotSealed();
+        Action* actionp = definedAction(action_name);
+        if (!actionp) {
+            throw horsewhisperer_error { "undefined action: " + action_name };
+        }
+        actionp->inputs = inputs;
+    }
+
+    // Directory of the cached results of the cacheable actions; an empty
+    // directory disables the cache
+    void setCacheDirectory(const std::string& directory) {
+        result_cache_.setDirectory(directory);
+    }
+
+    // Define the flags and actions of schema, which is not copied. Each
+    // action is defined when first looked up, the global flags when
+    // parsing starts, and all of them by seal() and help(); defining a
+    // schema therefore only costs sorting the hashes of the action names
+    // when most actions go unused.
+    void defineStaticSchema(const StaticSchema& schema) {
+        checkNotSealed();
+        if (static_schema_.actions || static_schema_.global_flags) {
+            throw horsewhisperer_error { "a static schema is already defined" };
+        }
+        invalidateHelp();
+        static_schema_ = schema;
+        static_action_index_.clear();
+        static_action_index_.reserve(schema.action_count);
+        for (size_t idx = 0; idx < schema.action_count; idx++) {
+            static_action_index_.emplace_back(schema.actions[idx].name_hash, idx);
+        }
+        std::sort(static_action_index_.begin(), static_action_index_.end());
+        static_actions_.reset(new std::atomic<Action*>[schema.action_count]());
+        static_global_flags_defined_ = false;
+        static_actions_left_ = schema.action_count;
+    }
+
+    void defineAction(std::string name, int arity, bool chainable,
+                      std::string description, std::string help_string,
+                      ActionStreamCallback action_callback) {
+        if (arity >= 0) {
+            throw horsewhisperer_error { "streaming action " + name
+                                         + " must have a negative arity" };
+        }
+        Action* actionp = newAction(name, arity, chainable, description,
+                                    help_string);
+        actionp->action_stream_callback = action_callback;
+    }
+
+    template <typename Type>
+    Type getFlagValue(std::string name) throw (undefined_flag_error) {
+        FlagRef ref = findFlag(name);
+        if (ref.flag) {
+            return readFlag<Type>(ref);
+        }
+
+        throw undefined_flag_error { "undefined flag: " + name };
+    };
+
+    FlagType checkAndGetTypeOfFlag(const std::string& flag_name) {
+        FlagRef ref = findFlag(flag_name);
+
+        if (!ref.flag) {
+            throw undefined_flag_error { "undefined flag: " + flag_name };
+        }
+
+        return getTypeOfFlag(ref.flag);
+    }
+
+    // ALSO check both contexts
+    template <typename Type>
+    void setFlag(std::string name, Type value) throw (undefined_flag_error,
+                                                      flag_validation_error) {
+        FlagRef ref = findFlag(name);
+        if (ref.flag) {
+            writeFlag<Type>(ref, name, value);
+            return;
+        }
+
+        throw undefined_flag_error { "undefined flag: " + name };
+    };
+
+    // Build the lookup tables used by parse; no flag or action can be
+    // defined afterwards, until the next reset
+    void seal() {
+        materializeStaticSchema();
+        std::map<std::string, Symbol> symbols {};
+
+        for (auto& k_v : global_flag_aliases_) {
+            symbols[k_v.first].global_flag = k_v.second;
+        }
+        for (auto& action : actions_) {
+            symbols[action.first].action = action.second;
+            for (auto& k_v : action.second->flags) {
+                symbols[k_v.first].action_flags.push_back(
+                    std::make_pair(action.second, k_v.second));
+            }
+        }
+
+        std::vector<std::string> names {};
+        names.reserve(symbols.size());
+        symbols_.clear();
+        symbols_.reserve(symbols.size());
+        for (auto& k_v : symbols) {
+            names.push_back(k_v.first);
+            symbols_.push_back(k_v.second);
+        }
+        names_.build(names);
+        sealed_ = true;
+    }
+
+    bool isSealed() {
+        return sealed_;
+    }
+
+    // Return the reference a handle resolves to in the current context
+    template <typename Type>
+    FlagRef getHandleFlag(const Action* action, Flag<Type>* flag) {
+        SessionState& session = currentSession();
+        return getHandleFlag(action, flag, session, currentContext(session));
+    }
+
+    // As above, in the given context of session
+    template <typename Type>
+    FlagRef getHandleFlag(const Action* action, Flag<Type>* flag,
+                          SessionState& session, Context* context) {
+        if (action == nullptr) {
+            return FlagRef { flag, session.contexts[GLOBAL_CONTEXT_IDX] };
+        }
+
+        if (context->action != action) {
+            throw undefined_flag_error { "undefined flag: " + flag->aliases };
+        }
+
+        return FlagRef { flag, context };
+    }
+
+    template <typename Type>
+    Type readFlag(const FlagRef& ref) {
+        const Flag<Type>* flagp = static_cast<const Flag<Type>*>(ref.flag);
+        return ref.context->get<Type>(flagp);
+    }
+
+    template <typename Type>
+    void writeFlag(const FlagRef& ref, const std::string& name, Type value) {
+        Flag<Type>* flagp = static_cast<Flag<Type>*>(ref.flag);
+        if (flagp->flag_callback) {
+            TraceSpan span { tracer_, "flag callback", name };
+            bool valid { flagp->flag_callback(value) };
+            span.setResult(valid);
+            if (!valid) {
+                throw flag_validation_error { "callback for flag '" + name +
+                                              "' returned false" };
+            }
+        }
+        ref.context->set<Type>(flagp, value);
+    }
+
+    std::vector<std::string> getParsedActions() {
+        SessionState& session = currentSession();
+        std::vector<std::string> action_container {};
+
+        if (session.parsed && session.contexts.size() > 1) {
+            for (size_t i = 0; i < session.contexts.size(); i++) {
+                if (session.contexts[i]->action) {
+                    action_container.push_back(session.contexts[i]->action->name);
+                }
+            }
+        }
+
+        return action_container;
+    }
+
+    void setHelpMargins(unsigned int left_margin, unsigned int right_margin) {
+        description_margin_left_ = left_margin;
+        description_margin_right_ = right_margin;
+        invalidateHelp();
+    }
+
+    // Record the spans of the parse and execution phases, until
+    // stopTracing; see Tracer
+    void startTracing() {
+        tracer_.start();
+    }
+
+    void stopTracing() {
+        tracer_.stop();
+    }
+
+    void writeTrace(std::ostream& output) {
+        tracer_.write(output);
+    }
+
+    bool writeTraceFile(const std::string& path) {
+        std::ofstream file { path };
+        if (!file) {
+            return false;
+        }
+        tracer_.write(file);
+        return static_cast<bool>(file);
+    }
+
+    // Sink of the messages, help and records; nullptr restores the
+    // default one, writing to std::cout
+    void setOutputSink(OutputSink* sink) {
+        output_->flush();
+        output_ = sink ? sink : &default_output_;
+    }
+
+    OutputSink& output() {
+        return *output_;
+    }
+
+    // Write what the sink buffered
+    void flush() {
+        output_->flush();
+    }
+
+    // Errors reported by the last parse and execution of the current
+    // session, in order
+    const std::vector<Diagnostic>& getDiagnostics() {
+        return currentSession().diagnostics;
+    }
+
+    // Debug method
+    void printState() {
+        SessionState& session = currentSession();
+        std::stringstream ss {};
+        ss << "Current context index = " << std::to_string(session.current_context_idx);
+        if (session.contexts.size() > 1) {
+            for (size_t idx = 1; idx < session.contexts.size(); idx++) {
+                ss << "\n" << session.contexts[idx]->toString();
+            }
+        }
+        writeLine(ss.str());
+    }
+
+  private:
+    friend class ActionContext;
+    friend class Session;
+
+    // Owner of the flags and actions, released by reset()
+    Arena definitions_;
+
+    // State of the command lines parsed without a Session
+    SessionState session_;
+
+    // Where messages are written; default_output_ unless set
+    StreamSink default_output_;
+    OutputSink* output_;
+
+    // Registered flags
+    std::map<std::string, Action*> actions_;
+
+    // The same actions by the hash of their name (see nameHash), so that
+    // parse looks tokens up without copying them
+    std::multimap<uint64_t, Action*> action_hashes_;
+
+    // Global flags by alias
+    std::map<std::string, FlagBase*> global_flag_aliases_;
+
+    // Distinct global flags, in definition order
+    std::vector<FlagBase*> global_flags_;
+
+    // Built-in global flags changing how the actions run, not their
+    // results; the result cache ignores them
+    std::set<const FlagBase*> execution_flags_;
+
+    // Maps contexts (global and single actions) to registered flags
+    std::map<std::string, std::vector<FlagBase*>> registered_flags_;
+
+    // Whether definitions are sealed
+    bool sealed_;
+
+    // Sealed lookup tables; names_ maps each action name and flag alias
+    // to its index in symbols_
+    PerfectHashTable names_;
+    std::vector<Symbol> symbols_;
+
+    // Action delimeters
+    TokenSet delimiters_;
+
+    // Pipe delimiters
+    TokenSet pipe_delimiters_;
 
-                    action_context->action = actions_[argv[arg_idx]];
-                    action_context->arguments = Arguments {};
-                    context_mgr_.push_back(std::move(action_context));
-                    current_context_idx_++;
-
-                    assert(current_context_idx_ == context_mgr_.size() - 1);
-
-                    // parse arguments and action flags
-                    int arity = context_mgr_[current_context_idx_]->action->arity;
-                    if (arity > 0) {  // iff read parameters = arity
-                        while (arity > 0) {
-                            ++arg_idx;
-                            if (arg_idx >= argc) {  // have we run out of tokens?
-                                break;
-                            } else if (argv[arg_idx][0] == '-') {  // is it a flag token?
-                                int parse_flag_outcome { parseFlag(argv, arg_idx ) };
-                                if (parse_flag_outcome != PARSE_OK) {
-                                    return parse_flag_outcome;
-                                }
-                            } else if (isActionDefined(argv[arg_idx])) {  // is it an action?
-                                std::cout << "Expected parameter for action: " << action
-                                          << ". Found action: " << argv[arg_idx] << std::endl;
-                                return PARSE_ERROR;
-                            } else if (std::find(delimiters_.begin(), delimiters_.end(),
-                                                 argv[arg_idx]) != delimiters_.end()) {  // is it a delimiter?
-                                std::cout << "Expected parameter for action: " << action
-                                          << ". Found delimiter: " << argv[arg_idx] << std::endl;
-                                return PARSE_ERROR;
-                            } else {
-                                context_mgr_[current_context_idx_]->arguments.push_back(argv[arg_idx]);
-                                arity--;
-                            }
-                        }
+    // Application name
+    std::string application_name_;
 
-                        if (arity > 0) {
-                            std::cout << "Expected "
-                                      << context_mgr_[current_context_idx_]->action->arity
-                                      << " parameters for action " << action << ". Only read "
-                                      << context_mgr_[current_context_idx_]->action->arity - arity
-                                      << "." << std::endl;
-                            return PARSE_ERROR;
-                        }
-                    } else if (arity < 0) {  // if read parameters at least = arity
-                        // When arity is an "at least" representation we eat arguments
-                        // until we either run out or until we hit a delimiter.
+    // Text header of the help message
+    std::string help_banner_;
 
-                        if (arg_idx >= argc - 1) {
-                            std::cout << "No arguments specified for " << action << ".\n";
-                            return PARSE_ERROR;
-                        }
+    // Version information
+    std::string version_string_;
 
-                        int abs_arity { -arity };
-
-                        do {
-                            ++arg_idx;
-                            if (argv[arg_idx][0] == '-') {
-                                int parse_flag_outcome { parseFlag(argv, arg_idx ) };
-                                if (parse_flag_outcome != PARSE_OK) {
-                                    return parse_flag_outcome;
-                                }
-                            }else {
-                                context_mgr_[current_context_idx_]->arguments.push_back(argv[arg_idx]);
-                                --abs_arity;
-                            }
-                        } while ((arg_idx+1 < argc)
-                                  && std::find(delimiters_.begin(), delimiters_.end(),
-                                               argv[arg_idx+1]) == delimiters_.end());
-
-                        if (abs_arity > 0) {
-                            auto expected_arity = -context_mgr_[current_context_idx_]->action->arity;
-                            std::cout << "Expected at least " << expected_arity
-                                      << " parameters for action " << action << ". Only read "
-                                      << expected_arity - abs_arity
-                                      << "." << std::endl;
-                            return PARSE_ERROR;
-                        }
-                    }
-                } else {
-                    std::cout << "Unknown action: " << argv[arg_idx] << std::endl;
-                    return PARSE_ERROR;
-                }
+    // Margins, indicated as number of columns
+    unsigned int description_margin_left_;
+    unsigned int description_margin_right_;
+
+    // Spans of the phases, recorded while tracing
+    Tracer tracer_;
+
+    // Cancels the actions running past their deadline
+    Watchdog watchdog_;
+
+    // Results of the cacheable actions
+    ResultCache result_cache_;
+
+#ifndef _WIN32
+    // Watcher of the inputs while in watch mode, for stopWatching
+    FileWatcher* watcher_;
+    std::mutex watch_mutex_;
+#endif
+    std::chrono::milliseconds watch_debounce_;
+
+    // Rendered help of the global context (nullptr) and of the actions
+    std::map<const Action*, std::string> help_cache_;
+    std::mutex help_mutex_;
+
+    // Static schema, and its definitions materialized so far (i.e.
+    // defined as the runtime ones). static_action_index_ holds the
+    // (name hash, index) pairs of the static actions sorted by hash; it is
+    // built by defineStaticSchema and only read afterwards. Sessions may
+    // parse at the same time: lookups read the index and the published
+    // actions without locking, and only materializing an action takes
+    // static_schema_mutex_. Materialized actions are not added to
+    // action_hashes_, which doesn't change while parsing.
+    StaticSchema static_schema_;
+    std::vector<std::pair<uint64_t, size_t>> static_action_index_;
+    std::unique_ptr<std::atomic<Action*>[]> static_actions_;
+    std::recursive_mutex static_schema_mutex_;
+    std::atomic<bool> static_global_flags_defined_;
+    std::atomic<size_t> static_actions_left_;
+
+    // Defines a flag of the static schema, globally if action is nullptr
+    struct StaticFlagDefiner {
+        HorseWhisperer* owner;
+        const StaticFlagDefinition& flag;
+        Action* action;
+
+        template <typename Type>
+        void visit() {
+            FlagCallback<Type> callback { nullptr };
+            if (auto static_callback = FlagTraits<Type>::staticCallback(flag.callback)) {
+                callback = static_callback;
+            }
+            Type default_value { FlagTraits<Type>::fromStatic(flag.default_value) };
+            if (action) {
+                owner->addActionFlag<Type>(action, flag.aliases, flag.description,
+                                           default_value, callback);
+            } else {
+                owner->defineGlobalFlag<Type>(flag.aliases, flag.description,
+                                              default_value, callback);
             }
         }
+    };
 
-        parsed_ = true;
-        return PARSE_OK;
+    void materializeStaticGlobalFlags() {
+        if (static_global_flags_defined_.load()) {
+            return;
+        }
+        std::lock_guard<std::recursive_mutex> lock { static_schema_mutex_ };
+        if (static_global_flags_defined_.load()) {
+            return;
+        }
+        for (size_t idx = 0; idx < static_schema_.global_flag_count; idx++) {
+            StaticFlagDefiner definer { this, static_schema_.global_flags[idx], nullptr };
+            visitFlagType(static_schema_.global_flags[idx].type, definer);
+        }
+        static_global_flags_defined_.store(true);
     }
 
-    bool validateActionArguments() {
-        if (!parsed_) {
-            return false;
+    // Return the action idx of the static schema, materializing it first
+    // if needed; an action defined at run time with the same name wins
+    Action* materializeStaticAction(size_t idx) {
+        Action* actionp { static_actions_[idx].load(std::memory_order_acquire) };
+        if (actionp) {
+            return actionp;
         }
-
-        if (context_mgr_.size() > 1) {
-            for (auto & context : context_mgr_) {
-                if (context->action && context->action->arguments_callback) {
-                    if (!context->action->arguments_callback(context->arguments)) {
-                        return false;
-                    }
-                }
-            }
+        std::lock_guard<std::recursive_mutex> lock { static_schema_mutex_ };
+        actionp = static_actions_[idx].load(std::memory_order_relaxed);
+        if (actionp) {
+            return actionp;
         }
-
-        return true;
+        const StaticActionDefinition& definition = static_schema_.actions[idx];
+        actionp = hashedAction(StringView { definition.name }, definition.name_hash);
+        if (actionp) {
+            static_actions_[idx].store(actionp, std::memory_order_release);
+            static_actions_left_.fetch_sub(1);
+            return actionp;
+        }
+        actionp = makeAction(definition.name, definition.arity,
+                             definition.chainable, definition.description,
+                             definition.help_string ? definition.help_string : "");
+        if (definition.action_callback) {
+            actionp->action_callback = definition.action_callback;
+        } else if (definition.action_view_callback) {
+            actionp->action_view_callback = definition.action_view_callback;
+        } else if (definition.action_context_callback) {
+            actionp->action_context_callback = definition.action_context_callback;
+        }
+        if (definition.arguments_callback) {
+            actionp->arguments_callback = definition.arguments_callback;
+        } else if (definition.arguments_view_callback) {
+            actionp->arguments_view_callback = definition.arguments_view_callback;
+        }
+        for (size_t flag_idx = 0; flag_idx < definition.flag_count; flag_idx++) {
+            StaticFlagDefiner definer { this, definition.flags[flag_idx], actionp };
+            visitFlagType(definition.flags[flag_idx].type, definer);
+        }
+        actions_[definition.name] = actionp;
+        // Published once the action and its flags are defined
+        static_actions_[idx].store(actionp, std::memory_order_release);
+        static_actions_left_.fetch_sub(1);
+        return actionp;
     }
 
-    // Dynamically output help information based on registered global and action
-    // specific flags
-    void help() {
-        if (context_mgr_[current_context_idx_]->action) {
-            actionHelp();
-        } else {
-            globalHelp();
+    // Return the index of the action of the static schema named so, whose
+    // name hashes to hash, or static_schema_.action_count
+    size_t staticActionIndex(StringView name, uint64_t hash) const {
+        auto it = std::lower_bound(static_action_index_.begin(), static_action_index_.end(),
+                                   std::make_pair(hash, size_t { 0 }));
+        for (; it != static_action_index_.end() && it->first == hash; ++it) {
+            if (name == StringView { static_schema_.actions[it->second].name }) {
+                return it->second;
+            }
         }
+        return static_schema_.action_count;
     }
 
-    // Display the version information on stdout
-    void version() {
-        std::cout << version_string_;
+    void materializeStaticSchema() {
+        materializeStaticGlobalFlags();
+        if (static_actions_left_.load() == 0) {
+            return;
+        }
+        for (size_t idx = 0; idx < static_schema_.action_count; idx++) {
+            materializeStaticAction(idx);
+        }
     }
 
-    bool whisper() {
-        if (!parsed_) {
-            return false;
+    // Return the defined action named so, materializing it from the
+    // static schema if needed; nullptr if the action is undefined
+    Action* definedAction(StringView name) {
+        uint64_t hash { nameHash(name) };
+        Action* actionp { hashedAction(name, hash) };
+        if (!actionp && !static_action_index_.empty()) {
+            size_t idx { staticActionIndex(name, hash) };
+            if (idx != static_schema_.action_count) {
+                actionp = materializeStaticAction(idx);
+            }
         }
+        return actionp;
+    }
 
-        current_context_idx_ = GLOBAL_CONTEXT_IDX - 1;
-        bool previous_result = true;
-
-        if (context_mgr_.size() > 1) {
-            for (size_t i = 0; i < context_mgr_.size(); i++) {
-                current_context_idx_++;
-                if (context_mgr_[i]->action) {
-                    if (!previous_result) {
-                        std::cout << "Not starting action '"
-                                  << context_mgr_[i]->action->name
-                                  << "'. Previous action failed to complete "
-                                  << "successfully." << std::endl;
-                    } else {
-                        // Record the current_context_idx_. Calling parse inside
-                        // an action_callback allows the context list to grow
-                        // during execution but has the side effect of mutating
-                        // the current_context_index.
-                        int tmp = current_context_idx_;
-                        // Flip it because success is 0
-                        previous_result = !context_mgr_[i]->action->action_callback(
-                                                context_mgr_[i]->arguments);
-                        current_context_idx_ = tmp;
-                        if (!context_mgr_[i]->action->chainable) {
-                            return !previous_result;
-                        }
-                    }
-                }
-           }
-        } else {
-            std::cout << "No action specified. See \"" << application_name_
-                      << " --help\" for available actions." << std::endl;
+    // Return the action named so, whose name hashes to hash, if defined
+    Action* hashedAction(StringView name, uint64_t hash) const {
+        auto range = action_hashes_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (name == StringView { it->second->name }) {
+                return it->second;
+            }
         }
-
-        return !previous_result;
+        return nullptr;
     }
 
-    template <typename Type>
-    void defineGlobalFlag(std::string aliases, std::string description,
-                          Type default_value, FlagCallback<Type> flag_callback){
-        Flag<Type>* flagp = new Flag<Type>();
-        flagp->aliases = aliases;
-        flagp->value = default_value;
-        flagp->description = description;
-        flagp->flag_callback = flag_callback;
-        // Aliases are space separated
-        std::istringstream iss { aliases };
-        while (iss) {
-            std::string tmp;
-            iss >> tmp;
-            context_mgr_[GLOBAL_CONTEXT_IDX]->flags[tmp] = flagp;
+    Action* newAction(const std::string& name, int arity, bool chainable,
+                      const std::string& description,
+                      const std::string& help_string) {
+        checkNotSealed();
+        Action* actionp = makeAction(name, arity, chainable, description, help_string);
+        // A redefined action replaces the previous one
+        uint64_t hash { nameHash(StringView { name }) };
+        auto range = action_hashes_.equal_range(hash);
+        for (auto it = range.first; it != range.second; ++it) {
+            if (it->second->name == name) {
+                action_hashes_.erase(it);
+                break;
+            }
         }
+        action_hashes_.emplace(hash, actionp);
+        actions_[name] = actionp;
+        return actionp;
+    }
 
-        // vlevel is special and we don't want it showing up in the help list
-        if (aliases != "vlevel") {
-            registered_flags_["global"].push_back(flagp);
-        }
+    Action* makeAction(const std::string& name, int arity, bool chainable,
+                       const std::string& description,
+                       const std::string& help_string) {
+        invalidateHelp();
+        Action* actionp = definitions_.make<Action>();
+        actionp->name = name;
+        actionp->arity = arity;
+        actionp->description = description;
+        actionp->help_string_ = help_string;
+        actionp->chainable = chainable;
+        actionp->has_dependencies = false;
+        actionp->timeout = std::chrono::milliseconds::zero();
+        actionp->cacheable = false;
+        return actionp;
     }
 
     template <typename Type>
-    void defineActionFlag(std::string action_name, std::string aliases, std::string description,
-                          Type default_value, FlagCallback<Type> flag_callback){
-        Flag<Type>* flagp = new Flag<Type>();
+    FlagHandle<Type> addActionFlag(Action* actionp, const std::string& aliases,
+                                   const std::string& description, Type default_value,
+                                   FlagCallback<Type> flag_callback) {
+        invalidateHelp();
+        Flag<Type>* flagp = definitions_.make<Flag<Type>>();
         flagp->aliases = aliases;
         flagp->value = default_value;
         flagp->description = description;
         flagp->flag_callback = flag_callback;
+        actionp->flag_list.push_back(flagp);
         // Aliases are space separated
         std::istringstream iss { aliases };
         std::string tmp;
         while (iss >> tmp) {
-            actions_[action_name]->flags[tmp] = flagp;
+            actionp->flags[tmp] = flagp;
         }
-        registered_flags_[action_name].push_back(flagp);
+        registered_flags_[actionp->name].push_back(flagp);
+
+        return FlagHandle<Type> { this, actionp, flagp };
     }
 
-    void defineAction(std::string name, int arity, bool chainable,
-                      std::string description, std::string help_string,
-                      ActionCallback action_callback,
-                      ArgumentsCallback arguments_callback) {
-        Action* actionp = new Action();
-        actionp->name = name;
-        actionp->arity = arity;
-        actionp->description = description;
-        actionp->help_string_ = help_string;
-        actionp->action_callback = action_callback;
-        actionp->arguments_callback = arguments_callback;
-        actionp->chainable = chainable;
-        actions_[name] = actionp;
+    // Whether the action arguments must be copied for the action callbacks
+    static bool needsArgumentsCopy(const Action* action) {
+        return (action->action_callback && !action->action_view_callback)
+               || (action->arguments_callback && !action->arguments_view_callback);
     }
 
-    template <typename Type>
-    Type getFlagValue(std::string name) throw (undefined_flag_error) {
-        int context_idx = getContextIdxIfDefined(name);
-        if (context_idx != NO_CONTEXT_IDX) {
-            return static_cast<Flag<Type>*>(context_mgr_[context_idx]->flags[name])->value;
+    void reserveArguments(Context& context, int count) {
+        context.argument_views.reserve(count);
+        if (needsArgumentsCopy(context.action)) {
+            context.arguments.reserve(count);
         }
+    }
 
-        throw undefined_flag_error { "undefined flag: " + name };
-    };
-
-    FlagType checkAndGetTypeOfFlag(const std::string& flag_name) {
-        int context_idx = getContextIdxIfDefined(flag_name);
+    void addArgument(Context& context, StringView argument) {
+        context.argument_views.push_back(argument);
+        if (needsArgumentsCopy(context.action)) {
+            context.arguments.push_back(argument.str());
+        }
+    }
 
-        if (context_idx == NO_CONTEXT_IDX) {
-            throw undefined_flag_error { "undefined flag: " + flag_name };
+    int invokeAction(Context& context) {
+        TraceSpan span { tracer_, "action", context.action->name };
+        span.addArguments(ArgumentsView { context.argument_views });
+        SessionState& session = currentSession();
+        std::string cache_key {};
+        if (isCached(context)) {
+            ResultCache::Result cached {};
+            cache_key = cacheKey(session, context);
+            if (!cache_key.empty() && result_cache_.load(cache_key, cached)) {
+                span.addArgument("cache", "hit");
+                if (!cached.output.empty()) {
+                    output_->write(cached.output);
+                }
+                span.setResult(cached.exit_code);
+                return cached.exit_code;
+            }
+            context.captured_output.reset(new std::string());
         }
 
-        return getTypeOfFlag(context_mgr_[context_idx]->flags[flag_name]);
-    }
+        size_t watch_id { watchCancellation(session, context) };
+        int result { 1 };
+        try {
+            result = invokeCallback(context);
+        } catch (...) {
+            unwatchCancellation(context, watch_id);
+            context.captured_output.reset();
+            throw;
+        }
+        if (unwatchCancellation(context, watch_id)) {
+            result = cancelledAction(session, context);
+        }
 
-    // ALSO check both contexts
-    template <typename Type>
-    void setFlag(std::string name, Type value) throw (undefined_flag_error,
-                                                      flag_validation_error) {
-        int context_idx = getContextIdxIfDefined(name);
-        if (context_idx != NO_CONTEXT_IDX) {
-            Flag<Type>* flagp = static_cast<Flag<Type>*>(
-                                    context_mgr_[context_idx]->flags[name]);
-            if (flagp->flag_callback && !flagp->flag_callback(value)) {
-                throw flag_validation_error { "callback for flag '" + name +
-                                              "' returned false" };
+        if (context.captured_output) {
+            if (!cache_key.empty() && result != ACTION_CANCELLED) {
+                result_cache_.store(cache_key,
+                                    ResultCache::Result { result, *context.captured_output });
             }
-            flagp->value = value;
-            return;
+            context.captured_output.reset();
         }
+        span.setResult(result);
+        return result;
+    }
 
-        throw undefined_flag_error { "undefined flag: " + name };
-    };
+    // Whether the result of the action of context is read from and stored
+    // in the cache: the action is cacheable, takes an ActionContext, whose
+    // writes are captured, and isn't piped, as its result would then
+    // depend on more than its arguments, flags and inputs. Streaming and
+    // asynchronous actions take no ActionContext callback.
+    bool isCached(const Context& context) const {
+        const Action* action = context.action;
+        return action->cacheable && result_cache_.enabled()
+               && action->action_context_callback
+               && !context.input && !context.output;
+    }
 
-    std::vector<std::string> getParsedActions() {
-        std::vector<std::string> action_container {};
+    // Value of flag in context, prefixed by its size, with the precision
+    // of the floating point types
+    static std::string flagValueKey(Context& context, const FlagBase* flag) {
+        std::ostringstream value {};
+        value << std::setprecision(std::numeric_limits<double>::max_digits10);
+        Context::ValuePrinter printer { value, context, flag };
+        visitFlagType(flag->type, printer);
+        return std::to_string(value.str().size()) + ":" + value.str();
+    }
 
-        if (parsed_ && context_mgr_.size() > 1) {
-            for (size_t i = 0; i < context_mgr_.size(); i++) {
-                if (context_mgr_[i]->action) {
-                    action_container.push_back(context_mgr_[i]->action->name);
+    // Everything the result of the action of context depends on: its name,
+    // its arguments, the values of its flags and of the global flags,
+    // except the execution flags, and the contents of its inputs. Empty if
+    // an input can't be read, so that the action runs uncached.
+    std::string cacheKey(SessionState& session, Context& context) {
+        std::ostringstream key {};
+        key << "action " << context.action->name.size() << ":" << context.action->name
+            << "\n";
+        for (auto& argument : context.argument_views) {
+            key << "argument " << argument.size() << ":" << argument << "\n";
+        }
+        for (auto flag : context.action->flag_list) {
+            key << "flag " << flag->aliases << "=" << flagValueKey(context, flag) << "\n";
+        }
+        Context& global_context = *session.contexts[GLOBAL_CONTEXT_IDX];
+        for (auto flag : global_flags_) {
+            if (execution_flags_.count(flag)) {
+                continue;
+            }
+            key << "global " << flag->aliases << "="
+                << flagValueKey(global_context, flag) << "\n";
+        }
+        if (context.action->inputs) {
+            for (auto& path : context.action->inputs(ActionContext { &session, &context })) {
+                MappedFile file {};
+                if (!file.open(path)) {
+                    return "";
                 }
+                size_t size = file.end() - file.begin();
+                key << "input " << path.size() << ":" << path << " " << size << " "
+                    << std::hex << contentHash(file.begin(), size) << std::dec << "\n";
             }
         }
-
-        return action_container;
+        return key.str();
     }
 
-    void setHelpMargins(unsigned int left_margin, unsigned int right_margin) {description_margin_left_ = left_margin;
-        description_margin_right_ = right_margin;
-    }
+    // Give context a Cancellation, watched by the watchdog until
+    // unwatchCancellation, if its action can be cancelled: if it has a
+    // deadline or signals are handled. When cancelled, the pipeline queues
+    // of the context are closed, so that its neighbours stop waiting for it.
+    size_t watchCancellation(SessionState& session, Context& context) {
+        std::chrono::milliseconds timeout { context.action->timeout };
+        if (timeout == std::chrono::milliseconds::zero()) {
+            timeout = session.action_timeout;
+        }
+        Watchdog::Clock::time_point deadline { session.deadline };
+        if (timeout > std::chrono::milliseconds::zero()) {
+            deadline = std::min(deadline, Watchdog::Clock::now() + timeout);
+        }
+        if (deadline == Watchdog::Clock::time_point::max()
+                && !Watchdog::handlingSignals().load()) {
+            context.cancellation.reset();
+            return 0;
+        }
 
-    // Debug method
-    void printState() {
-        std::stringstream ss {};
-        ss << "Current context index = " << std::to_string(current_context_idx_);
-        if (context_mgr_.size() > 1) {
-            for (size_t idx = 1; idx < context_mgr_.size(); idx++) {
-                ss << "\n" << context_mgr_[idx]->toString();
+        context.cancellation = std::make_shared<Cancellation>();
+        std::shared_ptr<RecordQueue> input { context.input };
+        std::shared_ptr<RecordQueue> output { context.output };
+        context.cancellation->onCancel([input, output]() {
+            if (input) {
+                input->closeReader();
+            }
+            if (output) {
+                output->closeWriter();
             }
+        });
+        return watchdog_.watch(context.cancellation, deadline);
+    }
+
+    // Stop watching the cancellation of context; return true if the
+    // action was cancelled
+    bool unwatchCancellation(Context& context, size_t watch_id) {
+        if (!context.cancellation) {
+            return false;
         }
-        std::cout << ss.str() << "\n";
+        watchdog_.unwatch(watch_id);
+        return context.cancellation->cancelled();
     }
 
-  private:
-    // Index of the context currently being processed
-    int current_context_idx_;
+    // Report that the action of context was cancelled; return its exit code
+    int cancelledAction(SessionState& session, Context& context) {
+        const std::string& action = context.action->name;
+        bool interrupted { context.cancellation->reason() == CancelReason::Interrupted };
+        report(session, Diagnostic { DiagnosticCode::ActionCancelled,
+                                     formatMessage("Action '", action, "' was cancelled: ",
+                                                   interrupted ? "interrupted."
+                                                               : "deadline exceeded."),
+                                     action, 0 });
+        return ACTION_CANCELLED;
+    }
 
-    // Container of contexts
-    std::vector<ContextPtr> context_mgr_;
+    // Start the deadline of the parsed command line and, if signals are
+    // handled, handle the next one
+    void startChain(SessionState& session) {
+        int timeout { getFlagValue<int>("timeout") };
+        session.deadline = timeout > 0
+                           ? Watchdog::Clock::now() + std::chrono::milliseconds(timeout)
+                           : Watchdog::Clock::time_point::max();
+        session.action_timeout = std::chrono::milliseconds(
+            getFlagValue<int>("action-timeout"));
+#ifndef _WIN32
+        Watchdog::rearmSignalHandlers();
+#endif
+        session.signals = Watchdog::signalCount().load();
+    }
 
-    // Registered flags
-    std::map<std::string, Action*> actions_;
+    // Whether the actions of the command line must stop: it was
+    // interrupted or its deadline passed
+    bool chainCancelled(const SessionState& session) {
+        return Watchdog::signalCount().load() != session.signals
+               || (session.deadline != Watchdog::Clock::time_point::max()
+                   && Watchdog::Clock::now() >= session.deadline);
+    }
 
-    // Maps contexts (global and single actions) to registered flags
-    std::map<std::string, std::vector<FlagBase*>> registered_flags_;
+    int invokeCallback(Context& context) {
+        if (context.action->action_stream_callback) {
+            return context.action->action_stream_callback(*context.argument_stream);
+        } else if (context.action->action_context_callback) {
+            return context.action->action_context_callback(
+                ActionContext { &currentSession(), &context });
+        } else if (context.action->async_callback) {
+            // Wait for the completion
+            std::shared_ptr<std::promise<int>> completion { new std::promise<int>() };
+            std::future<int> exit_code { completion->get_future() };
+            ActionCompletion done {
+                completeOnce([completion](int code) { completion->set_value(code); }) };
+            // Once cancelled, stop waiting for the action
+            if (context.cancellation) {
+                context.cancellation->onCancel([done]() { done(ACTION_CANCELLED); });
+            }
+            context.action->async_callback(
+                ActionContext { &currentSession(), &context }, done);
+            return exit_code.get();
+        } else if (context.action->action_view_callback) {
+            return context.action->action_view_callback(
+                ArgumentsView { context.argument_views });
+        }
+        return context.action->action_callback(context.arguments);
+    }
 
-    // Whether CL args have been parsed
-    bool parsed_;
+    // Completion calling complete with the exit code of its first call only
+    static ActionCompletion completeOnce(ActionCompletion complete) {
+        std::shared_ptr<std::atomic<bool>> called { new std::atomic<bool>(false) };
+        return [complete, called](int exit_code) {
+            if (!called->exchange(true)) {
+                complete(exit_code);
+            }
+        };
+    }
 
-    // Action delimeters
-    std::vector<std::string> delimiters_;
+    // Start the first action of run that can start: an asynchronous action
+    // is left running, the other actions and the pipelines are run. Return
+    // false if no action can start.
+    bool stepNextAction(SessionState& session, std::shared_ptr<AsyncRun> run) {
+        for (size_t idx = GLOBAL_CONTEXT_IDX + 1; idx < session.contexts.size(); idx++) {
+            Context& context = *session.contexts[idx];
+            // Piped actions run with the first action of their pipeline
+            if (run->states[idx] == WAITING && !context.input
+                    && dependenciesSucceeded(idx, run->states)) {
+                size_t last { pipelineEnd(session, idx) };
+                Context* calling_context { workerContext() };
+                workerContext() = &context;
+
+                if (last == idx && context.action->async_callback) {
+                    run->states[idx] = RUNNING;
+                    ++run->running;
+                    // Spans the action until its completion
+                    std::shared_ptr<TraceSpan> span {};
+                    if (tracer_.enabled()) {
+                        span.reset(new TraceSpan { tracer_, "action", context.action->name });
+                        span->addArguments(ArgumentsView { context.argument_views });
+                    }
+                    size_t watch_id { watchCancellation(session, context) };
+                    ActionCompletion done { completeOnce([this, &session, &context, run, idx, span,
+                                                          watch_id](int exit_code) {
+                        if (unwatchCancellation(context, watch_id)) {
+                            exit_code = cancelledAction(session, context);
+                        }
+                        if (span) {
+                            span->setResult(exit_code);
+                            span->end();
+                        }
+                        std::function<void()> on_progress {};
+                        {
+                            std::lock_guard<std::mutex> lock { run->mutex };
+                            run->completed.emplace_back(idx, exit_code);
+                            on_progress = run->on_progress;
+                        }
+                        if (on_progress) {
+                            on_progress();
+                        }
+                    }) };
+                    // Once cancelled, stop waiting for the action
+                    if (context.cancellation) {
+                        context.cancellation->onCancel([done]() { done(ACTION_CANCELLED); });
+                    }
+                    try {
+                        context.action->async_callback(
+                            ActionContext { &session, &context }, done);
+                    } catch (...) {
+                        workerContext() = calling_context;
+                        done(1);
+                        throw;
+                    }
+                    workerContext() = calling_context;
+                    return true;
+                }
 
-    // Application name
-    std::string application_name_;
+                int result { 1 };
+                try {
+                    result = last == idx ? invokeAction(context)
+                                         : invokePipeline(session, idx, last);
+                } catch (...) {
+                    workerContext() = calling_context;
+                    for (size_t i = idx; i <= last; i++) {
+                        run->states[i] = FAILED;
+                    }
+                    run->failed = true;
+                    throw;
+                }
+                workerContext() = calling_context;
+                for (size_t i = idx; i <= last; i++) {
+                    run->states[i] = result == 0 ? SUCCEEDED : FAILED;
+                }
+                run->failed = run->failed || result != 0;
+                return true;
+            }
+            if (!context.action->chainable) {
+                break;
+            }
+        }
+        return false;
+    }
 
-    // Text header of the help message
-    std::string help_banner_;
+    // Index of the last action of the pipeline starting at idx
+    size_t pipelineEnd(SessionState& session, size_t idx) {
+        while (session.contexts[idx]->output) {
+            idx++;
+        }
+        return idx;
+    }
 
-    // Version information
-    std::string version_string_;
+    // Run the actions of the pipeline from first to last together, each on
+    // its own thread but the last, run on the calling thread. When an action
+    // returns, the next one reads the end of its input and the previous one
+    // can't write anymore. Return 0 if every action succeeded, 1 otherwise.
+    int invokePipeline(SessionState& session, size_t first, size_t last) {
+        std::vector<int> results(last - first + 1, 1);
+        std::exception_ptr error {};
+        std::mutex mutex {};
+        auto run = [&](size_t idx) {
+            Context& context = *session.contexts[idx];
+            workerContext() = &context;
+            try {
+                results[idx - first] = invokeAction(context);
+            } catch (...) {
+                std::lock_guard<std::mutex> lock { mutex };
+                if (!error) {
+                    error = std::current_exception();
+                }
+            }
+            if (context.output) {
+                context.output->closeWriter();
+            }
+            if (context.input) {
+                context.input->closeReader();
+            }
+        };
 
-    // Margins, indicated as number of columns
-    unsigned int description_margin_left_;
-    unsigned int description_margin_right_;
+        std::vector<std::thread> threads {};
+        for (size_t idx = first; idx < last; idx++) {
+            threads.emplace_back([&run, &session, idx]() {
+                activeSession() = &session;
+                run(idx);
+            });
+        }
+        Context* calling_context { workerContext() };
+        run(last);
+        workerContext() = calling_context;
+        for (auto& thread : threads) {
+            thread.join();
+        }
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        for (auto result : results) {
+            if (result != 0) {
+                return 1;
+            }
+        }
+        return 0;
+    }
 
     void clean() {
-        context_mgr_.clear();
+        session_.reset();
         actions_.clear();
+        action_hashes_.clear();
         registered_flags_.clear();
+        global_flag_aliases_.clear();
+        global_flags_.clear();
+        execution_flags_.clear();
         delimiters_.clear();
+        pipe_delimiters_.clear();
+        names_ = PerfectHashTable {};
+        symbols_.clear();
+        tracer_.reset();
+        static_schema_ = StaticSchema { nullptr, 0, nullptr, 0 };
+        static_action_index_.clear();
+        static_actions_.reset();
+        invalidateHelp();
+        definitions_.clear();
     }
 
     void init() {
-        current_context_idx_ = GLOBAL_CONTEXT_IDX;
+        output_ = &default_output_;
+        result_cache_.setDirectory("");
+#ifndef _WIN32
+        watcher_ = nullptr;
+#endif
+        watch_debounce_ = std::chrono::milliseconds(WATCH_DEBOUNCE_MS_DEFAULT);
+        sealed_ = false;
+        static_schema_ = StaticSchema { nullptr, 0, nullptr, 0 };
+        static_global_flags_defined_ = false;
+        static_actions_left_ = 0;
+        application_name_ = "";
+        help_banner_ = "";
+        version_string_ = "";
+        description_margin_left_ = DESCRIPTION_MARGIN_LEFT_DEFAULT;
+        description_margin_right_ = DESCRIPTION_MARGIN_RIGHT_DEFAULT;
+
+        defineGlobalFlag<bool>("h help", "Show this message", false, nullptr);
+        defineGlobalFlag<int>("vlevel", "", 0, nullptr);
+        defineGlobalFlag<bool>("verbose", "Set verbose output", false,
+                               [this](bool) { setFlag<int>("vlevel", 1);
+                                              return true; });
+        defineGlobalFlag<std::string>("batch", "Execute the command lines read "
+                                      "from a file ('-' for stdin)", "", nullptr);
+        defineGlobalFlag<int>("j jobs", "Maximum number of actions run in "
+                              "parallel (0 for one per core)", 1, nullptr);
+        defineGlobalFlag<std::string>("trace", "Write a Chrome trace of the "
+                                      "parse and the actions to a file", "",
+                                      [this](std::string& path) {
+                                          if (!path.empty()) {
+                                              tracer_.start();
+                                          }
+                                          return true; });
+        defineGlobalFlag<int>("timeout", "Cancel the actions still running after "
+                              "this many milliseconds (0 for no limit)", 0,
+                              [](int& timeout) { return timeout >= 0; });
+        defineGlobalFlag<int>("action-timeout", "Cancel each action running for "
+                              "more than this many milliseconds (0 for no limit)", 0,
+                              [](int& timeout) { return timeout >= 0; });
+        defineGlobalFlag<bool>("watch", "Run the actions again when their input "
+                               "files change", false, nullptr);
+        for (auto name : { "batch", "jobs", "trace", "timeout", "action-timeout",
+                           "watch" }) {
+            execution_flags_.insert(global_flag_aliases_[name]);
+        }
+    }
+
+    // Write the trace requested with --trace, once the actions have run
+    void writeRequestedTrace() {
+        if (!tracer_.enabled() || currentSession().running_batch) {
+            return;
+        }
+        std::string path { getFlagValue<std::string>("trace") };
+        if (path.empty()) {
+            return;
+        }
+        tracer_.stop();
+        if (!writeTraceFile(path)) {
+            writeLine("Cannot write trace file: " + path);
+        }
+    }
 
-        ContextPtr global_context { new Context() };
+    // Drop the parsed contexts, keeping the definitions and the values of
+    // the global flags. The contexts are released with their arena, so that
+    // parsing many command lines (see runBatch) doesn't grow the memory.
+    void resetParse() {
+        SessionState& session = currentSession();
+        std::vector<FlagValue> global_values {
+            std::move(session.contexts[GLOBAL_CONTEXT_IDX]->values) };
+        session.contexts.clear();
+        session.context_arena.clear();
+        ContextPtr global_context { session.context_arena.make<Context>() };
         global_context->action = nullptr;
-        context_mgr_.push_back(std::move(global_context));
+        global_context->values = std::move(global_values);
+        session.contexts.push_back(global_context);
+        session.current_context_idx = GLOBAL_CONTEXT_IDX;
+        session.parsed = false;
+        session.response_files.clear();
+    }
+
+    // Parse, validate and execute a command line as a main function would
+    int executeCommandLine(int argc, char** argv) {
+        switch (parse(argc, argv)) {
+            case PARSE_OK:
+                break;
+            case PARSE_HELP:
+                help();
+                return 0;
+            case PARSE_VERSION:
+                version();
+                return 0;
+            case PARSE_INVALID_FLAG:
+                return 2;
+            default:
+                return 1;
+        }
+
+        if (!validateActionArguments()) {
+            return 1;
+        }
+
+        return whisper() ? 1 : 0;
+    }
+
+#ifndef _WIN32
+    // Execute the command line received on session_fd, in the forked
+    // session process. Return the exit status of the session process.
+    int serveDaemonSession(int session_fd) {
+        uint32_t payload_size;
+        int fds[DAEMON_FORWARDED_FDS];
+        if (!receiveDaemonHeader(session_fd, payload_size, fds)) {
+            return 1;
+        }
+        std::vector<char> payload(payload_size);
+        if (!receiveAll(session_fd, payload.data(), payload_size)
+                || payload.empty() || payload.back() != '\0') {
+            return 1;
+        }
+
+        std::vector<char*> strings {};
+        for (size_t i = 0; i < payload.size(); i += std::strlen(&payload[i]) + 1) {
+            strings.push_back(&payload[i]);
+        }
+        int argc { 0 };
+        if (strings.size() < 2 || !parseInteger(StringView { strings[1] }, argc)
+                || argc < 1 || strings.size() - 2 < static_cast<size_t>(argc)) {
+            return 1;
+        }
+
+        for (int fd = 0; fd < DAEMON_FORWARDED_FDS; fd++) {
+            if (fds[fd] != fd) {
+                dup2(fds[fd], fd);
+                close(fds[fd]);
+            }
+        }
+        for (size_t i = 2 + argc; i < strings.size(); i++) {
+            char* separator = std::strchr(strings[i], '=');
+            if (separator) {
+                *separator = '\0';
+                setenv(strings[i], separator + 1, 1);
+            } else {
+                unsetenv(strings[i]);
+            }
+        }
+
+        int32_t exit_code { 1 };
+        if (chdir(strings[0]) != 0) {
+            writeLine(formatMessage("Cannot change directory to ", strings[0], ": ",
+                                    std::strerror(errno)));
+        } else {
+            std::vector<char*> argv(strings.begin() + 2, strings.begin() + 2 + argc);
+            argv.push_back(nullptr);
+            try {
+                exit_code = executeCommandLine(argc, argv.data());
+            } catch (const std::exception& e) {
+                writeLine(formatMessage("Daemon session failed: ", e.what()));
+            }
+        }
+        output_->flush();
+        std::cout.flush();
+        std::cerr.flush();
+        fflush(nullptr);
 
-        parsed_ = false;
-        application_name_ = "";
-        help_banner_ = "";
-        version_string_ = "";
-        description_margin_left_ = DESCRIPTION_MARGIN_LEFT_DEFAULT;
-        description_margin_right_ = DESCRIPTION_MARGIN_RIGHT_DEFAULT;
+        return sendAll(session_fd, &exit_code, sizeof(exit_code)) ? 0 : 1;
+    }
+#endif
 
-        defineGlobalFlag<bool>("h help", "Show this message", false, nullptr);
-        defineGlobalFlag<int>("vlevel", "", 0, nullptr);
-        defineGlobalFlag<bool>("verbose", "Set verbose output", false,
-                               [this](bool) { setFlag<int>("vlevel", 1);
-                                              return true; });
+    static bool isFlag(StringView token) {
+        return !token.empty() && token[0] == '-';
     }
 
-    int parseFlag(char* argv[], int& i) {
+    int parseFlag(StringView token, TokenStream& tokens) {
+        TraceSpan span { tracer_, "token", "flag" };
+        span.addArgument("token", token);
+        size_t position { tokens.position() };
         // It's a flag. Get the array offset
-        int offset = 1;
-        if (argv[i][1] == '-') {
+        size_t offset = 1;
+        if (token.size() > 1 && token[1] == '-') {
             ++offset;
         }
-        std::string flagname { &argv[i][offset] };
-
         // check if flag looks like key=value
-        size_t k_v { flagname.find("=") };
+        size_t k_v { token.find('=', offset) };
+        std::string flagname {
+            token.substr(offset, k_v == StringView::npos ? StringView::npos
+                                                         : k_v - offset).str() };
 
-        if (k_v != std::string::npos) {
-            flagname = flagname.substr(0, k_v);
-            // += offset to take - or -- into account
+        if (k_v != StringView::npos) {
             // increment to get the first char after '='
-            ++k_v += offset;
+            ++k_v;
         }
 
         //  Deal with special vlevel flags
@@ -758,165 +5600,146 @@ class HorseWhisperer {
             return PARSE_VERSION;
         }
 
-        if (!isFlagDefined(flagname)) {
-            std::cout << "Unknown flag: " << flagname << std::endl;
+        FlagRef ref = findFlag(flagname);
+        if (!ref.flag) {
+            diagnose(DiagnosticCode::UnknownFlag, token, position,
+                     "Unknown flag: " + flagname);
             return PARSE_ERROR;
         }
 
         std::string value {};
 
-        FlagType flag_type = checkAndGetTypeOfFlag(flagname);
+        FlagType flag_type = getTypeOfFlag(ref.flag);
 
-        if (k_v != std::string::npos) {
-            value = &argv[i][k_v];
-        } else if (flag_type != FlagType::Bool && argv[++i]) {
+        StringView next_token {};
+        if (k_v != StringView::npos) {
+            value.assign(token.data() + k_v, token.size() - k_v);
+        } else if (flag_type != FlagType::Bool && tokens.next(next_token)) {
             // bool shouldn't try and take an argument from argv
-            value = argv[i];
+            value = next_token.str();
+        } else if (tokens.failed()) {
+            return PARSE_ERROR;
         }
 
-        return setAndValidateFlag(flag_type, flagname, value);
+        return setAndValidateFlag(ref, flag_type, flagname, value, token,
+                                  position);
     }
 
-    int setAndValidateFlag(FlagType flag_type, std::string flagname,
-                           std::string value) {
-        if (flag_type == FlagType::Bool) {
-            bool b_val { true };
-
-            if (!value.empty()) {
-                // passed as --true_thing=false|true
-                if (value == "false") {
-                    b_val = false;
-                } else if (value != "true") {
-                    std::cout << "Flag '" << flagname
-                              << "' expects a value of 'true' or 'false'"
-                              << std::endl;
-                    return PARSE_ERROR;
-                }
-            }
-            setFlag<bool>(flagname, b_val);
-            return PARSE_OK;
-        } else {
-            if (value.empty()) {
-                std::cout << "Missing value for flag: " << flagname << std::endl;
+    // Converts a command line value to the flag type and sets it
+    struct FlagValueSetter {
+        HorseWhisperer& hw;
+        const FlagRef& ref;
+        const std::string& flagname;
+        const std::string& value;
+        StringView token;
+        size_t position;
+
+        template <typename Type>
+        int visit() {
+            if (FlagTraits<Type>::takes_value && value.empty()) {
+                hw.diagnose(DiagnosticCode::MissingFlagValue, token, position,
+                            "Missing value for flag: " + flagname);
                 return PARSE_ERROR;
             }
 
-            if (flag_type == FlagType::String) {
-                setFlag<std::string>(flagname, std::string(value));
-                return PARSE_OK;
-            } else if (flag_type == FlagType::Int) {
-                if (validateInteger(value)) {
-                    setFlag<int>(flagname, std::stol(value, nullptr, 10));
-                    return PARSE_OK;
-                } else {
-                    std::cout << "Flag '" << flagname
-                                << "' expects a value of type integer" << std::endl;
-                    return PARSE_INVALID_FLAG;
-                }
-            } else if (flag_type == FlagType::Double) {
-                if (validateDouble(value)) {
-                    setFlag<double>(flagname, std::stod(value));
-                    return PARSE_OK;
-                } else {
-                    std::cout << "Flag '" << flagname
-                              << "' expects a value of type double" << std::endl;
-                    return PARSE_INVALID_FLAG;
-                }
+            Type converted {};
+            if (!FlagTraits<Type>::parse(value, converted)) {
+                hw.diagnose(DiagnosticCode::InvalidFlagValue, token, position,
+                            formatMessage("Flag '", flagname, "' expects ",
+                                          FlagTraits<Type>::expected()));
+                return FlagTraits<Type>::invalid_result;
             }
+
+            hw.writeFlag<Type>(ref, flagname, converted);
+            return PARSE_OK;
         }
+    };
 
-        std::cout << flagname << " is not of a valid flag type." << std::endl;
-        return PARSE_ERROR;
+    int setAndValidateFlag(const FlagRef& ref, FlagType flag_type,
+                           const std::string& flagname, const std::string& value,
+                           StringView token, size_t position) {
+        FlagValueSetter setter { *this, ref, flagname, value, token, position };
+        return visitFlagType(flag_type, setter);
     }
 
-    // Display help information for the global context
-    void globalHelp() {
-        std::cout << help_banner_ << std::endl;
-        std::cout << std::endl;
+    // Render the help of the global context
+    void globalHelp(std::ostream& out) {
+        out << help_banner_ << "\n";
+        out << "\n";
 
-        std::cout << "Global options:";
+        out << "Global options:";
 
         for (const auto& flag : registered_flags_["global"]) {
-            writeFlagHelp(flag);
+            writeFlagHelp(out, flag);
         }
 
-        std::cout << "\n\nActions:\n";
+        out << "\n\nActions:\n";
         for (const auto& action : actions_) {
-            writeActionDescription(action.second);
+            writeActionDescription(out, action.second);
         }
 
-        std::cout << "\nFor action specific help run \"" << application_name_
-                  << " <action> --help\"" << std::endl;
+        out << "\nFor action specific help run \"" << application_name_
+            << " <action> --help\"" << "\n";
     }
 
-    // Display help information for the current action context
-    void actionHelp() {
-        if (context_mgr_[current_context_idx_]->action->help_string_.empty()) {
-            std::cout << "No specific help found for action :"
-                      << context_mgr_[current_context_idx_]->action->name
-                      << "\n\n";
+    // Render the help of an action
+    void actionHelp(std::ostream& out, const Action* action) {
+        if (action->help_string_.empty()) {
+            out << "No specific help found for action :" << action->name
+                << "\n\n";
             return;
         }
 
-        std::cout << context_mgr_[current_context_idx_]->action->help_string_;
+        out << action->help_string_;
 
-        if (registered_flags_.find(context_mgr_[current_context_idx_]->action->name)
-                != registered_flags_.end()) {
-            std::cout << "\n  " << context_mgr_[current_context_idx_]->action->name
-                      << " specific flags:\n";
-            for (const auto& f : registered_flags_[
-                                    context_mgr_[current_context_idx_]->action->name]) {
-                writeFlagHelp(f);
+        auto flags = registered_flags_.find(action->name);
+        if (flags != registered_flags_.end()) {
+            out << "\n  " << action->name << " specific flags:\n";
+            for (const auto& f : flags->second) {
+                writeFlagHelp(out, f);
             }
         }
-        std::cout << std::endl << std::endl;
+        out << "\n\n";
     }
 
-    // Output the help information related to a single flag
-    void writeFlagHelp(const FlagBase* flag) {
-        std::stringstream aliases_stream { flag->aliases };
-        std::stringstream output {};
-        std::string alias {};
-        std::string arg {};
-        size_t last_alias_size { 0 };
-
-        switch (getTypeOfFlag(flag)) {
-            case FlagType::Bool:
-                // No argument
-                break;
-            case FlagType::String:
-                arg = " <str>";
-                break;
-            case FlagType::Int:
-                arg = " <int>";
-                break;
-            case FlagType::Double:
-                arg = " <float>";
-        }
-
-        while (aliases_stream >> alias) {
-            if (alias != "") {
-                output << "\n";
-                output << std::setw(description_margin_left_) << std::left;
-                last_alias_size = alias.size() + arg.size();
-
-                if (last_alias_size == 1) {
-                    output << "   -" + alias + arg;
-                } else if (last_alias_size > 1) {
-                    output << "  --" + alias + arg;
-                }
+    // Render the help information related to a single flag
+    void writeFlagHelp(std::ostream& out, const FlagBase* flag) {
+        FlagPlaceholderVisitor placeholder {};
+        std::string arg { visitFlagType(getTypeOfFlag(flag), placeholder) };
+
+        // Aliases are separated by blanks, and listed on one line with the
+        // placeholder of the value after the last one: "-j, --jobs <int>"
+        static const char* blanks = " \t\n\v\f\r";
+        const std::string& aliases = flag->aliases;
+        std::string names {};
+        size_t begin { aliases.find_first_not_of(blanks) };
+        while (begin != std::string::npos) {
+            size_t end { std::min(aliases.find_first_of(blanks, begin), aliases.size()) };
+            std::string alias { aliases, begin, end - begin };
+            begin = aliases.find_first_not_of(blanks, end);
+
+            if (names.empty()) {
+                names = alias.size() == 1 ? "   -" : "  --";
+            } else {
+                names += alias.size() == 1 ? ", -" : ", --";
             }
+            names += alias;
+        }
+        if (!names.empty()) {
+            names += arg;
+            out << "\n";
+            out << std::setw(description_margin_left_) << std::left << names;
         }
 
-        auto newLine = [&output](unsigned int margin) {
-            output << "\n" << std::setw(margin) << std::left;
+        auto newLine = [&out](unsigned int margin) {
+            out << "\n" << std::setw(margin) << std::left;
             // Same length as above to fill the field in the same way
-            output << "    ";
+            out << "    ";
         };
 
-        // New line condition: (2 or 3 spaces + dash prefix + alias
-        // size + 2 spaces to separate from description) > margin
-        if (last_alias_size + 6 > description_margin_left_) {
+        // New line condition: aliases + 2 spaces to separate from the
+        // description > margin
+        if (names.size() + 2 > description_margin_left_) {
             newLine(description_margin_left_);
         }
 
@@ -925,65 +5748,144 @@ class HorseWhisperer {
             if (!first_line) {
                 newLine(description_margin_left_);
             }
-            output << line;
+            out << line;
             first_line = false;
         }
-
-        std::cout << output.str();
     }
 
-    // Output the action description related to a specific action
-    void writeActionDescription(const Action* action) {
-        std::stringstream action_stream;
-        action_stream << "  " << action->name;
-
-        std::cout << std::setw(description_margin_left_) << std::left
-                  << action_stream.str();
+    // Render the action description related to a specific action
+    void writeActionDescription(std::ostream& out, const Action* action) {
+        out << std::setw(description_margin_left_) << std::left
+            << "  " + action->name;
 
         // New line condition: (2 spaces + action name + 2 spaces to
         // separate from description) > margin
         if (action->name.size() + 4 > description_margin_left_) {
-            std::cout << "\n";
-            std::cout << std::setw(description_margin_left_) << std::left
-                      << "    ";
+            out << "\n";
+            out << std::setw(description_margin_left_) << std::left
+                << "    ";
         }
 
-        std::cout << std::setw(description_margin_left_) << std::left;
+        out << std::setw(description_margin_left_) << std::left;
 
         bool first_line { true };
         for (auto& line : wordWrap(action->description, getDescriptionWidth())) {
             if (!first_line) {
-                std::cout << std::setw(description_margin_left_) << std::left
-                          << "    "
-                          << std::setw(description_margin_left_) << std::left;
+                out << std::setw(description_margin_left_) << std::left
+                    << "    "
+                    << std::setw(description_margin_left_) << std::left;
             }
-            std::cout << line << "\n";
+            out << line << "\n";
             first_line = false;
         }
     }
 
-    bool isFlagDefined(std::string name) {
-        if (getContextIdxIfDefined(name) != NO_CONTEXT_IDX) {
-            return true;
-        } else {
-            return false;
+    // Return the flag named so in the current context, falling back to the
+    // global context; the returned flag is nullptr if the flag is undefined
+    FlagRef findFlag(const std::string& name) {
+        SessionState& session = currentSession();
+        return findFlag(name, session, currentContext(session));
+    }
+
+    // As above, in the given context of session
+    FlagRef findFlag(const std::string& name, SessionState& session,
+                     Context* context) {
+        Context* global_context = session.contexts[GLOBAL_CONTEXT_IDX];
+
+        if (sealed_) {
+            int id { names_.find(name.data(), name.size()) };
+            if (id == NAME_NOT_FOUND) {
+                return FlagRef { nullptr, nullptr };
+            }
+            const Symbol& symbol = symbols_[id];
+            if (context->action) {
+                for (auto& action_flag : symbol.action_flags) {
+                    if (action_flag.first == context->action) {
+                        return FlagRef { action_flag.second, context };
+                    }
+                }
+            }
+            return FlagRef { symbol.global_flag, global_context };
+        }
+
+        materializeStaticGlobalFlags();
+        if (context->action) {
+            auto it = context->action->flags.find(name);
+            if (it != context->action->flags.end()) {
+                return FlagRef { it->second, context };
+            }
+        }
+
+        auto it = global_flag_aliases_.find(name);
+        if (it != global_flag_aliases_.end()) {
+            return FlagRef { it->second, global_context };
         }
+
+        return FlagRef { nullptr, nullptr };
     }
 
-    int getContextIdxIfDefined(std::string name) {
-        if (context_mgr_[current_context_idx_]->flags.find(name)
-                != context_mgr_[current_context_idx_]->flags.end()) {
-            return current_context_idx_;
-        } else if (context_mgr_[GLOBAL_CONTEXT_IDX]->flags.find(name)
-                != context_mgr_[GLOBAL_CONTEXT_IDX]->flags.end()) {
-            return GLOBAL_CONTEXT_IDX;
-        } else {
-            return NO_CONTEXT_IDX;
+    // Return the action named so; nullptr if the action is undefined
+    Action* findAction(StringView name) {
+        if (sealed_) {
+            int id { names_.find(name.data(), name.size()) };
+            return id == NAME_NOT_FOUND ? nullptr : symbols_[id].action;
+        }
+
+        return definedAction(name);
+    }
+
+    // Context of the action run by the calling thread, for actions run in
+    // parallel; nullptr in the other threads
+    static Context*& workerContext() {
+        static thread_local Context* context { nullptr };
+        return context;
+    }
+
+    Context* currentContext(SessionState& session) {
+        Context* context { workerContext() };
+        return context ? context : session.contexts[session.current_context_idx];
+    }
+
+    // State of the session running on the calling thread, if any
+    static SessionState*& activeSession() {
+        static thread_local SessionState* session { nullptr };
+        return session;
+    }
+
+    // State of the session running on the calling thread, if it belongs
+    // to this HorseWhisperer, otherwise of the command lines parsed without
+    // a Session
+    SessionState& currentSession() {
+        SessionState* active { activeSession() };
+        return active && active->owner == this ? *active : session_;
+    }
+
+    // Whether the contexts the context at idx depends on have succeeded
+    bool dependenciesSucceeded(size_t idx, const std::vector<ContextState>& states) {
+        SessionState& session = currentSession();
+        const Action* action = session.contexts[idx]->action;
+        for (size_t i = GLOBAL_CONTEXT_IDX + 1; i < idx; i++) {
+            bool depends { !action->has_dependencies || !action->chainable
+                           || std::find(action->dependencies.begin(),
+                                        action->dependencies.end(),
+                                        session.contexts[i]->action->name)
+                              != action->dependencies.end() };
+            if (depends && states[i] != SUCCEEDED) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void checkNotSealed() {
+        if (sealed_) {
+            throw sealed_error { "definitions are sealed" };
         }
     }
 
-    bool isActionDefined(std::string name) {
-        return !(actions_.find(name) == actions_.end());
+    void invalidateHelp() {
+        std::lock_guard<std::mutex> lock { help_mutex_ };
+        help_cache_.clear();
     }
 
     unsigned int getDescriptionWidth() {
@@ -991,32 +5893,212 @@ class HorseWhisperer {
     }
 };
 
+//
+// FlagHandle
+//
+
+template <typename Type>
+Type FlagHandle<Type>::get() const {
+    return owner_->readFlag<Type>(owner_->getHandleFlag<Type>(action_, flag_));
+}
+
+template <typename Type>
+Type FlagHandle<Type>::get(const ActionContext& context) const {
+    return owner_->readFlag<Type>(owner_->getHandleFlag<Type>(
+        action_, flag_, *context.session_, context.context_));
+}
+
+template <typename Type>
+void FlagHandle<Type>::set(Type value) const {
+    owner_->writeFlag<Type>(owner_->getHandleFlag<Type>(action_, flag_),
+                            flag_->aliases, value);
+}
+
+//
+// ActionContext
+//
+
+inline const std::string& ActionContext::actionName() const {
+    return context_->action->name;
+}
+
+inline bool ActionContext::read(std::string& record) const {
+    return context_->input && !cancelled() && context_->input->read(record);
+}
+
+inline bool ActionContext::write(std::string record) const {
+    if (cancelled()) {
+        return false;
+    }
+    if (context_->output) {
+        return context_->output->write(record);
+    }
+    record.push_back('\n');
+    if (context_->captured_output) {
+        context_->captured_output->append(record);
+    }
+    session_->owner->output().write(record);
+    return true;
+}
+
+inline CancellationToken ActionContext::cancellation() const {
+    return CancellationToken { context_->cancellation };
+}
+
+inline bool ActionContext::cancelled() const {
+    return context_->cancellation && context_->cancellation->cancelled();
+}
+
+template <typename Type>
+Type ActionContext::getFlag(const std::string& flag_name) const {
+    HorseWhisperer* owner = session_->owner;
+    FlagRef ref = owner->findFlag(flag_name, *session_, context_);
+    if (!ref.flag) {
+        throw undefined_flag_error { "undefined flag: " + flag_name };
+    }
+    return owner->readFlag<Type>(ref);
+}
+
+//
+// Session
+//
+
+// Parse and execution state of command lines, for a HorseWhisperer then
+// only holding the definitions. The sessions of a HorseWhisperer may parse
+// and run command lines on different threads at the same time, as long as
+// the definitions don't change meanwhile (see Seal); each session is used
+// by one thread at a time. Within the actions of a session, the free
+// functions (GetFlag, SetFlag, ...) and flag handles refer to the session.
+// Sessions must not outlive the definitions, up to the next Reset().
+class Session {
+  public:
+    // Session of the HorseWhisperer singleton
+    Session() : Session { HorseWhisperer::Instance() } {}
+
+    explicit Session(HorseWhisperer& parser) : state_ { &parser } {}
+
+    // As Parse()
+    int parse(int argc, char** argv) {
+        Activation activation { state_ };
+        return state_.owner->parse(argc, argv);
+    }
+
+    // As ValidateActionArguments()
+    bool validateActionArguments() {
+        Activation activation { state_ };
+        return state_.owner->validateActionArguments();
+    }
+
+    // As Start()
+    int start() {
+        Activation activation { state_ };
+        return state_.owner->whisper();
+    }
+
+    // As StartAsync()
+    int startAsync(std::function<void()> on_progress = nullptr) {
+        Activation activation { state_ };
+        return state_.owner->startAsync(on_progress);
+    }
+
+    // As Step()
+    int step() {
+        Activation activation { state_ };
+        return state_.owner->step();
+    }
+
+    // Drop the parsed command line and the values of the flags, then parse,
+    // validate and execute the command line as a main function would.
+    // Return its exit code.
+    int execute(int argc, char** argv) {
+        reset();
+        Activation activation { state_ };
+        return state_.owner->executeCommandLine(argc, argv);
+    }
+
+    // As GetFlag()
+    template <typename Type>
+    Type getFlag(std::string flag_name) {
+        Activation activation { state_ };
+        return state_.owner->getFlagValue<Type>(flag_name);
+    }
+
+    // As SetFlag()
+    template <typename Type>
+    void setFlag(std::string flag_name, Type value) {
+        Activation activation { state_ };
+        state_.owner->setFlag<Type>(flag_name, value);
+    }
+
+    // As GetParsedActions()
+    std::vector<std::string> getParsedActions() {
+        Activation activation { state_ };
+        return state_.owner->getParsedActions();
+    }
+
+    // As ShowHelp()
+    void showHelp() {
+        Activation activation { state_ };
+        state_.owner->help();
+    }
+
+    // Errors reported by the last parse and execution of the session
+    const std::vector<Diagnostic>& getDiagnostics() const {
+        return state_.diagnostics;
+    }
+
+    // Drop the parsed command line and the values of the flags
+    void reset() {
+        state_.reset();
+    }
+
+  private:
+    // Make the session the one running on the calling thread, until
+    // destroyed
+    class Activation {
+      public:
+        explicit Activation(SessionState& state)
+                : previous_ { HorseWhisperer::activeSession() } {
+            HorseWhisperer::activeSession() = &state;
+        }
+
+        ~Activation() {
+            HorseWhisperer::activeSession() = previous_;
+        }
+
+      private:
+        SessionState* previous_;
+    };
+
+    SessionState state_;
+};
+
 //
 // API
 //
 
 template <typename Type>
-static void DefineGlobalFlag(std::string aliases,
-                                std::string description,
-                                Type default_value,
-                                FlagCallback<Type> flag_callback) {
-    HorseWhisperer::Instance().defineGlobalFlag<Type>(aliases,
-                                                      description,
-                                                      default_value,
-                                                      flag_callback);
+static FlagHandle<Type> DefineGlobalFlag(std::string aliases,
+                                         std::string description,
+                                         Type default_value,
+                                         FlagCallback<Type> flag_callback) {
+    return HorseWhisperer::Instance().defineGlobalFlag<Type>(aliases,
+                                                             description,
+                                                             default_value,
+                                                             flag_callback);
 }
 
 template <typename Type>
-static void DefineActionFlag(std::string action_name,
-                                std::string aliases,
-                                std::string description,
-                                Type default_value,
-                                FlagCallback<Type> flag_callback) {
-    HorseWhisperer::Instance().defineActionFlag<Type>(action_name,
-                                                      aliases,
-                                                      description,
-                                                      default_value,
-                                                      flag_callback);
+static FlagHandle<Type> DefineActionFlag(std::string action_name,
+                                         std::string aliases,
+                                         std::string description,
+                                         Type default_value,
+                                         FlagCallback<Type> flag_callback) {
+    return HorseWhisperer::Instance().defineActionFlag<Type>(action_name,
+                                                             aliases,
+                                                             description,
+                                                             default_value,
+                                                             flag_callback);
 }
 
 template <typename Type>
@@ -1049,10 +6131,138 @@ static void DefineAction(std::string action_name,
                                             arguments_callback);
 }
 
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionViewCallback action_callback,
+                         ArgumentsViewCallback arguments_callback = nullptr) {
+    HorseWhisperer::Instance().defineAction(action_name,
+                                            arity,
+                                            chainable,
+                                            description,
+                                            help_string,
+                                            action_callback,
+                                            arguments_callback);
+}
+
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionStreamCallback action_callback) {
+    HorseWhisperer::Instance().defineAction(action_name,
+                                            arity,
+                                            chainable,
+                                            description,
+                                            help_string,
+                                            action_callback);
+}
+
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         ActionContextCallback action_callback,
+                         ArgumentsViewCallback arguments_callback = nullptr) {
+    HorseWhisperer::Instance().defineAction(action_name,
+                                            arity,
+                                            chainable,
+                                            description,
+                                            help_string,
+                                            action_callback,
+                                            arguments_callback);
+}
+
+// The action calls done with its exit code once complete. Start waits for
+// it, while Step leaves it running.
+static void DefineAction(std::string action_name,
+                         int arity,
+                         bool chainable,
+                         std::string description,
+                         std::string help_string,
+                         AsyncActionCallback action_callback,
+                         ArgumentsViewCallback arguments_callback = nullptr) {
+    HorseWhisperer::Instance().defineAction(action_name,
+                                            arity,
+                                            chainable,
+                                            description,
+                                            help_string,
+                                            action_callback,
+                                            arguments_callback);
+}
+
+static void SetActionDependencies(std::string action_name,
+                                  std::vector<std::string> dependencies) {
+    HorseWhisperer::Instance().setActionDependencies(action_name, dependencies);
+}
+
+// Cancel the action once it has run for milliseconds, overriding the
+// --action-timeout flag; 0 restores the flag value. Actions see the
+// cancellation through ActionContext::cancellation(); asynchronous actions
+// are not waited for once cancelled.
+static void SetActionTimeout(std::string action_name, unsigned int milliseconds) {
+    HorseWhisperer::Instance().setActionTimeout(
+        action_name, std::chrono::milliseconds(milliseconds));
+}
+
+// Replay the exit code and the output of the action, as stored in the
+// cache directory (see SetCacheDirectory), when it runs again with the same
+// arguments, flag values, global flag values and input contents; the
+// built-in flags controlling the execution (--jobs, --trace, --timeout...)
+// are not part of the key. Only the output written through
+// ActionContext::write is replayed, so the action must take an
+// ActionContext; throws horsewhisperer_error otherwise. Streaming,
+// asynchronous and piped actions always run.
+static void SetActionCacheable(std::string action_name, bool cacheable) {
+    HorseWhisperer::Instance().setActionCacheable(action_name, cacheable);
+}
+
+// Declare the files the action reads, to be part of its cache key.
+static void SetActionInputs(std::string action_name, ActionInputsCallback inputs) {
+    HorseWhisperer::Instance().setActionInputs(action_name, inputs);
+}
+
+// Store the results of the cacheable actions in directory, created if
+// needed; an empty directory, the default, disables the cache.
+static void SetCacheDirectory(std::string directory) {
+    HorseWhisperer::Instance().setCacheDirectory(directory);
+}
+
+// Make Start return once the actions run with --watch complete; callable
+// from any thread, including from an action.
+static void StopWatching() {
+    HorseWhisperer::Instance().stopWatching();
+}
+
+// Wait for the inputs to stay unchanged for milliseconds before running the
+// actions again with --watch (100 by default).
+static void SetWatchDebounce(unsigned int milliseconds) {
+    HorseWhisperer::Instance().setWatchDebounce(std::chrono::milliseconds(milliseconds));
+}
+
+#ifndef _WIN32
+// On SIGINT or SIGTERM, cancel the running actions and skip the remaining
+// ones instead of terminating; a second signal terminates the process.
+// false restores the previous signal handlers.
+static void SetCancelOnSignals(bool enable) {
+    Watchdog::handleSignals(enable);
+}
+#endif
+
 static bool IsActionFlag(std::string action, std::string flagname) {
     return HorseWhisperer::Instance().isActionFlag(action, flagname);
 }
 
+// The schema is not copied and must outlive its use, e.g. a constexpr
+// object built with MakeStaticSchema.
+static void DefineStaticSchema(const StaticSchema& schema) {
+    HorseWhisperer::Instance().defineStaticSchema(schema);
+}
+
 static void SetAppName(std::string name) {
     HorseWhisperer::Instance().setAppName(name);
 }
@@ -1069,11 +6279,22 @@ static void SetDelimiters(std::vector<std::string> delimiters) {
     HorseWhisperer::Instance().setDelimiters(delimiters);
 }
 
+// Actions separated by a pipe delimiter run together, each one reading the
+// records written by the previous one; see ActionContext::read and write.
+static void SetPipeDelimiters(std::vector<std::string> delimiters) {
+    HorseWhisperer::Instance().setPipeDelimiters(delimiters);
+}
+
 // Return 1 if parse didn't succeed.
 static int Parse(int argc, char** argv) {
     return HorseWhisperer::Instance().parse(argc, argv);
 }
 
+// Throws sealed_error when defining flags or actions after sealing.
+static void Seal() {
+    HorseWhisperer::Instance().seal();
+}
+
 // Return false if parse didn't succeed.
 static bool ValidateActionArguments() {
     return HorseWhisperer::Instance().validateActionArguments();
@@ -1095,6 +6316,48 @@ static int Start() {
     return HorseWhisperer::Instance().whisper();
 }
 
+// Start the parsed actions without waiting for them to complete; then call
+// Step until it returns 0 or 1, its exit code. on_progress is called by the
+// threads completing asynchronous actions, so should only wake the event
+// loop up. Return 1 if parse didn't succeed.
+static int StartAsync(std::function<void()> on_progress = nullptr) {
+    return HorseWhisperer::Instance().startAsync(on_progress);
+}
+
+// Run the actions started by StartAsync that can run without waiting.
+// Return STEP_RUNNING while asynchronous actions are running.
+static int Step() {
+    return HorseWhisperer::Instance().step();
+}
+
+// Execute the command lines read from input; see HorseWhisperer::runBatch.
+static BatchResult RunBatch(std::istream& input) {
+    return HorseWhisperer::Instance().runBatch(input);
+}
+
+// Return 1 if any command line of the batch failed.
+static int StartBatch(std::string path) {
+    return HorseWhisperer::Instance().startBatch(path);
+}
+
+#ifndef _WIN32
+// Serve the command lines of ForwardToDaemon; see HorseWhisperer::startDaemon.
+static int StartDaemon(std::string socket_path) {
+    return HorseWhisperer::Instance().startDaemon(socket_path);
+}
+
+// Execute the command line in the daemon listening on socket_path, with
+// the current working directory, the named environment variables and the
+// standard streams of the caller. Return DAEMON_UNAVAILABLE if no daemon
+// is listening, otherwise the exit code of the command line.
+static int ForwardToDaemon(std::string socket_path,
+                           int argc,
+                           char** argv,
+                           std::vector<std::string> environment = {}) {
+    return forwardToDaemon(socket_path, argc, argv, environment);
+}
+#endif
+
 static void Reset() {
     HorseWhisperer::Instance().reset();
 }
@@ -1103,6 +6366,46 @@ static void SetHelpMargins(unsigned int left_margin, unsigned int right_margin)
     HorseWhisperer::Instance().setHelpMargins(left_margin, right_margin);
 }
 
+// Record spans of the parse, of each token, of the flag and arguments
+// callbacks and of each action, until StopTracing; StartTracing drops the
+// spans recorded before. The --trace global flag starts tracing when parsed
+// and writes the trace to its file once Start returns.
+static void StartTracing() {
+    HorseWhisperer::Instance().startTracing();
+}
+
+static void StopTracing() {
+    HorseWhisperer::Instance().stopTracing();
+}
+
+// Write the recorded spans in the Chrome trace event JSON format.
+static void WriteTrace(std::ostream& output) {
+    HorseWhisperer::Instance().writeTrace(output);
+}
+
+// Return false if the file cannot be written.
+static bool WriteTraceFile(std::string path) {
+    return HorseWhisperer::Instance().writeTraceFile(path);
+}
+
+// Write the messages, the help and the records of the actions to sink
+// instead of std::cout; nullptr restores std::cout. The sink must outlive
+// its use and is flushed when replaced.
+static void SetOutputSink(OutputSink* sink) {
+    HorseWhisperer::Instance().setOutputSink(sink);
+}
+
+// Write what the output sink buffered. Nothing is flushed implicitly,
+// except before forking daemon sessions and when they end.
+static void Flush() {
+    HorseWhisperer::Instance().flush();
+}
+
+// Return the errors reported by the last Parse and Start, in order.
+static std::vector<Diagnostic> GetDiagnostics() {
+    return HorseWhisperer::Instance().getDiagnostics();
+}
+
 }  // namespace HorseWhisperer
 
 #endif  // HORSEWHISPERER_INCLUDE_HORSE_WHISPERER_H_
@@ -0,0 +1,144 @@
+/*
+    async_benchmark.cpp
+    ===================
+
+    Measures an event loop ticking every millisecond while it runs a chain
+    of independent asynchronous fetch actions, completed by timer threads
+    after a delay: with a blocking Start, and driven by StartAsync/Step.
+    Reports the wall time of the chain and the longest loop stall.
+
+    Run with:
+        ./horsewhisperer-async-benchmark [fetches] [fetch delay ms]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+// Timer threads completing the fetches
+static std::mutex timers_mutex {};
+static std::vector<std::thread> timers {};
+
+static void defineSchema(int delay_ms) {
+    HW::Reset();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineAction("fetch", 1, true, "", "",
+                     [delay_ms](HW::ActionContext, HW::ActionCompletion done) {
+                        std::lock_guard<std::mutex> lock { timers_mutex };
+                        timers.emplace_back([delay_ms, done]() {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(delay_ms));
+                            done(0);
+                        });
+                     });
+    HW::SetActionDependencies("fetch", {});
+}
+
+static void joinTimers() {
+    std::lock_guard<std::mutex> lock { timers_mutex };
+    for (auto& timer : timers) {
+        timer.join();
+    }
+    timers.clear();
+}
+
+struct LoopResult {
+    double total_ms;
+    double longest_stall_ms;
+};
+
+// Run the event loop until the chain of fetches completes; iterate is
+// called on each loop iteration and returns whether the chain still runs
+template <typename Iterate>
+static LoopResult runLoop(int fetches, int delay_ms, Iterate iterate) {
+    defineSchema(delay_ms);
+    std::vector<std::string> tokens { "benchmark" };
+    for (int i = 0; i < fetches; i++) {
+        tokens.push_back("fetch");
+        tokens.push_back("https://example.com/" + std::to_string(i));
+        tokens.push_back("+");
+    }
+    tokens.pop_back();
+    std::vector<char*> argv {};
+    for (auto& token : tokens) {
+        argv.push_back(&token[0]);
+    }
+    if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK) {
+        std::cout << "parse failed\n";
+        std::exit(1);
+    }
+
+    LoopResult result { 0, 0 };
+    auto begin = Clock::now();
+    auto last_tick = begin;
+    bool running { true };
+    while (running) {
+        running = iterate();
+        auto now = Clock::now();
+        result.longest_stall_ms = std::max(
+            result.longest_stall_ms,
+            std::chrono::duration<double, std::milli>(now - last_tick).count());
+        last_tick = now;
+    }
+    result.total_ms = std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+    joinTimers();
+    return result;
+}
+
+int main(int argc, char* argv[]) {
+    int fetches { argc > 1 ? std::atoi(argv[1]) : 50 };
+    int delay_ms { argc > 2 ? std::atoi(argv[2]) : 5 };
+
+    // The loop waits up to 1 ms for an event
+    std::mutex mutex {};
+    std::condition_variable progress {};
+    bool progressed { false };
+    auto wait = [&]() {
+        std::unique_lock<std::mutex> lock { mutex };
+        progress.wait_for(lock, std::chrono::milliseconds(1), [&]() { return progressed; });
+        progressed = false;
+    };
+
+    LoopResult blocking { runLoop(fetches, delay_ms, [&]() {
+        if (HW::Start() != 0) {
+            std::exit(1);
+        }
+        return false;
+    }) };
+
+    bool started { false };
+    LoopResult stepped { runLoop(fetches, delay_ms, [&]() {
+        if (!started) {
+            started = true;
+            HW::StartAsync([&]() {
+                std::lock_guard<std::mutex> lock { mutex };
+                progressed = true;
+                progress.notify_one();
+            });
+        }
+        int result { HW::Step() };
+        if (result == HW::STEP_RUNNING) {
+            wait();
+            return true;
+        }
+        if (result != 0) {
+            std::exit(1);
+        }
+        return false;
+    }) };
+
+    std::cout << fetches << " fetches of " << delay_ms << " ms\n";
+    std::cout << "blocking Start:  " << blocking.total_ms << " ms, longest stall "
+              << blocking.longest_stall_ms << " ms\n";
+    std::cout << "StartAsync/Step: " << stepped.total_ms << " ms, longest stall "
+              << stepped.longest_stall_ms << " ms\n";
+    return 0;
+}
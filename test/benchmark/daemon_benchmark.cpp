@@ -0,0 +1,100 @@
+/*
+    daemon_benchmark.cpp
+    ====================
+
+    Compares the latency of a command executed by a fresh process, which
+    pays for the initialisation of the actions, with a round trip to a
+    daemon started once (StartDaemon / ForwardToDaemon).
+
+    Run with:
+        ./horsewhisperer-daemon-benchmark [commands] [initialisation ms]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace HW = HorseWhisperer;
+
+static const char* SELF = "/proc/self/exe";
+
+// Define the actions, after an initialisation lasting init_ms
+static void defineSchema(int init_ms) {
+    usleep(init_ms * 1000);
+    HW::DefineGlobalFlag<int>("ponies", "all the ponies", 1, nullptr);
+    HW::DefineAction("gallop", 0, true, "make the ponies gallop", "",
+                     [](const HW::Arguments&) -> int {
+                        return HW::GetFlag<int>("ponies") != 4; });
+}
+
+static double millisecondsPerCommand(int commands, std::function<int()> command) {
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < commands; i++) {
+        if (command() != 0) {
+            std::cout << "command failed\n";
+            std::exit(1);
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count()
+           / commands;
+}
+
+int main(int argc, char* argv[]) {
+    // Child modes: "--serve <socket> <ms>" and "--exec <ms> <command line>"
+    if (argc > 3 && std::string(argv[1]) == "--serve") {
+        defineSchema(std::atoi(argv[3]));
+        return HW::StartDaemon(argv[2]);
+    } else if (argc > 2 && std::string(argv[1]) == "--exec") {
+        defineSchema(std::atoi(argv[2]));
+        argv[2] = argv[0];
+        if (HW::Parse(argc - 2, argv + 2) != HW::PARSE_OK
+                || !HW::ValidateActionArguments()) {
+            return 1;
+        }
+        return HW::Start();
+    }
+
+    int commands { argc > 1 ? std::atoi(argv[1]) : 200 };
+    std::string init_ms { argc > 2 ? argv[2] : "20" };
+    std::string socket_path { "/tmp/horsewhisperer_daemon_benchmark_"
+                              + std::to_string(getpid()) + ".sock" };
+
+    pid_t daemon_pid = fork();
+    if (daemon_pid == 0) {
+        execl(SELF, "benchmark", "--serve", socket_path.c_str(), init_ms.c_str(),
+              static_cast<char*>(nullptr));
+        _exit(1);
+    }
+
+    const char* cli[] = { "benchmark", "gallop", "--ponies", "4" };
+    auto forward = [&]() {
+        return HW::ForwardToDaemon(socket_path, 4, const_cast<char**>(cli));
+    };
+    while (forward() == HW::DAEMON_UNAVAILABLE) {
+        usleep(1000);
+    }
+
+    std::cout << commands << " commands, " << init_ms
+              << " ms of initialisation\n";
+    std::cout << "fresh exec:     "
+              << millisecondsPerCommand(commands, [&]() {
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        execl(SELF, "benchmark", "--exec", init_ms.c_str(),
+                              "gallop", "--ponies", "4", static_cast<char*>(nullptr));
+                        _exit(1);
+                    }
+                    int status { 1 };
+                    waitpid(pid, &status, 0);
+                    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+                 }) << " ms/command\n";
+    std::cout << "daemon session: "
+              << millisecondsPerCommand(commands, forward) << " ms/command\n";
+
+    kill(daemon_pid, SIGTERM);
+    waitpid(daemon_pid, nullptr, 0);
+    unlink(socket_path.c_str());
+    return 0;
+}
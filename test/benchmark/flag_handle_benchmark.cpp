@@ -0,0 +1,86 @@
+/*
+    flag_handle_benchmark.cpp
+    =========================
+
+    Compares flag reads through a FlagHandle with string keyed GetFlag
+    calls, from inside an action callback (as in examples/example1.cpp),
+    and with reads through the ActionContext of the action.
+
+    Run with:
+        ./horsewhisperer-flag-handle-benchmark [iterations]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace HW = HorseWhisperer;
+
+template <typename Function>
+static double nanosecondsPerOp(long iterations, Function f) {
+    auto start = std::chrono::steady_clock::now();
+    f(iterations);
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count()
+           / iterations;
+}
+
+int main(int argc, char* argv[]) {
+    long iterations { argc > 1 ? std::atol(argv[1]) : 10000000L };
+    volatile long sink { 0 };
+
+    auto ponies = HW::DefineGlobalFlag<int>("ponies", "all the ponies", 1,
+                                            nullptr);
+    HW::FlagHandle<bool> tired {};
+
+    HW::DefineAction("gallop", 0, true, "make the ponies gallop", "", [&](
+            const HW::ActionContext& context) -> int {
+        std::cout << "global flag, GetFlag:     "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += HW::GetFlag<int>("ponies");
+                        }
+                     }) << " ns/op\n";
+        std::cout << "global flag, FlagHandle:  "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += ponies.get();
+                        }
+                     }) << " ns/op\n";
+        std::cout << "action flag, GetFlag:     "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += HW::GetFlag<bool>("tired");
+                        }
+                     }) << " ns/op\n";
+        std::cout << "action flag, FlagHandle:  "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += tired.get();
+                        }
+                     }) << " ns/op\n";
+        std::cout << "action flag, context:     "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += context.getFlag<bool>("tired");
+                        }
+                     }) << " ns/op\n";
+        std::cout << "action flag, handle(ctx): "
+                  << nanosecondsPerOp(iterations, [&](long n) {
+                        for (long i = 0; i < n; i++) {
+                            sink += tired.get(context);
+                        }
+                     }) << " ns/op\n";
+        return 0;
+    });
+    tired = HW::DefineActionFlag<bool>("gallop", "tired",
+                                       "are the horses tired?", false, nullptr);
+
+    const char* cli[] = { "benchmark", "gallop", "--ponies", "4" };
+    if (HW::Parse(4, const_cast<char**>(cli)) != HW::PARSE_OK) {
+        return 1;
+    }
+
+    return HW::Start();
+}
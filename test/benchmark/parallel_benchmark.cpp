@@ -0,0 +1,69 @@
+/*
+    parallel_benchmark.cpp
+    ======================
+
+    Measures the wall time of a wide chain of independent actions, each
+    waiting for a given time as a sync target would, run sequentially and
+    in parallel (--jobs), against the longest single action.
+
+    Run with:
+        ./horsewhisperer-parallel-benchmark [actions] [jobs]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+static void defineSchema() {
+    HW::Reset();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineAction("sync", 1, true, "sync a target", "",
+                     [](const HW::Arguments& args) -> int {
+                        std::this_thread::sleep_for(
+                            std::chrono::milliseconds(std::stoi(args[0])));
+                        return 0; });
+    HW::SetActionDependencies("sync", {});
+}
+
+int main(int argc, char* argv[]) {
+    int actions { argc > 1 ? std::atoi(argv[1]) : 32 };
+    std::string jobs { argc > 2 ? argv[2] : std::to_string(actions) };
+
+    // Targets taking from 10 to 50 ms
+    std::vector<std::string> tokens { "benchmark", "--jobs", "1" };
+    int longest { 0 };
+    for (int i = 0; i < actions; i++) {
+        int milliseconds { 10 + (i * 37) % 41 };
+        longest = std::max(longest, milliseconds);
+        tokens.push_back("sync");
+        tokens.push_back(std::to_string(milliseconds));
+        tokens.push_back("+");
+    }
+
+    std::cout << actions << " actions, longest: " << longest << " ms\n";
+    for (std::string jobs_value : { std::string("1"), jobs }) {
+        defineSchema();
+        tokens[2] = jobs_value;
+        std::vector<char*> cli {};
+        for (auto& token : tokens) {
+            cli.push_back(&token[0]);
+        }
+
+        auto start = Clock::now();
+        if (HW::Parse(cli.size(), cli.data()) != HW::PARSE_OK || HW::Start() != 0) {
+            std::cout << "run failed\n";
+            return 1;
+        }
+        std::cout << "--jobs " << jobs_value << ": "
+                  << std::chrono::duration<double, std::milli>(Clock::now() - start).count()
+                  << " ms\n";
+    }
+
+    return 0;
+}
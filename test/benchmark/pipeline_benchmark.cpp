@@ -0,0 +1,163 @@
+/*
+    pipeline_benchmark.cpp
+    ======================
+
+    Measures the wall time of a scan + filter + upload chain, where scan
+    and upload wait for I/O and filter uses the CPU, when the actions hand
+    their records over through temporary files, one after the other, and
+    when they are piped and run together, and the CPU time they use. A
+    last pipeline scans slowly, so that filter and upload mostly wait for
+    it: waiting for records shouldn't burn CPU time.
+
+    Run with:
+        ./horsewhisperer-pipeline-benchmark [records]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <fstream>
+#include <iostream>
+#include <thread>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+// I/O latency: 1 ms per block of records read or written
+static const int BLOCK_RECORDS = 100;
+
+static void waitForIO(int record) {
+    if (record % BLOCK_RECORDS == 0) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+}
+
+static std::string scanRecord(int i) {
+    waitForIO(i);
+    return "/data/file-" + std::to_string(i);
+}
+
+static bool keepRecord(const std::string& record) {
+    // FNV-1a rounds, standing for parsing the record
+    uint64_t hash { 14695981039346656037ULL };
+    for (int round = 0; round < 2000; round++) {
+        for (char c : record) {
+            hash = (hash ^ static_cast<unsigned char>(c)) * 1099511628211ULL;
+        }
+    }
+    return hash % 4 != 0;
+}
+
+static void uploadRecord(int i) {
+    waitForIO(i);
+}
+
+static void defineSchema(int records) {
+    HW::Reset();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::SetPipeDelimiters(std::vector<std::string> { "|" });
+
+    // Chained: each action reads the file of the previous one
+    HW::DefineAction("scan-file", 1, true, "", "", [records](const HW::Arguments& args) -> int {
+        std::ofstream out { args[0] };
+        for (int i = 0; i < records; i++) {
+            out << scanRecord(i) << "\n";
+        }
+        return 0; });
+    HW::DefineAction("filter-file", 2, true, "", "", [](const HW::Arguments& args) -> int {
+        std::ifstream in { args[0] };
+        std::ofstream out { args[1] };
+        std::string record {};
+        while (std::getline(in, record)) {
+            if (keepRecord(record)) {
+                out << record << "\n";
+            }
+        }
+        return 0; });
+    HW::DefineAction("upload-file", 1, true, "", "", [](const HW::Arguments& args) -> int {
+        std::ifstream in { args[0] };
+        std::string record {};
+        for (int i = 0; std::getline(in, record); i++) {
+            uploadRecord(i);
+        }
+        return 0; });
+
+    // Piped
+    HW::DefineAction("scan", 0, true, "", "", [records](const HW::ActionContext& context) -> int {
+        for (int i = 0; i < records; i++) {
+            context.write(scanRecord(i));
+        }
+        return 0; });
+    HW::DefineAction("scan-slowly", 0, true, "", "", [records](const HW::ActionContext& context) -> int {
+        for (int i = 0; i < records / BLOCK_RECORDS; i++) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+            context.write(scanRecord(i));
+        }
+        return 0; });
+    HW::DefineAction("filter", 0, true, "", "", [](const HW::ActionContext& context) -> int {
+        std::string record {};
+        while (context.read(record)) {
+            if (keepRecord(record)) {
+                context.write(record);
+            }
+        }
+        return 0; });
+    HW::DefineAction("upload", 0, true, "", "", [](const HW::ActionContext& context) -> int {
+        std::string record {};
+        for (int i = 0; context.read(record); i++) {
+            uploadRecord(i);
+        }
+        return 0; });
+}
+
+struct Timing {
+    double wall_ms;
+    double cpu_ms;
+};
+
+static std::ostream& operator<<(std::ostream& out, const Timing& timing) {
+    return out << timing.wall_ms << " ms (CPU: " << timing.cpu_ms << " ms)";
+}
+
+static Timing run(int records, std::vector<std::string> tokens) {
+    defineSchema(records);
+    std::vector<char*> argv {};
+    for (auto& token : tokens) {
+        argv.push_back(&token[0]);
+    }
+
+    auto start = Clock::now();
+    std::clock_t cpu_start { std::clock() };
+    if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK || HW::Start() != 0) {
+        std::cout << "run failed\n";
+        std::exit(1);
+    }
+    return Timing { std::chrono::duration<double, std::milli>(Clock::now() - start).count(),
+                    1000.0 * (std::clock() - cpu_start) / CLOCKS_PER_SEC };
+}
+
+int main(int argc, char* argv[]) {
+    int records { argc > 1 ? std::atoi(argv[1]) : 20000 };
+    std::string scanned { "pipeline_benchmark_scanned.tmp" };
+    std::string filtered { "pipeline_benchmark_filtered.tmp" };
+
+    std::cout << records << " records\n";
+    std::cout << "chained through files: "
+              << run(records, { "benchmark", "scan-file", scanned, "+",
+                                "filter-file", scanned, filtered, "+",
+                                "upload-file", filtered })
+              << "\n";
+    std::cout << "piped:                 "
+              << run(records, { "benchmark", "scan", "|", "filter", "|", "upload" })
+              << "\n";
+    std::cout << "piped, slow scan:      "
+              << run(records, { "benchmark", "scan-slowly", "|", "filter", "|", "upload" })
+              << "\n";
+
+    std::remove(scanned.c_str());
+    std::remove(filtered.c_str());
+    return 0;
+}
@@ -0,0 +1,106 @@
+/*
+    response_file_benchmark.cpp
+    ===========================
+
+    Measures the expansion of a large response file (@file) into the
+    arguments of a negative arity action, against a memcpy of the same
+    size as a reference for the memory bandwidth, and compares the time to
+    the first argument and the memory growth of a streaming action with
+    an action receiving all its arguments at once (Linux only).
+
+    Run with:
+        ./horsewhisperer-response-file-benchmark [arguments]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+static double milliseconds(Clock::time_point start, Clock::time_point end) {
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+static double megabytesPerSecond(size_t bytes, Clock::time_point start) {
+    return bytes / 1e3 / milliseconds(start, Clock::now());
+}
+
+// Resident anonymous memory (i.e. not counting the mapped file), in MB
+static double anonymousMegabytes() {
+    std::ifstream status { "/proc/self/status" };
+    std::string key {};
+    double kilobytes { 0 };
+    while (status >> key) {
+        if (key == "RssAnon:") {
+            status >> kilobytes;
+            break;
+        }
+    }
+    return kilobytes / 1e3;
+}
+
+int main(int argc, char* argv[]) {
+    long arguments { argc > 1 ? std::atol(argv[1]) : 5000000L };
+    std::string path { "horsewhisperer_response_file_benchmark.txt" };
+
+    size_t size { 0 };
+    {
+        std::ofstream file { path };
+        for (long i = 0; i < arguments; i++) {
+            std::string line { "/var/spool/scheduler/jobs/" + std::to_string(i) + ".dat\n" };
+            file << line;
+            size += line.size();
+        }
+    }
+
+    size_t count { 0 };
+    Clock::time_point first_argument {};
+    double memory { 0 };
+    std::string response_file { "@" + path };
+    for (const char* action : { "stream", "list" }) {
+        HW::Reset();
+        HW::DefineAction("stream", -1, true, "stream the files", "",
+                         [&](HW::ArgumentStream& args) -> int {
+                            HW::StringView arg {};
+                            first_argument = Clock::now();
+                            while (args.next(arg)) {}
+                            count = args.count();
+                            memory = anonymousMegabytes();
+                            return 0; });
+        HW::DefineAction("list", -1, true, "list the files", "",
+                         [&](const HW::ArgumentsView& args) -> int {
+                            first_argument = Clock::now();
+                            count = args.size();
+                            memory = anonymousMegabytes();
+                            return 0; });
+
+        const char* cli[] = { "benchmark", action, response_file.c_str() };
+        double initial_memory { anonymousMegabytes() };
+        auto start = Clock::now();
+        if (HW::Parse(3, const_cast<char**>(cli)) != HW::PARSE_OK || HW::Start() != 0) {
+            std::cout << "parse failed\n";
+            return 1;
+        }
+        std::cout << action << ": " << megabytesPerSecond(size, start)
+                  << " MB/s, first argument after "
+                  << milliseconds(start, first_argument) << " ms, memory +"
+                  << memory - initial_memory << " MB\n";
+    }
+
+    std::vector<char> source(size, 'x');
+    std::vector<char> copy(size);
+    auto start = Clock::now();
+    std::memcpy(copy.data(), source.data(), size);
+    std::cout << "memcpy: " << megabytesPerSecond(size, start) << " MB/s\n";
+    std::cout << count << " arguments, " << size / 1e6 << " MB\n";
+
+    std::remove(path.c_str());
+    return copy[0] != 'x';
+}
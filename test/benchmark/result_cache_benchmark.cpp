@@ -0,0 +1,127 @@
+/*
+    result_cache_benchmark.cpp
+    ==========================
+
+    Measures a chain of deterministic actions, each reading an input file
+    and spending some CPU time on it before writing a record: without the
+    result cache, on a cold cache (the results are stored) and on a warm
+    cache (the results are replayed, once the inputs are hashed).
+
+    Run with:
+        ./horsewhisperer-result-cache-benchmark [actions] [input KiB] [work rounds]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+
+#include <dirent.h>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+static const std::string CACHE_DIRECTORY { "hw_result_cache_benchmark" };
+
+// Discards the records
+class NullSink : public HW::OutputSink {
+  public:
+    void write(HW::StringView) override {}
+    void flush() override {}
+};
+
+static void defineSchema(int rounds) {
+    HW::Reset();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineAction("digest", 1, true, "", "",
+                     [rounds](const HW::ActionContext& context) -> int {
+                        std::ifstream file { context.arguments()[0].str(),
+                                             std::ios::binary };
+                        std::string content { std::istreambuf_iterator<char>(file),
+                                              std::istreambuf_iterator<char>() };
+                        uint64_t digest { 0 };
+                        for (int round = 0; round < rounds; round++) {
+                            for (char c : content) {
+                                digest = (digest ^ static_cast<unsigned char>(c))
+                                         * 1099511628211ULL;
+                            }
+                        }
+                        context.write(std::to_string(digest));
+                        return 0; },
+                     nullptr);
+    HW::SetActionCacheable("digest", true);
+    HW::SetActionInputs("digest", [](const HW::ActionContext& context) {
+                            return context.arguments().toArguments(); });
+}
+
+static void removeCache() {
+    if (DIR* entries = opendir(CACHE_DIRECTORY.c_str())) {
+        while (dirent* entry = readdir(entries)) {
+            std::string name { entry->d_name };
+            if (name != "." && name != "..") {
+                std::remove((CACHE_DIRECTORY + "/" + name).c_str());
+            }
+        }
+        closedir(entries);
+    }
+    std::remove(CACHE_DIRECTORY.c_str());
+}
+
+// Milliseconds taken to parse and run the chain in a new session
+static double runChain(std::vector<std::string> tokens) {
+    std::vector<char*> argv {};
+    for (auto& token : tokens) {
+        argv.push_back(&token[0]);
+    }
+    auto begin = Clock::now();
+    HW::Session session {};
+    if (session.parse(argv.size(), argv.data()) != HW::PARSE_OK || session.start() != 0) {
+        std::cout << "chain failed\n";
+        std::exit(1);
+    }
+    return std::chrono::duration<double, std::milli>(Clock::now() - begin).count();
+}
+
+int main(int argc, char* argv[]) {
+    int actions { argc > 1 ? std::atoi(argv[1]) : 20 };
+    int input_kib { argc > 2 ? std::atoi(argv[2]) : 256 };
+    int rounds { argc > 3 ? std::atoi(argv[3]) : 20 };
+
+    std::vector<std::string> paths {};
+    std::vector<std::string> tokens { "benchmark" };
+    for (int i = 0; i < actions; i++) {
+        paths.push_back("hw_result_cache_input_" + std::to_string(i) + ".bin");
+        std::ofstream file { paths.back(), std::ios::binary };
+        for (int j = 0; j < input_kib * 1024; j++) {
+            file.put(static_cast<char>((i * 31 + j * 7) & 0xff));
+        }
+        tokens.push_back("digest");
+        tokens.push_back(paths.back());
+        tokens.push_back("+");
+    }
+    tokens.pop_back();
+
+    NullSink sink {};
+    defineSchema(rounds);
+    HW::SetOutputSink(&sink);
+    removeCache();
+    double uncached_ms { runChain(tokens) };
+    HW::SetCacheDirectory(CACHE_DIRECTORY);
+    double cold_ms { runChain(tokens) };
+    double warm_ms { runChain(tokens) };
+    HW::SetOutputSink(nullptr);
+
+    removeCache();
+    for (auto& path : paths) {
+        std::remove(path.c_str());
+    }
+
+    std::cout << actions << " actions, " << input_kib << " KiB inputs, " << rounds
+              << " rounds\n";
+    std::cout << "uncached:   " << uncached_ms << " ms\n";
+    std::cout << "cold cache: " << cold_ms << " ms\n";
+    std::cout << "warm cache: " << warm_ms << " ms\n";
+    return 0;
+}
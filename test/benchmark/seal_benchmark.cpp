@@ -0,0 +1,75 @@
+/*
+    seal_benchmark.cpp
+    ==================
+
+    Measures parse time with and without sealed lookup tables, for a
+    schema with many actions and flags.
+
+    Run with:
+        ./horsewhisperer-seal-benchmark [actions] [invocations]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+
+namespace HW = HorseWhisperer;
+
+static void defineSchema(int num_actions) {
+    HW::Reset();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    for (int i = 0; i < num_actions; i++) {
+        std::string name { "action_" + std::to_string(i) };
+        HW::DefineGlobalFlag<int>("global_" + std::to_string(i), "", 0, nullptr);
+        HW::DefineAction(name, 1, true, "", "",
+                         [](const HW::Arguments&) -> int { return 0; });
+        HW::DefineActionFlag<std::string>(name, "flag_" + std::to_string(i), "",
+                                          "", nullptr);
+    }
+}
+
+static double parseMilliseconds(int num_actions, std::vector<char*>& argv,
+                                bool sealed) {
+    defineSchema(num_actions);
+    if (sealed) {
+        HW::Seal();
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK) {
+        std::cout << "parse failed\n";
+        std::exit(1);
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::milli>(end - start).count();
+}
+
+int main(int argc, char* argv[]) {
+    int num_actions { argc > 1 ? std::atoi(argv[1]) : 5000 };
+    int invocations { argc > 2 ? std::atoi(argv[2]) : 20000 };
+
+    std::vector<std::string> tokens { "benchmark" };
+    for (int i = 0; i < invocations; i++) {
+        int action { (i * 7919) % num_actions };
+        tokens.push_back("action_" + std::to_string(action));
+        tokens.push_back("argument");
+        tokens.push_back("--flag_" + std::to_string(action));
+        tokens.push_back("value");
+        tokens.push_back("--global_" + std::to_string((i * 104729) % num_actions));
+        tokens.push_back("42");
+        tokens.push_back("+");
+    }
+    std::vector<char*> cli {};
+    for (auto& token : tokens) {
+        cli.push_back(&token[0]);
+    }
+
+    std::cout << num_actions << " actions, " << cli.size() << " tokens\n";
+    std::cout << "unsealed: " << parseMilliseconds(num_actions, cli, false)
+              << " ms\n";
+    std::cout << "sealed:   " << parseMilliseconds(num_actions, cli, true)
+              << " ms\n";
+
+    return 0;
+}
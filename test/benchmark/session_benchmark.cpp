@@ -0,0 +1,107 @@
+/*
+    session_benchmark.cpp
+    =====================
+
+    Measures the throughput of command lines parsed and executed by a
+    number of threads sharing sealed definitions, each with its own
+    Session, against the same threads serialised behind one lock on the
+    singleton.
+
+    Run with:
+        ./horsewhisperer-session-benchmark [commands per thread] [max threads]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+// Administrative commands, as a service would receive them
+static void defineSchema(HW::HorseWhisperer& parser) {
+    parser.setDelimiters(std::vector<std::string> { "+" });
+    parser.defineGlobalFlag<int>("timeout", "", 30, nullptr);
+    parser.defineGlobalFlag<std::string>("user", "", "", nullptr);
+    for (std::string name : { "status", "reload", "drain", "resize" }) {
+        parser.defineAction(name, -1, true, "", "",
+                            [](const HW::ArgumentsView& args) -> int {
+                               return args.size() == 0 || HW::GetFlag<int>("timeout") <= 0;
+                            }, nullptr);
+        parser.defineActionFlag<bool>(name, "force", "", false, nullptr);
+        parser.defineActionFlag<int>(name, "weight", "", 1, nullptr);
+    }
+    parser.seal();
+}
+
+// Command lines/s of threads running commands command lines each
+template <typename Execute>
+static double commandsPerSecond(int threads, int commands, Execute execute) {
+    std::atomic<int> failures { 0 };
+    std::vector<std::thread> workers {};
+    auto start = Clock::now();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([&execute, &failures, commands, t]() {
+            std::vector<std::string> tokens {
+                "admin", "--user", "u" + std::to_string(t), "--timeout", "10",
+                "status", "pool", "--weight", "3", "+",
+                "drain", "backend-1", "backend-2", "--force" };
+            std::vector<char*> argv {};
+            for (auto& token : tokens) {
+                argv.push_back(&token[0]);
+            }
+            for (int i = 0; i < commands; i++) {
+                failures += execute(argv.size(), argv.data());
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+    double seconds { std::chrono::duration<double>(Clock::now() - start).count() };
+    if (failures > 0) {
+        std::cout << "command lines failed\n";
+        std::exit(1);
+    }
+    return threads * commands / seconds;
+}
+
+int main(int argc, char* argv[]) {
+    int commands { argc > 1 ? std::atoi(argv[1]) : 20000 };
+    int max_threads { argc > 2 ? std::atoi(argv[2])
+                               : static_cast<int>(std::max(1u, std::thread::hardware_concurrency())) };
+
+    HW::HorseWhisperer parser {};
+    defineSchema(parser);
+
+    // The singleton, reset between command lines, behind a global lock
+    HW::HorseWhisperer& singleton = HW::HorseWhisperer::Instance();
+    defineSchema(singleton);
+    std::mutex lock {};
+    auto locked = [&singleton, &lock](int argc, char** argv) -> int {
+        std::lock_guard<std::mutex> guard { lock };
+        HW::Session session { singleton };
+        return session.execute(argc, argv);
+    };
+
+    std::cout << "threads  sessions (commands/s)  locked singleton (commands/s)\n";
+    for (int threads = 1; threads <= max_threads; threads *= 2) {
+        double sessions { commandsPerSecond(threads, commands, [&parser](int argc, char** argv) {
+            // One session per thread, reused for every command line
+            static thread_local HW::Session session { parser };
+            return session.execute(argc, argv);
+        }) };
+        double serialised { commandsPerSecond(threads, commands, locked) };
+        std::cout << std::setw(7) << threads << std::setw(24) << static_cast<long>(sessions)
+                  << std::setw(31) << static_cast<long>(serialised) << "\n";
+    }
+
+    return 0;
+}
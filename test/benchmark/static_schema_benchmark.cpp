@@ -0,0 +1,205 @@
+/*
+    static_schema_benchmark.cpp
+    ===========================
+
+    Measures the startup of a tool with 1000 actions, each with a flag:
+    constructing the HorseWhisperer, defining the schema, parsing a
+    command line running one of the actions and running it. The schema
+    is defined at compile time with DefineStaticSchema, or at run time
+    with DefineAction and DefineActionFlag when built with
+    HORSEWHISPERER_BENCHMARK_RUNTIME_SCHEMA; the two builds are the
+    horsewhisperer-static-schema-benchmark and
+    horsewhisperer-runtime-schema-benchmark targets, so that their
+    sizes can be compared too.
+
+    It then measures the parsing of an argument-heavy command line,
+    chaining 100 of the actions with an argument and a flag each, by
+    sessions of one HorseWhisperer on several threads at the same time.
+    Each argument is looked up as an action name too, while most of the
+    static actions are never materialized.
+
+    Run with:
+        ./horsewhisperer-static-schema-benchmark [startups] [parses] [threads]
+        ./horsewhisperer-runtime-schema-benchmark [startups] [parses] [threads]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace HW = HorseWhisperer;
+
+// Heap allocations made by the process
+static std::atomic<size_t> heap_allocations { 0 };
+
+void* operator new(size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc {};
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+static int runAction(const HW::ArgumentsView& arguments) {
+    return arguments.size() == 1 ? 0 : 1;
+}
+
+static bool validateArguments(const HW::ArgumentsView& arguments) {
+    return !arguments.empty();
+}
+
+static const int NUM_ACTIONS { 1000 };
+
+static std::string actionName(int idx) {
+    std::string digits { std::to_string(idx) };
+    return "action_" + std::string(3 - digits.size(), '0') + digits;
+}
+
+#ifdef HORSEWHISPERER_BENCHMARK_RUNTIME_SCHEMA
+
+static const char* SCHEMA_KIND { "runtime" };
+
+static void defineSchema(HW::HorseWhisperer& parser) {
+    for (int i = 0; i < NUM_ACTIONS; i++) {
+        std::string name { actionName(i) };
+        parser.defineAction(name, 1, true, "an action of the benchmark",
+                            "Runs " + name + "\n", runAction, validateArguments);
+        parser.defineActionFlag<int>(name, "level", "level of the action", 0,
+                                     nullptr);
+    }
+}
+
+#else
+
+static const char* SCHEMA_KIND { "static" };
+
+constexpr HW::StaticFlagDefinition action_flags[] = {
+    HW::StaticFlag<int>("level", "level of the action", 0),
+};
+
+#define BENCHMARK_ACTION(n) \
+    HW::StaticAction("action_" #n, 1, true, "an action of the benchmark", \
+                     "Runs action_" #n "\n", runAction) \
+        .withFlags(action_flags) \
+        .withArgumentsCallback(validateArguments),
+#define BENCHMARK_ACTIONS_10(p) \
+    BENCHMARK_ACTION(p##0) BENCHMARK_ACTION(p##1) BENCHMARK_ACTION(p##2) \
+    BENCHMARK_ACTION(p##3) BENCHMARK_ACTION(p##4) BENCHMARK_ACTION(p##5) \
+    BENCHMARK_ACTION(p##6) BENCHMARK_ACTION(p##7) BENCHMARK_ACTION(p##8) \
+    BENCHMARK_ACTION(p##9)
+#define BENCHMARK_ACTIONS_100(p) \
+    BENCHMARK_ACTIONS_10(p##0) BENCHMARK_ACTIONS_10(p##1) BENCHMARK_ACTIONS_10(p##2) \
+    BENCHMARK_ACTIONS_10(p##3) BENCHMARK_ACTIONS_10(p##4) BENCHMARK_ACTIONS_10(p##5) \
+    BENCHMARK_ACTIONS_10(p##6) BENCHMARK_ACTIONS_10(p##7) BENCHMARK_ACTIONS_10(p##8) \
+    BENCHMARK_ACTIONS_10(p##9)
+
+// action_000 to action_999
+constexpr HW::StaticActionDefinition actions[] = {
+    BENCHMARK_ACTIONS_100(0) BENCHMARK_ACTIONS_100(1) BENCHMARK_ACTIONS_100(2)
+    BENCHMARK_ACTIONS_100(3) BENCHMARK_ACTIONS_100(4) BENCHMARK_ACTIONS_100(5)
+    BENCHMARK_ACTIONS_100(6) BENCHMARK_ACTIONS_100(7) BENCHMARK_ACTIONS_100(8)
+    BENCHMARK_ACTIONS_100(9)
+};
+
+constexpr HW::StaticSchema schema = HW::MakeStaticSchema(actions);
+
+static void defineSchema(HW::HorseWhisperer& parser) {
+    parser.defineStaticSchema(schema);
+}
+
+#endif
+
+int main(int argc, char* argv[]) {
+    int startups { argc > 1 ? std::atoi(argv[1]) : 1000 };
+    int parses { argc > 2 ? std::atoi(argv[2]) : 1000 };
+    int num_threads { argc > 3 ? std::atoi(argv[3]) : 4 };
+
+    std::vector<std::string> tokens { "benchmark", "action_500", "argument",
+                                      "--level", "3" };
+    std::vector<char*> cli {};
+    for (auto& token : tokens) {
+        cli.push_back(&token[0]);
+    }
+
+    size_t allocations_before { heap_allocations.load() };
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < startups; i++) {
+        HW::HorseWhisperer parser {};
+        defineSchema(parser);
+        if (parser.parse(cli.size(), cli.data()) != HW::PARSE_OK
+                || !parser.validateActionArguments() || parser.whisper()) {
+            std::cout << "startup failed\n";
+            return 1;
+        }
+    }
+    auto end = std::chrono::steady_clock::now();
+    size_t allocations { heap_allocations.load() - allocations_before };
+
+    std::cout << SCHEMA_KIND << " schema of " << NUM_ACTIONS << " actions, "
+              << startups << " startups\n";
+    std::cout << "startup:     "
+              << std::chrono::duration<double, std::micro>(end - start).count()
+                 / startups
+              << " us\n";
+    std::cout << "allocations: " << allocations / startups << " per startup\n";
+
+    // action_000 file_0 --level 3 action_010 file_1 --level 3 ...
+    std::vector<std::string> chain_tokens { "benchmark" };
+    for (int i = 0; i < 100; i++) {
+        chain_tokens.push_back(actionName(i * 10));
+        chain_tokens.push_back("file_" + std::to_string(i));
+        chain_tokens.push_back("--level");
+        chain_tokens.push_back("3");
+    }
+    std::vector<char*> chain_cli {};
+    for (auto& token : chain_tokens) {
+        chain_cli.push_back(&token[0]);
+    }
+
+    HW::HorseWhisperer parser {};
+    defineSchema(parser);
+    std::atomic<bool> parse_failed { false };
+    start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads {};
+    for (int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&parser, &chain_cli, &parse_failed, parses]() {
+            for (int i = 0; i < parses; i++) {
+                HW::Session session { parser };
+                if (session.parse(chain_cli.size(), chain_cli.data()) != HW::PARSE_OK) {
+                    parse_failed = true;
+                }
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    end = std::chrono::steady_clock::now();
+    if (parse_failed) {
+        std::cout << "parse failed\n";
+        return 1;
+    }
+
+    std::cout << parses << " parses of " << chain_tokens.size() - 1 << " tokens on each of "
+              << num_threads << " threads\n";
+    std::cout << "parse:       "
+              << std::chrono::duration<double, std::micro>(end - start).count()
+                 / (parses * num_threads)
+              << " us of wall time per command line\n";
+
+    return 0;
+}
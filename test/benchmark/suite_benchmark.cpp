@@ -0,0 +1,264 @@
+/*
+    suite_benchmark.cpp
+    ===================
+
+    Measures the main operations on synthetic schemas of 10 to 10,000
+    actions (each with an action flag, plus as many global flags) and
+    command lines of 1 to 1,000,000 tokens:
+      - parse:     Session::parse, per token
+      - validate:  Session::validateActionArguments, per action
+      - dispatch:  Session::start with actions doing nothing, per action
+      - get_flag:  Session::getFlag, per call
+      - set_flag:  Session::setFlag, per call
+      - global_help, action_help: Session::showHelp, per rendering
+
+    Reports, as one JSON object per line, the time and the heap
+    allocations per operation, so that runs can be compared:
+      {"benchmark":"parse","schema_size":100,"tokens":10000,"ops":...,
+       "ns_per_op":...,"allocs_per_op":...}
+
+    Run with:
+        ./horsewhisperer-benchmark-suite [max schema size] [max tokens]
+*/
+#include <horsewhisperer/horsewhisperer.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <streambuf>
+
+namespace HW = HorseWhisperer;
+
+using Clock = std::chrono::steady_clock;
+
+// Heap allocations made by the process
+static std::atomic<size_t> heap_allocations { 0 };
+
+void* operator new(size_t size) {
+    heap_allocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc {};
+    }
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, size_t) noexcept {
+    std::free(p);
+}
+
+// Time spent and allocations made by the measured operations
+struct Measurement {
+    double ns;
+    size_t allocations;
+    size_t ops;
+
+    Measurement() : ns { 0 }, allocations { 0 }, ops { 0 } {}
+
+    // Measure op, counting ops operations
+    template <typename Op>
+    void add(size_t op_count, Op op) {
+        size_t allocations_before { allocations_now() };
+        auto start = Clock::now();
+        op();
+        auto end = Clock::now();
+        allocations += allocations_now() - allocations_before;
+        ns += std::chrono::duration<double, std::nano>(end - start).count();
+        ops += op_count;
+    }
+
+    static size_t allocations_now() {
+        return heap_allocations.load(std::memory_order_relaxed);
+    }
+};
+
+// Repeat measure (which calls Measurement::add) until enough time has
+// been measured
+template <typename Measure>
+static Measurement repeat(Measure measure) {
+    static const double MIN_NS { 50e6 };
+    Measurement measurement {};
+    do {
+        measure(measurement);
+    } while (measurement.ns < MIN_NS);
+    return measurement;
+}
+
+static void report(const std::string& benchmark, size_t schema_size,
+                   size_t tokens, const Measurement& measurement) {
+    double ops { static_cast<double>(std::max<size_t>(measurement.ops, 1)) };
+    std::cout << "{\"benchmark\":\"" << benchmark << "\""
+              << ",\"schema_size\":" << schema_size
+              << ",\"tokens\":" << tokens
+              << ",\"ops\":" << measurement.ops
+              << ",\"ns_per_op\":" << measurement.ns / ops
+              << ",\"allocs_per_op\":" << measurement.allocations / ops
+              << "}" << std::endl;
+}
+
+// Schema of size actions, each with a flag, and size global flags
+static void defineSchema(HW::HorseWhisperer& parser, size_t size) {
+    HW::ActionViewCallback action { [](const HW::ArgumentsView&) { return 0; } };
+    HW::ArgumentsViewCallback validate {
+        [](const HW::ArgumentsView& arguments) { return !arguments.empty(); } };
+    parser.setAppName("benchmark");
+    parser.setDelimiters({ "+" });
+    for (size_t i = 0; i < size; i++) {
+        std::string name { "action_" + std::to_string(i) };
+        parser.defineGlobalFlag<int>("global_" + std::to_string(i),
+                                     "a global flag of the benchmark", 0, nullptr);
+        parser.defineAction(name, 1, true, "an action of the benchmark",
+                            "Runs " + name + "\n", action, validate);
+        parser.defineActionFlag<int>(name, "flag_" + std::to_string(i),
+                                     "a flag of " + name, 0, nullptr);
+    }
+    parser.seal();
+}
+
+// Command line of count tokens: chained actions with an argument and a
+// flag, then global flags for the remaining tokens
+static std::vector<std::string> makeTokens(size_t schema_size, size_t count) {
+    std::vector<std::string> tokens { "benchmark" };
+    for (size_t i = 0; tokens.size() + 4 <= count + 1; i++) {
+        size_t action { (i * 7919) % schema_size };
+        tokens.push_back("action_" + std::to_string(action));
+        tokens.push_back("argument");
+        tokens.push_back("--flag_" + std::to_string(action) + "=7");
+        tokens.push_back("+");
+    }
+    for (size_t i = 0; tokens.size() < count + 1; i++) {
+        tokens.push_back("--global_" + std::to_string((i * 104729) % schema_size) + "=42");
+    }
+    return tokens;
+}
+
+static std::vector<char*> makeArgv(std::vector<std::string>& tokens) {
+    std::vector<char*> argv {};
+    for (auto& token : tokens) {
+        argv.push_back(&token[0]);
+    }
+    return argv;
+}
+
+static void parseOrExit(HW::Session& session, std::vector<char*>& argv, int expected) {
+    session.reset();
+    if (session.parse(argv.size(), argv.data()) != expected) {
+        std::cout << "parse failed\n";
+        std::exit(1);
+    }
+}
+
+// Discards what is written to it
+class NullBuffer : public std::streambuf {
+  protected:
+    int overflow(int c) override { return c; }
+    std::streamsize xsputn(const char*, std::streamsize count) override {
+        return count;
+    }
+};
+
+static void benchmarkCommandLines(HW::HorseWhisperer& parser, size_t schema_size,
+                                  size_t tokens_count) {
+    HW::Session session { parser };
+    std::vector<std::string> tokens { makeTokens(schema_size, tokens_count) };
+    std::vector<char*> argv { makeArgv(tokens) };
+
+    report("parse", schema_size, tokens_count, repeat([&](Measurement& m) {
+        session.reset();
+        m.add(tokens_count, [&]() { session.parse(argv.size(), argv.data()); });
+    }));
+
+    parseOrExit(session, argv, HW::PARSE_OK);
+    size_t actions { session.getParsedActions().size() };
+    if (actions == 0) {
+        return;
+    }
+
+    report("validate", schema_size, tokens_count, repeat([&](Measurement& m) {
+        m.add(actions, [&]() {
+            if (!session.validateActionArguments()) {
+                std::exit(1);
+            }
+        });
+    }));
+
+    report("dispatch", schema_size, tokens_count, repeat([&](Measurement& m) {
+        m.add(actions, [&]() {
+            if (session.start() != 0) {
+                std::exit(1);
+            }
+        });
+    }));
+}
+
+static void benchmarkFlags(HW::HorseWhisperer& parser, size_t schema_size) {
+    static const size_t CALLS { 10000 };
+    HW::Session session { parser };
+    std::vector<std::string> names {};
+    for (size_t i = 0; i < CALLS; i++) {
+        names.push_back("global_" + std::to_string((i * 104729) % schema_size));
+    }
+
+    int sum { 0 };
+    report("get_flag", schema_size, 0, repeat([&](Measurement& m) {
+        m.add(CALLS, [&]() {
+            for (const auto& name : names) {
+                sum += session.getFlag<int>(name);
+            }
+        });
+    }));
+    report("set_flag", schema_size, 0, repeat([&](Measurement& m) {
+        m.add(CALLS, [&]() {
+            for (const auto& name : names) {
+                session.setFlag<int>(name, ++sum);
+            }
+        });
+    }));
+}
+
+static void benchmarkHelp(HW::HorseWhisperer& parser, size_t schema_size) {
+    HW::Session session { parser };
+    NullBuffer null_buffer {};
+    std::streambuf* cout_buffer { std::cout.rdbuf() };
+
+    std::vector<std::string> global_help { "benchmark", "--help" };
+    std::vector<char*> global_argv { makeArgv(global_help) };
+    parseOrExit(session, global_argv, HW::PARSE_HELP);
+    std::cout.rdbuf(&null_buffer);
+    Measurement global {
+        repeat([&](Measurement& m) { m.add(1, [&]() { session.showHelp(); }); }) };
+    std::cout.rdbuf(cout_buffer);
+    report("global_help", schema_size, global_help.size() - 1, global);
+
+    std::vector<std::string> action_help { "benchmark", "action_0", "--help" };
+    std::vector<char*> action_argv { makeArgv(action_help) };
+    parseOrExit(session, action_argv, HW::PARSE_HELP);
+    std::cout.rdbuf(&null_buffer);
+    Measurement action {
+        repeat([&](Measurement& m) { m.add(1, [&]() { session.showHelp(); }); }) };
+    std::cout.rdbuf(cout_buffer);
+    report("action_help", schema_size, action_help.size() - 1, action);
+}
+
+int main(int argc, char* argv[]) {
+    size_t max_schema_size { argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 10000 };
+    size_t max_tokens { argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 1000000 };
+
+    for (size_t schema_size = 10; schema_size <= max_schema_size; schema_size *= 10) {
+        HW::HorseWhisperer parser {};
+        defineSchema(parser, schema_size);
+        for (size_t tokens = 1; tokens <= max_tokens; tokens *= 100) {
+            benchmarkCommandLines(parser, schema_size, tokens);
+        }
+        benchmarkFlags(parser, schema_size);
+        benchmarkHelp(parser, schema_size);
+    }
+
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include <horsewhisperer/horsewhisperer.h>
+#include <atomic>
+#include <csignal>
+#include <dirent.h>
 #include "../test.h"
 
 namespace HW = HorseWhisperer;
@@ -26,6 +29,107 @@ TEST_CASE("reset", "[reset]") {
     }
 }
 
+// Heap allocations not freed yet, counted for the whole test binary
+static std::atomic<long> live_allocations { 0 };
+
+void* operator new(size_t size) {
+    void* p = std::malloc(size ? size : 1);
+    if (!p) {
+        throw std::bad_alloc {};
+    }
+    live_allocations++;
+    return p;
+}
+
+void operator delete(void* p) noexcept {
+    if (p) {
+        live_allocations--;
+        std::free(p);
+    }
+}
+
+void operator delete(void* p, size_t) noexcept {
+    if (p) {
+        live_allocations--;
+        std::free(p);
+    }
+}
+
+// Check that cycles of Reset, definitions and Parse leave the live
+// allocations unchanged
+static void checkResetAndParseCycles(int cycles) {
+    auto cycle = []() {
+        HW::Reset();
+        prepareGlobal();
+        HW::SetDelimiters(std::vector<std::string> { "+" });
+        prepareAction(nullptr);
+        HW::DefineActionFlag<std::string>("test-action", "s string", "a test flag",
+                                          "", nullptr);
+        const char* cli[] = { "test-app", "test-action", "--action-get", "+",
+                              "test-action", "-s", "value", "--global-get" };
+        return HW::Parse(8, const_cast<char**>(cli));
+    };
+    REQUIRE(cycle() == HW::PARSE_OK);
+    long allocations { live_allocations };
+    int failed_parses { 0 };
+    for (int i = 0; i < cycles; i++) {
+        failed_parses += cycle() != HW::PARSE_OK;
+    }
+    // Read before REQUIRE, which allocates
+    long growth { live_allocations - allocations };
+    REQUIRE(failed_parses == 0);
+    REQUIRE(growth == 0);
+}
+
+TEST_CASE("Arena", "[reset]") {
+    SECTION("it destroys its objects, most recent first") {
+        std::vector<int> destroyed {};
+        struct Tracked {
+            Tracked(std::vector<int>& destroyed_, int id_)
+                    : destroyed { destroyed_ }, id { id_ } {}
+            ~Tracked() { destroyed.push_back(id); }
+            std::vector<int>& destroyed;
+            int id;
+        };
+        {
+            HW::Arena arena {};
+            for (int i = 0; i < 1000; i++) {
+                REQUIRE(arena.make<Tracked>(destroyed, i)->id == i);
+            }
+            arena.clear();
+            REQUIRE(destroyed.size() == 1000);
+            REQUIRE(destroyed.front() == 999);
+            REQUIRE(destroyed.back() == 0);
+            arena.make<Tracked>(destroyed, 1000);
+        }
+        REQUIRE(destroyed.back() == 1000);
+    }
+
+    SECTION("it reuses its blocks once cleared") {
+        HW::Arena arena {};
+        for (int i = 0; i < 1000; i++) {
+            arena.make<int64_t>(i);
+        }
+        arena.clear();
+        long allocations { live_allocations };
+        for (int i = 0; i < 1000; i++) {
+            arena.make<int64_t>(i);
+        }
+        // Read before REQUIRE, which allocates
+        long growth { live_allocations - allocations };
+        REQUIRE(growth == 0);
+    }
+
+    SECTION("Reset and Parse do not leak") {
+        checkResetAndParseCycles(1000);
+    }
+}
+
+// Run with "[leak]"; a million cycles take about a minute
+TEST_CASE("Reset and Parse do not leak over many cycles", "[.][leak]") {
+    checkResetAndParseCycles(1000000);
+}
+
 TEST_CASE("global GetFlag", "[global getflag]") {
     HW::Reset();
     prepareGlobal();
@@ -377,4 +481,2418 @@ TEST_CASE("HorseWhisperer::Start", "[start]") {
         HW::Start();
         REQUIRE(call_counter == 3);
     }
+
+    SECTION("chained actions without the flag read its default value") {
+        std::vector<std::string> values {};
+        HW::DefineAction("chain_test_4", 0, true, "test-action", "no help",
+                         [&values](std::vector<std::string>) -> int {
+                            values.push_back(HW::GetFlag<std::string>("test_flag"));
+                            return 0; });
+        HW::DefineActionFlag<std::string>("chain_test_4", "test_flag t",
+                                          "no description", "foo", nullptr);
+
+        const char* cli[] = { "test-app",
+                              "chain_test_4",
+                              "chain_test_4", "--test_flag", "spam", "-t", "eggs",
+                              "chain_test_4" };
+
+        HW::Parse(8, const_cast<char**>(cli));
+        HW::Start();
+        REQUIRE(values == (std::vector<std::string> { "foo", "eggs", "foo" }));
+    }
+}
+
+TEST_CASE("FlagHandle", "[handle]") {
+    HW::Reset();
+    prepareGlobal();
+
+    SECTION("it reads and writes a global flag") {
+        auto handle = HW::DefineGlobalFlag<int>("global-handle", "test", 3, nullptr);
+        REQUIRE(handle.isValid());
+        REQUIRE(handle.get() == 3);
+        handle.set(42);
+        REQUIRE(handle.get() == 42);
+        REQUIRE(HW::GetFlag<int>("global-handle") == 42);
+    }
+
+    SECTION("it throws when flag validation fails") {
+        auto handle = HW::DefineGlobalFlag<int>("global-handle", "test", 3,
+                                                [](int& v) -> bool { return v < 5; });
+        REQUIRE_THROWS_AS(handle.set(6), HW::flag_validation_error);
+        REQUIRE(handle.get() == 3);
+    }
+
+    SECTION("it resolves action flags to the active context") {
+        std::vector<std::string> values {};
+        HW::FlagHandle<std::string> handle {};
+        HW::DefineAction("handle_test", 0, true, "test-action", "no help",
+                         [&values, &handle](std::vector<std::string>) -> int {
+                            values.push_back(handle.get());
+                            return 0; });
+        handle = HW::DefineActionFlag<std::string>("handle_test", "h_flag f",
+                                                   "no description", "foo",
+                                                   nullptr);
+
+        const char* cli[] = { "test-app",
+                              "handle_test", "--h_flag", "spam",
+                              "handle_test",
+                              "handle_test", "-f", "eggs" };
+        REQUIRE(HW::Parse(8, const_cast<char**>(cli)) == HW::PARSE_OK);
+        HW::Start();
+        REQUIRE(values == (std::vector<std::string> { "spam", "foo", "eggs" }));
+    }
+
+    SECTION("it throws when reading an action flag from another context") {
+        prepareAction(nullptr);
+        auto handle = HW::DefineActionFlag<bool>("test-action", "handle-flag",
+                                                 "a test flag", false, nullptr);
+        REQUIRE_THROWS_AS(handle.get(), HW::undefined_flag_error);
+    }
+}
+
+TEST_CASE("PerfectHashTable", "[seal]") {
+    std::vector<std::string> keys {};
+    for (int i = 0; i < 10000; i++) {
+        keys.push_back("key_" + std::to_string(i));
+    }
+    HW::PerfectHashTable table {};
+    table.build(keys);
+
+    SECTION("it finds every key") {
+        REQUIRE(table.size() == keys.size());
+        for (size_t i = 0; i < keys.size(); i++) {
+            REQUIRE(table.find(keys[i].data(), keys[i].size()) == static_cast<int>(i));
+        }
+    }
+
+    SECTION("it does not find other keys") {
+        for (int i = 10000; i < 20000; i++) {
+            std::string key { "key_" + std::to_string(i) };
+            REQUIRE(table.find(key.data(), key.size()) == HW::NAME_NOT_FOUND);
+        }
+        REQUIRE(table.find("", 0) == HW::NAME_NOT_FOUND);
+    }
+}
+
+TEST_CASE("TokenSet", "[parse]") {
+    HW::TokenSet set {};
+    set.assign(std::vector<std::string> { "+", "++", "then" });
+
+    SECTION("it contains its tokens only") {
+        REQUIRE(set.contains("+"));
+        REQUIRE(set.contains("++"));
+        REQUIRE(set.contains("then"));
+        REQUIRE_FALSE(set.contains("+++"));
+        REQUIRE_FALSE(set.contains("the"));
+        REQUIRE_FALSE(set.contains("action"));
+        REQUIRE_FALSE(set.contains(""));
+    }
+
+    SECTION("it can contain the empty token") {
+        set.assign(std::vector<std::string> { "" });
+        REQUIRE(set.contains(""));
+        REQUIRE_FALSE(set.contains("+"));
+    }
+
+    SECTION("it can be cleared") {
+        set.clear();
+        REQUIRE_FALSE(set.contains("+"));
+    }
+}
+
+TEST_CASE("Seal", "[seal]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    std::vector<std::string> values {};
+    HW::DefineAction("seal_test", 1, true, "test-action", "no help",
+                     [&values](std::vector<std::string> args) -> int {
+                        values.push_back(args[0] + ":"
+                                         + HW::GetFlag<std::string>("seal_flag"));
+                        return 0; });
+    HW::DefineActionFlag<std::string>("seal_test", "seal_flag s", "no description",
+                                      "foo", nullptr);
+    HW::DefineGlobalFlag<int>("global-int", "test", 1, nullptr);
+    HW::Seal();
+
+    SECTION("it parses actions, action flags and global flags") {
+        const char* cli[] = { "test-app", "--global-int", "5",
+                              "seal_test", "one", "--seal_flag", "spam", "+",
+                              "seal_test", "two", "-s", "eggs" };
+        REQUIRE(HW::Parse(12, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::GetFlag<int>("global-int") == 5);
+        HW::Start();
+        REQUIRE(values == (std::vector<std::string> { "one:spam", "two:eggs" }));
+    }
+
+    SECTION("it rejects unknown flags and actions") {
+        const char* flag_cli[] = { "test-app", "--seal_flag", "spam" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(flag_cli)) == HW::PARSE_ERROR);
+        const char* action_cli[] = { "test-app", "seal_flag" };
+        REQUIRE(HW::Parse(2, const_cast<char**>(action_cli)) == HW::PARSE_ERROR);
+    }
+
+    SECTION("it throws when defining after sealing") {
+        REQUIRE_THROWS_AS(HW::DefineGlobalFlag<int>("late", "test", 1, nullptr),
+                          HW::sealed_error);
+        REQUIRE_THROWS_AS(HW::DefineAction("late", 0, true, "", "", action_callback),
+                          HW::sealed_error);
+    }
+
+    SECTION("Reset unseals") {
+        HW::Reset();
+        REQUIRE_NOTHROW(HW::DefineGlobalFlag<int>("late", "test", 1, nullptr));
+    }
+}
+
+TEST_CASE("StringView", "[views]") {
+    const char* text = "key=value";
+    HW::StringView view { text };
+
+    SECTION("it refers to the given characters") {
+        REQUIRE(view.size() == 9);
+        REQUIRE(view.data() == text);
+        REQUIRE(view.str() == "key=value");
+    }
+
+    SECTION("it compares by content") {
+        REQUIRE(view == "key=value");
+        REQUIRE(view == std::string { "key=value" });
+        REQUIRE(view != "key");
+    }
+
+    SECTION("it finds characters and makes substrings") {
+        size_t idx { view.find('=') };
+        REQUIRE(idx == 3);
+        REQUIRE(view.substr(0, idx) == "key");
+        REQUIRE(view.substr(idx + 1) == "value");
+        REQUIRE(view.find('#') == HW::StringView::npos);
+        REQUIRE(view.find('e', 2) == 8);
+        REQUIRE(view.find('k', 9) == HW::StringView::npos);
+        REQUIRE(HW::StringView {}.find('k') == HW::StringView::npos);
+    }
+}
+
+TEST_CASE("ArgumentsView callbacks", "[views]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+
+    std::vector<std::string> validated {};
+    std::vector<std::string> executed {};
+    HW::DefineAction("view_test", -1, true, "test-action", "no help",
+                     [&executed](const HW::ArgumentsView& args) -> int {
+                        for (auto& arg : args) {
+                            executed.push_back(arg.str());
+                        }
+                        return 0; },
+                     [&validated](const HW::ArgumentsView& args) -> bool {
+                        validated = args.toArguments();
+                        return args[0] != "bad"; });
+
+    SECTION("they receive views into argv") {
+        const char* cli[] = { "test-app", "view_test", "one", "two", "three" };
+        REQUIRE(HW::Parse(5, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::ValidateActionArguments());
+        REQUIRE(HW::Start() == 0);
+        std::vector<std::string> expected { "one", "two", "three" };
+        REQUIRE(validated == expected);
+        REQUIRE(executed == expected);
+    }
+
+    SECTION("they can be chained with Arguments callbacks") {
+        std::vector<std::string> legacy {};
+        HW::DefineAction("legacy_test", 1, true, "test-action", "no help",
+                         [&legacy](const HW::Arguments& args) -> int {
+                            legacy = args;
+                            return 0; });
+        const char* cli[] = { "test-app", "view_test", "one", "+",
+                              "legacy_test", "two" };
+        REQUIRE(HW::Parse(6, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(executed == (std::vector<std::string> { "one" }));
+        REQUIRE(legacy == (std::vector<std::string> { "two" }));
+    }
+
+    SECTION("their validation result is honoured") {
+        const char* cli[] = { "test-app", "view_test", "bad" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE_FALSE(HW::ValidateActionArguments());
+    }
+}
+
+TEST_CASE("flag type tags", "[type]") {
+    HW::Reset();
+    prepareGlobal();
+
+    SECTION("flags carry the tag of their type") {
+        HW::Flag<int> int_flag {};
+        HW::Flag<std::string> string_flag {};
+        REQUIRE(HW::getTypeOfFlag(&int_flag) == HW::FlagType::Int);
+        REQUIRE(HW::getTypeOfFlag(&string_flag) == HW::FlagType::String);
+    }
+
+    SECTION("invalid values are reported according to the flag type") {
+        HW::DefineGlobalFlag<bool>("global-bool", "test", false, nullptr);
+        HW::DefineGlobalFlag<double>("global-double", "test", 1.1, nullptr);
+        const char* bool_cli[] = { "test-app", "--global-bool=maybe" };
+        REQUIRE(HW::Parse(2, const_cast<char**>(bool_cli)) == HW::PARSE_ERROR);
+        const char* double_cli[] = { "test-app", "--global-double", "pi" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(double_cli))
+                == HW::PARSE_INVALID_FLAG);
+        const char* ok_cli[] = { "test-app", "--global-bool=false",
+                                 "--global-double", "3.5" };
+        REQUIRE(HW::Parse(4, const_cast<char**>(ok_cli)) == HW::PARSE_OK);
+        REQUIRE(HW::GetFlag<double>("global-double") == 3.5);
+    }
+}
+
+TEST_CASE("parseInteger", "[numbers]") {
+    int i {};
+    int64_t i64 {};
+    uint64_t u64 {};
+
+    SECTION("it parses signed values") {
+        REQUIRE(HW::parseInteger<int>("42", i));
+        REQUIRE(i == 42);
+        REQUIRE(HW::parseInteger<int>("-42", i));
+        REQUIRE(i == -42);
+        REQUIRE(HW::parseInteger<int>("+7", i));
+        REQUIRE(i == 7);
+    }
+
+    SECTION("it parses the limits of the type") {
+        REQUIRE(HW::parseInteger<int>("2147483647", i));
+        REQUIRE(i == 2147483647);
+        REQUIRE(HW::parseInteger<int>("-2147483648", i));
+        REQUIRE(i == std::numeric_limits<int>::min());
+        REQUIRE(HW::parseInteger<int64_t>("-9223372036854775808", i64));
+        REQUIRE(i64 == std::numeric_limits<int64_t>::min());
+        REQUIRE(HW::parseInteger<uint64_t>("18446744073709551615", u64));
+        REQUIRE(u64 == std::numeric_limits<uint64_t>::max());
+    }
+
+    SECTION("it rejects values out of range") {
+        REQUIRE_FALSE(HW::parseInteger<int>("2147483648", i));
+        REQUIRE_FALSE(HW::parseInteger<int>("-2147483649", i));
+        REQUIRE_FALSE(HW::parseInteger<int64_t>("9223372036854775808", i64));
+        REQUIRE_FALSE(HW::parseInteger<uint64_t>("18446744073709551616", u64));
+        REQUIRE_FALSE(HW::parseInteger<uint64_t>("-1", u64));
+    }
+
+    SECTION("it rejects malformed values") {
+        REQUIRE_FALSE(HW::parseInteger<int>("", i));
+        REQUIRE_FALSE(HW::parseInteger<int>("-", i));
+        REQUIRE_FALSE(HW::parseInteger<int>("4 2", i));
+        REQUIRE_FALSE(HW::parseInteger<int>("42x", i));
+        REQUIRE_FALSE(HW::parseInteger<int>("forty two", i));
+    }
+}
+
+TEST_CASE("parseDouble", "[numbers]") {
+    double d {};
+
+    SECTION("it matches strtod") {
+        const char* numbers[] = { "0", "-0.0", "3.14", "-2.5e-3", "1E10", ".5",
+                                  "5.", "0.1", "123456789012345678901234",
+                                  "2.2250738585072014e-308", "1.7976931348623157e308",
+                                  "0.30000000000000004", "9007199254740993",
+                                  "1e-400" };
+        for (auto number : numbers) {
+            REQUIRE(HW::parseDouble(number, d));
+            REQUIRE(d == std::strtod(number, nullptr));
+        }
+    }
+
+    SECTION("it rejects malformed values and overflows") {
+        const char* numbers[] = { "", ".", "-", "e5", "1e", "1.2.3", "1e5x",
+                                  "pi", "inf", "nan", " 1", "1e400" };
+        for (auto number : numbers) {
+            REQUIRE_FALSE(HW::parseDouble(number, d));
+        }
+    }
+
+    SECTION("it does not depend on the locale") {
+        std::string previous { std::setlocale(LC_NUMERIC, nullptr) };
+        if (std::setlocale(LC_NUMERIC, "de_DE.UTF-8")) {
+            REQUIRE(HW::parseDouble("1.5", d));
+            REQUIRE(d == 1.5);
+            REQUIRE(HW::parseDouble("1.000000000000000000001e300", d));
+            REQUIRE(d == 1e300);
+            std::setlocale(LC_NUMERIC, previous.c_str());
+        }
+    }
+}
+
+TEST_CASE("numeric flags", "[numbers]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::DefineGlobalFlag<int>("int", "test", 0, nullptr);
+    HW::DefineGlobalFlag<int64_t>("int64", "test", 0, nullptr);
+    HW::DefineGlobalFlag<uint64_t>("uint64", "test", 0, nullptr);
+    HW::DefineGlobalFlag<float>("float", "test", 0, nullptr);
+
+    SECTION("they accept negative and 64 bit values") {
+        const char* cli[] = { "test-app", "--int", "-3", "--int64=-5000000000",
+                              "--uint64", "10000000000000000000", "--float", "-0.5" };
+        REQUIRE(HW::Parse(8, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::GetFlag<int>("int") == -3);
+        REQUIRE(HW::GetFlag<int64_t>("int64") == -5000000000LL);
+        REQUIRE(HW::GetFlag<uint64_t>("uint64") == 10000000000000000000ULL);
+        REQUIRE(HW::GetFlag<float>("float") == -0.5f);
+        REQUIRE(HW::GetFlagType("uint64") == HW::FlagType::UInt64);
+    }
+
+    SECTION("they reject values out of range instead of truncating") {
+        const char* int_cli[] = { "test-app", "--int", "5000000000" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(int_cli)) == HW::PARSE_INVALID_FLAG);
+        const char* float_cli[] = { "test-app", "--float", "1e39" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(float_cli)) == HW::PARSE_INVALID_FLAG);
+    }
+}
+
+TEST_CASE("tokenizeCommandLine", "[batch]") {
+    std::vector<std::string> tokens {};
+
+    SECTION("it splits on blanks and honours quotes and escapes") {
+        REQUIRE(HW::tokenizeCommandLine(
+            "  trot 'mode world champion'\t\"say \\\"hi\\\"\" a\\ b '' ", tokens));
+        REQUIRE(tokens == (std::vector<std::string> {
+            "trot", "mode world champion", "say \"hi\"", "a b", "" }));
+    }
+
+    SECTION("it fails on unterminated quotes") {
+        REQUIRE_FALSE(HW::tokenizeCommandLine("trot 'mode", tokens));
+    }
+}
+
+TEST_CASE("nextCommandLineToken", "[parse]") {
+    HW::StringView token {};
+    bool quoted { false };
+
+    SECTION("plain tokens refer to the buffer, which is left unchanged") {
+        std::string buffer { "gallop ponies" };
+        char* p = &buffer[0];
+        REQUIRE(HW::nextCommandLineToken(p, p + 13, token, quoted) == HW::TOKEN_OK);
+        REQUIRE(token == "gallop");
+        REQUIRE(token.data() == buffer.data());
+        REQUIRE_FALSE(quoted);
+        REQUIRE(HW::nextCommandLineToken(p, p + 7, token, quoted) == HW::TOKEN_OK);
+        REQUIRE(token == "ponies");
+        REQUIRE(HW::nextCommandLineToken(p, p, token, quoted) == HW::TOKEN_END);
+        REQUIRE(buffer == "gallop ponies");
+    }
+
+    SECTION("quotes and escapes are removed in place") {
+        std::string buffer { "'@two words' \\@pony" };
+        char* p = &buffer[0];
+        char* end = p + buffer.size();
+        REQUIRE(HW::nextCommandLineToken(p, end, token, quoted) == HW::TOKEN_OK);
+        REQUIRE(token == "@two words");
+        REQUIRE(quoted);
+        REQUIRE(HW::nextCommandLineToken(p, end, token, quoted) == HW::TOKEN_OK);
+        REQUIRE(token == "@pony");
+        REQUIRE(quoted);
+    }
+}
+
+TEST_CASE("response files", "[parse]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineGlobalFlag<int>("global-int", "test", 1, nullptr);
+
+    std::vector<std::vector<std::string>> executed {};
+    HW::DefineAction("list", -1, true, "test-action", "no help",
+                     [&executed](const HW::ArgumentsView& args) -> int {
+                        executed.push_back(args.toArguments());
+                        return 0; });
+    HW::DefineAction("pair", 2, true, "test-action", "no help",
+                     [&executed](const HW::Arguments& args) -> int {
+                        executed.push_back(args);
+                        return 0; });
+
+    std::vector<std::string> paths {};
+    auto write = [&paths](std::string path, std::string content) {
+        std::ofstream file { path };
+        file << content;
+        paths.push_back(path);
+    };
+    // The arguments refer to the tokens parsed until the actions complete
+    std::vector<std::string> tokens {};
+    auto parse = [&tokens](std::vector<std::string> command_line) -> int {
+        tokens = command_line;
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::Parse(argv.size(), argv.data());
+    };
+
+    SECTION("their tokens replace the @file token") {
+        write("hw_response_1.txt", "one 'two words'\n\"three\"\n\tfour --global-int 5\n");
+        REQUIRE(parse({ "list", "zero", "@hw_response_1.txt", "five" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(executed == (std::vector<std::vector<std::string>> {
+            { "zero", "one", "two words", "three", "four", "five" } }));
+        REQUIRE(HW::GetFlag<int>("global-int") == 5);
+    }
+
+    SECTION("they can contain actions, delimiters and nested response files") {
+        write("hw_response_2.txt", "a b\n+ pair @hw_response_3.txt '@c'\n");
+        write("hw_response_3.txt", "x y + list");
+        REQUIRE(parse({ "@hw_response_2.txt" }) == HW::PARSE_ERROR);
+        REQUIRE(parse({ "list", "@hw_response_2.txt" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(executed == (std::vector<std::vector<std::string>> {
+            { "a", "b" }, { "x", "y" }, { "@c" } }));
+    }
+
+    SECTION("errors are reported") {
+        write("hw_response_4.txt", "a 'b");
+        write("hw_response_5.txt", "a @hw_response_5.txt");
+        REQUIRE(parse({ "list", "@hw_response_missing.txt" }) == HW::PARSE_ERROR);
+        REQUIRE(parse({ "list", "@hw_response_4.txt" }) == HW::PARSE_ERROR);
+        REQUIRE(parse({ "list", "@hw_response_5.txt" }) == HW::PARSE_ERROR);
+    }
+
+    SECTION("the arity minimum is checked across response files") {
+        write("hw_response_6.txt", "");
+        REQUIRE(parse({ "pair", "a", "@hw_response_6.txt" }) == HW::PARSE_ERROR);
+        REQUIRE(parse({ "list", "@hw_response_6.txt" }) == HW::PARSE_ERROR);
+    }
+
+    for (auto& path : paths) {
+        std::remove(path.c_str());
+    }
+}
+
+TEST_CASE("streaming actions", "[stream]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineGlobalFlag<int>("global-int", "test", 1, nullptr);
+
+    std::vector<std::string> streamed {};
+    size_t limit { 100 };
+    HW::DefineAction("stream", -2, true, "test-action", "no help",
+                     [&streamed, &limit](HW::ArgumentStream& args) -> int {
+                        HW::StringView arg {};
+                        while (args.count() < limit && args.next(arg)) {
+                            streamed.push_back(arg.str() + ":"
+                                + std::to_string(HW::GetFlag<int>("global-int")));
+                        }
+                        return 0; });
+    std::vector<std::string> chained {};
+    HW::DefineAction("chained", 1, true, "test-action", "no help",
+                     [&chained](const HW::Arguments& args) -> int {
+                        chained.push_back(args[0]);
+                        return 0; });
+
+    // Streamed arguments are read from argv after Parse returns
+    std::vector<char*> argv {};
+    auto parse = [&argv](std::vector<std::string>& tokens) -> int {
+        tokens.insert(tokens.begin(), "test-app");
+        argv.clear();
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::Parse(argv.size(), argv.data());
+    };
+
+    SECTION("the action reads its arguments, literally, after its flags") {
+        std::vector<std::string> tokens { "stream", "--global-int", "5", "a",
+                                          "--global-int", "b" };
+        REQUIRE(parse(tokens) == HW::PARSE_OK);
+        REQUIRE(HW::ValidateActionArguments());
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(streamed == (std::vector<std::string> {
+            "a:5", "--global-int:5", "b:5" }));
+    }
+
+    SECTION("the command line following the arguments is parsed after the action") {
+        limit = 1;
+        std::vector<std::string> tokens { "stream", "a", "b", "c", "+", "chained",
+                                          "d", "--global-int", "7" };
+        REQUIRE(parse(tokens) == HW::PARSE_OK);
+        REQUIRE(HW::GetParsedActions() == (std::vector<std::string> { "stream" }));
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(streamed == (std::vector<std::string> { "a:1" }));
+        REQUIRE(chained == (std::vector<std::string> { "d" }));
+        REQUIRE(HW::GetFlag<int>("global-int") == 7);
+    }
+
+    SECTION("errors following the arguments make the chain fail") {
+        std::vector<std::string> tokens { "stream", "a", "b", "+", "unknown" };
+        REQUIRE(parse(tokens) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+    }
+
+    SECTION("'-' stands for the lines read from stdin, which are read lazily") {
+        std::istringstream input { "x\n\ny\nz\n" };
+        std::streambuf* cin_buffer = std::cin.rdbuf(input.rdbuf());
+        std::vector<std::string> tokens { "stream", "-", "w" };
+        int parse_result { parse(tokens) };
+        std::streamoff read_by_parse { input.tellg() };
+        int start_result { HW::Start() };
+        std::cin.rdbuf(cin_buffer);
+
+        REQUIRE(parse_result == HW::PARSE_OK);
+        REQUIRE(read_by_parse == 5);
+        REQUIRE(start_result == 0);
+        REQUIRE(streamed == (std::vector<std::string> {
+            "x:1", "y:1", "z:1", "w:1" }));
+    }
+
+    SECTION("the arity minimum is checked by parse") {
+        std::vector<std::string> no_arguments { "stream" };
+        REQUIRE(parse(no_arguments) == HW::PARSE_ERROR);
+        std::vector<std::string> one_argument { "stream", "a", "+", "chained", "b" };
+        REQUIRE(parse(one_argument) == HW::PARSE_ERROR);
+    }
+
+    SECTION("streaming actions must have a negative arity") {
+        REQUIRE_THROWS_AS(HW::DefineAction("bad_stream", 1, true, "", "",
+                                           [](HW::ArgumentStream&) -> int { return 0; }),
+                          HW::horsewhisperer_error);
+    }
+}
+
+TEST_CASE("parallel actions", "[parallel]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+
+    std::mutex mutex {};
+    std::vector<std::string> finished {};
+    auto finish = [&mutex, &finished](std::string name) {
+        std::lock_guard<std::mutex> lock { mutex };
+        finished.push_back(name);
+    };
+
+    // Succeed once `count` instances of the action run at the same time
+    std::atomic<int> arrived { 0 };
+    int count { 2 };
+    HW::DefineAction("meet", 1, true, "test-action", "no help",
+                     [&](const HW::Arguments& args) -> int {
+                        ++arrived;
+                        for (int i = 0; i < 2000 && arrived < count; i++) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        finish(args[0] + ":" + HW::GetFlag<std::string>("tag"));
+                        return arrived < count; });
+    HW::DefineActionFlag<std::string>("meet", "tag", "test", "", nullptr);
+    HW::SetActionDependencies("meet", {});
+    HW::DefineAction("after", 1, true, "test-action", "no help",
+                     [&](const HW::Arguments& args) -> int {
+                        finish(args[0]);
+                        return args[0] == "fail"; });
+    HW::DefineAction("after_meet", 1, true, "test-action", "no help",
+                     [&](const HW::Arguments& args) -> int {
+                        finish(args[0]);
+                        return 0; });
+    HW::SetActionDependencies("after_meet", { "meet" });
+
+    auto start = [](std::vector<std::string> tokens) -> int {
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK) {
+            return -1;
+        }
+        return HW::Start();
+    };
+
+    SECTION("independent actions run concurrently, with their own flags") {
+        REQUIRE(start({ "-j", "2", "meet", "a", "--tag", "x", "+",
+                        "meet", "b", "--tag", "y" }) == 0);
+        std::sort(finished.begin(), finished.end());
+        REQUIRE(finished == (std::vector<std::string> { "a:x", "b:y" }));
+    }
+
+    SECTION("actions wait for their dependencies") {
+        REQUIRE(start({ "-j", "4", "meet", "a", "+", "after_meet", "b", "+",
+                        "meet", "c" }) == 0);
+        REQUIRE(finished.back() == "b");
+    }
+
+    SECTION("actions without declared dependencies wait for all the preceding ones") {
+        count = 1;
+        REQUIRE(start({ "-j", "4", "after", "a", "+", "meet", "b", "+",
+                        "after", "c", "+", "after", "d" }) == 0);
+        REQUIRE(finished == (std::vector<std::string> { "a", "b:", "c", "d" }));
+    }
+
+    SECTION("nothing starts after a failure") {
+        REQUIRE(start({ "--jobs", "4", "after", "fail", "+", "after", "b", "+",
+                        "after", "c" }) == 1);
+        REQUIRE(finished == (std::vector<std::string> { "fail" }));
+    }
+}
+
+TEST_CASE("ActionContext callbacks", "[context]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+
+    std::mutex mutex {};
+    std::vector<std::string> reads {};
+    std::atomic<int> arrived { 0 };
+    int count { 1 };
+    HW::FlagHandle<std::string> tag {};
+    auto other = HW::DefineGlobalFlag<int>("other", "test", 7, nullptr);
+    HW::DefineAction("context_test", 1, true, "test-action", "no help",
+                     [&](const HW::ActionContext& context) -> int {
+                        // Wait for the other actions, so that reads happen
+                        // while they run
+                        ++arrived;
+                        for (int i = 0; i < 2000 && arrived < count; i++) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        std::thread reader { [&]() {
+                            std::string read { context.actionName() + " "
+                                + context.arguments()[0].str() + " "
+                                + context.getFlag<std::string>("tag") + " "
+                                + tag.get(context) + " "
+                                + std::to_string(other.get(context)) + " "
+                                + std::to_string(context.getFlag<bool>("global-get")) };
+                            std::lock_guard<std::mutex> lock { mutex };
+                            reads.push_back(read);
+                        } };
+                        reader.join();
+                        return 0; },
+                     [](const HW::ArgumentsView& args) -> bool {
+                        return args[0] != "bad"; });
+    tag = HW::DefineActionFlag<std::string>("context_test", "tag", "test",
+                                            "none", nullptr);
+
+    auto start = [](std::vector<std::string> tokens) -> int {
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK
+                || !HW::ValidateActionArguments()) {
+            return -1;
+        }
+        return HW::Start();
+    };
+
+    SECTION("it reads the arguments and flags of the action from any thread") {
+        REQUIRE(start({ "--global-get", "context_test", "a", "--tag", "x", "+",
+                        "context_test", "b" }) == 0);
+        REQUIRE(reads == (std::vector<std::string> {
+            "context_test a x x 7 1", "context_test b none none 7 1" }));
+    }
+
+    SECTION("it reads its own context while other actions run") {
+        count = 2;
+        HW::SetActionDependencies("context_test", {});
+        REQUIRE(start({ "-j", "2", "context_test", "a", "--tag", "x", "+",
+                        "context_test", "b", "--tag", "y" }) == 0);
+        std::sort(reads.begin(), reads.end());
+        REQUIRE(reads == (std::vector<std::string> {
+            "context_test a x x 7 0", "context_test b y y 7 0" }));
+    }
+
+    SECTION("its validation callback receives the arguments") {
+        REQUIRE(start({ "context_test", "bad" }) == -1);
+        REQUIRE(reads.empty());
+    }
+
+    SECTION("it throws when reading flags of other actions") {
+        prepareAction(nullptr);
+        auto handle = HW::DefineActionFlag<int>("test-action", "handle-flag",
+                                                "a test flag", 0, nullptr);
+        std::vector<std::string> errors {};
+        HW::DefineAction("context_error", 0, true, "test-action", "no help",
+                         [&](const HW::ActionContext& context) -> int {
+                            try {
+                                handle.get(context);
+                            } catch (HW::undefined_flag_error& e) {
+                                errors.push_back(e.what());
+                            }
+                            try {
+                                context.getFlag<int>("handle-flag");
+                            } catch (HW::undefined_flag_error& e) {
+                                errors.push_back(e.what());
+                            }
+                            return 0; });
+        REQUIRE(start({ "context_error" }) == 0);
+        REQUIRE(errors == (std::vector<std::string> {
+            "undefined flag: handle-flag", "undefined flag: handle-flag" }));
+    }
+}
+
+TEST_CASE("RecordQueue", "[pipe]") {
+    HW::RecordQueue queue { 4 };
+    std::string record {};
+
+    SECTION("it passes the records in order, waiting while full") {
+        std::thread writer { [&queue]() {
+            for (int i = 0; i < 1000; i++) {
+                std::string record { std::to_string(i) };
+                queue.write(record);
+            }
+            queue.closeWriter();
+        } };
+        std::vector<std::string> records {};
+        while (queue.read(record)) {
+            records.push_back(record);
+        }
+        writer.join();
+        REQUIRE(records.size() == 1000);
+        REQUIRE(records[0] == "0");
+        REQUIRE(records[999] == "999");
+    }
+
+    SECTION("writes fail once the reader is done") {
+        queue.closeReader();
+        for (int i = 0; i < 4; i++) {
+            record = "a";
+            REQUIRE(queue.write(record));
+        }
+        REQUIRE_FALSE(queue.write(record));
+    }
+
+    SECTION("blocked reads are woken up by writes and by closing") {
+        std::vector<std::string> records {};
+        std::thread reader { [&queue, &records]() {
+            std::string read_record {};
+            while (queue.read(read_record)) {
+                records.push_back(read_record);
+            }
+        } };
+        // Long enough for the reader to block
+        for (auto text : { "a", "b" }) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(50));
+            record = text;
+            REQUIRE(queue.write(record));
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        queue.closeWriter();
+        reader.join();
+        REQUIRE(records == (std::vector<std::string> { "a", "b" }));
+    }
+
+    SECTION("blocked writes are woken up by reads and by closing") {
+        std::atomic<int> written { 0 };
+        std::thread writer { [&queue, &written]() {
+            std::string written_record { "a" };
+            while (queue.write(written_record)) {
+                written++;
+                written_record = "a";
+            }
+        } };
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE(written == 4);
+        REQUIRE(queue.read(record));
+        std::this_thread::sleep_for(std::chrono::milliseconds(50));
+        REQUIRE(written == 5);
+        queue.closeReader();
+        writer.join();
+    }
+}
+
+TEST_CASE("pipelines", "[pipe]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::SetPipeDelimiters(std::vector<std::string> { "|" });
+
+    std::vector<std::string> collected {};
+    std::atomic<int> produced { 0 };
+    HW::DefineAction("produce", 1, true, "test-action", "no help",
+                     [&produced](const HW::ActionContext& context) -> int {
+                        int count { std::stoi(context.arguments()[0].str()) };
+                        for (int i = 0; i < count; i++) {
+                            if (!context.write(std::to_string(i))) {
+                                break;
+                            }
+                            ++produced;
+                        }
+                        return 0; });
+    HW::DefineAction("double", 0, true, "test-action", "no help",
+                     [](const HW::ActionContext& context) -> int {
+                        std::string record {};
+                        while (context.read(record)) {
+                            context.write(std::to_string(2 * std::stoi(record)));
+                        }
+                        return 0; });
+    HW::DefineAction("collect", 1, true, "test-action", "no help",
+                     [&collected](const HW::ActionContext& context) -> int {
+                        size_t limit { std::stoul(context.arguments()[0].str()) };
+                        std::string record {};
+                        while (collected.size() < limit && context.read(record)) {
+                            collected.push_back(record);
+                        }
+                        return context.getFlag<bool>("fail"); });
+    HW::DefineActionFlag<bool>("collect", "fail", "test", false, nullptr);
+    HW::DefineAction("after", 0, true, "test-action", "no help",
+                     [&collected](const HW::Arguments&) -> int {
+                        collected.push_back("after");
+                        return 0; });
+
+    auto start = [](std::vector<std::string> tokens) -> int {
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        if (HW::Parse(argv.size(), argv.data()) != HW::PARSE_OK) {
+            return -1;
+        }
+        return HW::Start();
+    };
+
+    SECTION("piped actions pass records through bounded queues") {
+        REQUIRE(start({ "produce", "5000", "|", "double", "|", "collect", "5000",
+                        "+", "after" }) == 0);
+        REQUIRE(collected.size() == 5001);
+        REQUIRE(collected[1] == "2");
+        REQUIRE(collected[4999] == "9998");
+        REQUIRE(collected.back() == "after");
+    }
+
+    SECTION("the last action of a pipeline writes to stdout") {
+        std::stringstream out {};
+        auto buf = std::cout.rdbuf(out.rdbuf());
+        int result { start({ "produce", "3", "|", "double" }) };
+        std::cout.rdbuf(buf);
+        REQUIRE(result == 0);
+        REQUIRE(out.str() == "0\n2\n4\n");
+    }
+
+    SECTION("writers stop once the next action returns") {
+        REQUIRE(start({ "produce", "1000000", "|", "collect", "3" }) == 0);
+        REQUIRE(collected == (std::vector<std::string> { "0", "1", "2" }));
+        REQUIRE(produced < 1000000);
+    }
+
+    SECTION("a failing action fails the pipeline") {
+        REQUIRE(start({ "produce", "10", "|", "collect", "10", "--fail", "+",
+                        "after" }) == 1);
+        REQUIRE(collected.size() == 10);
+    }
+
+    SECTION("pipelines run as a unit in parallel mode") {
+        REQUIRE(start({ "-j", "4", "produce", "2000", "|", "collect", "2000",
+                        "+", "after" }) == 0);
+        REQUIRE(collected.size() == 2001);
+        REQUIRE(collected.back() == "after");
+    }
+
+    SECTION("only actions taking an ActionContext can be piped") {
+        REQUIRE(start({ "produce", "1", "|", "after" }) == -1);
+        REQUIRE(start({ "after", "|", "collect", "1" }) == -1);
+    }
+
+    SECTION("a pipe delimiter joins two actions") {
+        REQUIRE(start({ "|", "collect", "1" }) == -1);
+        REQUIRE(start({ "produce", "1", "|" }) == -1);
+        REQUIRE(start({ "produce", "1", "|", "|", "collect", "1" }) == -1);
+    }
+}
+
+TEST_CASE("async actions", "[async]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+
+    // Actions completed by the test, from the threads it chooses
+    std::mutex mutex {};
+    std::vector<std::pair<std::string, HW::ActionCompletion>> pending {};
+    std::vector<std::string> completed {};
+    HW::DefineAction("fetch", 1, true, "test-action", "no help",
+                     [&](HW::ActionContext context, HW::ActionCompletion done) {
+                        std::string url { context.arguments()[0].str() };
+                        bool fail { context.getFlag<bool>("fail") };
+                        std::lock_guard<std::mutex> lock { mutex };
+                        pending.emplace_back(url, [&, url, fail, done](int) {
+                            {
+                                std::lock_guard<std::mutex> lock { mutex };
+                                completed.push_back(url);
+                            }
+                            done(fail);
+                        });
+                     });
+    HW::DefineActionFlag<bool>("fetch", "fail", "test", false, nullptr);
+    HW::DefineAction("report", 0, true, "test-action", "no help",
+                     [&](const HW::Arguments&) -> int {
+                        std::lock_guard<std::mutex> lock { mutex };
+                        completed.push_back("report");
+                        return 0; });
+
+    // The arguments refer to the tokens parsed until the actions complete
+    std::vector<std::string> tokens {};
+    auto parse = [&tokens](std::vector<std::string> command_line) -> int {
+        tokens = command_line;
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::Parse(argv.size(), argv.data());
+    };
+    auto completeFirst = [&]() {
+        std::pair<std::string, HW::ActionCompletion> next {};
+        {
+            std::lock_guard<std::mutex> lock { mutex };
+            next = pending.front();
+            pending.erase(pending.begin());
+        }
+        next.second(0);
+    };
+
+    SECTION("Start waits for the completion of asynchronous actions") {
+        REQUIRE(parse({ "fetch", "a", "+", "report" }) == HW::PARSE_OK);
+        std::thread completer { [&]() {
+            while (true) {
+                {
+                    std::lock_guard<std::mutex> lock { mutex };
+                    if (!pending.empty()) {
+                        break;
+                    }
+                }
+                std::this_thread::yield();
+            }
+            completeFirst();
+        } };
+        REQUIRE(HW::Start() == 0);
+        completer.join();
+        REQUIRE(completed == (std::vector<std::string> { "a", "report" }));
+    }
+
+    SECTION("Step runs the actions without waiting") {
+        REQUIRE(parse({ "fetch", "a", "+", "fetch", "b", "+", "report" }) == HW::PARSE_OK);
+        int progress { 0 };
+        REQUIRE(HW::StartAsync([&progress]() { progress++; }) == 0);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        REQUIRE(pending.size() == 1);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+
+        completeFirst();
+        REQUIRE(progress == 1);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        REQUIRE(pending.size() == 1);
+        REQUIRE(pending[0].first == "b");
+
+        completeFirst();
+        REQUIRE(HW::Step() == 0);
+        REQUIRE(progress == 2);
+        REQUIRE(completed == (std::vector<std::string> { "a", "b", "report" }));
+        REQUIRE(HW::Step() == 0);
+    }
+
+    SECTION("independent asynchronous actions run at the same time") {
+        HW::SetActionDependencies("fetch", {});
+        HW::SetActionDependencies("report", { "fetch" });
+        REQUIRE(parse({ "fetch", "a", "+", "fetch", "b", "+", "report" }) == HW::PARSE_OK);
+        REQUIRE(HW::StartAsync() == 0);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        REQUIRE(pending.size() == 2);
+
+        completeFirst();
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        REQUIRE(completed == (std::vector<std::string> { "a" }));
+        completeFirst();
+        REQUIRE(HW::Step() == 0);
+        REQUIRE(completed == (std::vector<std::string> { "a", "b", "report" }));
+    }
+
+    SECTION("a failed asynchronous action stops the chain") {
+        REQUIRE(parse({ "fetch", "a", "--fail", "+", "report" }) == HW::PARSE_OK);
+        REQUIRE(HW::StartAsync() == 0);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        completeFirst();
+        REQUIRE(HW::Step() == 1);
+        REQUIRE(completed == (std::vector<std::string> { "a" }));
+    }
+
+    SECTION("only the first completion counts") {
+        REQUIRE(parse({ "fetch", "a", "+", "report" }) == HW::PARSE_OK);
+        REQUIRE(HW::StartAsync() == 0);
+        REQUIRE(HW::Step() == HW::STEP_RUNNING);
+        HW::ActionCompletion done { pending[0].second };
+        done(0);
+        done(0);
+        REQUIRE(HW::Step() == 0);
+        REQUIRE(completed == (std::vector<std::string> { "a", "a", "report" }));
+    }
+
+    SECTION("StartAsync fails without a parsed command line") {
+        REQUIRE(parse({ "fetch" }) != HW::PARSE_OK);
+        REQUIRE(HW::StartAsync() == 1);
+    }
+}
+
+TEST_CASE("cancellation", "[cancel]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+
+    // Waits until cancelled, unless its argument is "quick"
+    std::atomic<int> cancelled_runs { 0 };
+    HW::DefineAction("wait", 1, true, "test-action", "no help",
+                     [&](HW::ActionContext context) -> int {
+                        if (context.arguments()[0] == "quick") {
+                            return context.cancelled();
+                        }
+                        while (!context.cancellation().cancelled()) {
+                            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                        }
+                        if (context.cancellation().reason() == HW::CancelReason::Interrupted) {
+                            cancelled_runs += 100;
+                        }
+                        cancelled_runs++;
+                        return 0; },
+                     nullptr);
+    // Never completes
+    HW::DefineAction("hang", 0, true, "test-action", "no help",
+                     [](HW::ActionContext, HW::ActionCompletion) {},
+                     nullptr);
+
+    std::vector<std::string> tokens {};
+    auto parse = [&tokens](std::vector<std::string> command_line) -> int {
+        tokens = command_line;
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::Parse(argv.size(), argv.data());
+    };
+    auto codes = []() {
+        std::vector<HW::DiagnosticCode> result {};
+        for (auto& diagnostic : HW::GetDiagnostics()) {
+            result.push_back(diagnostic.code);
+        }
+        return result;
+    };
+
+    SECTION("actions without a deadline are not cancelled") {
+        REQUIRE(parse({ "wait", "quick" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(HW::GetDiagnostics().empty());
+    }
+
+    SECTION("an action is cancelled once its timeout passes") {
+        HW::SetActionTimeout("wait", 20);
+        REQUIRE(parse({ "wait", "a", "+", "wait", "quick" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        REQUIRE(cancelled_runs == 1);
+        REQUIRE(codes() == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled,
+            HW::DiagnosticCode::ActionNotStarted }));
+        REQUIRE(HW::GetDiagnostics()[0].message
+                == "Action 'wait' was cancelled: deadline exceeded.");
+    }
+
+    SECTION("--action-timeout applies to every action") {
+        REQUIRE(parse({ "--action-timeout", "20", "wait", "quick", "+", "wait", "a" })
+                == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        REQUIRE(cancelled_runs == 1);
+        REQUIRE(codes() == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled }));
+    }
+
+    SECTION("--timeout cancels the command line and skips the remaining actions") {
+        REQUIRE(parse({ "--timeout", "20", "wait", "a", "+", "wait", "quick",
+                        "+", "wait", "quick" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        REQUIRE(codes() == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled,
+            HW::DiagnosticCode::ActionSkipped,
+            HW::DiagnosticCode::ActionSkipped }));
+    }
+
+    SECTION("--timeout applies to actions run in parallel") {
+        HW::SetActionDependencies("wait", {});
+        REQUIRE(parse({ "--timeout", "20", "-j", "2", "wait", "a", "+", "wait", "b" })
+                == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        REQUIRE(cancelled_runs == 2);
+    }
+
+    SECTION("asynchronous actions are not waited for once cancelled") {
+        HW::SetActionTimeout("hang", 20);
+        REQUIRE(parse({ "hang" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        REQUIRE(codes() == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled }));
+    }
+
+    SECTION("Step does not wait for asynchronous actions once cancelled") {
+        HW::SetActionTimeout("hang", 20);
+        REQUIRE(parse({ "hang" }) == HW::PARSE_OK);
+        REQUIRE(HW::StartAsync(nullptr) == 0);
+        int result { HW::STEP_RUNNING };
+        while ((result = HW::Step()) == HW::STEP_RUNNING) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        REQUIRE(result == 1);
+    }
+
+    SECTION("SIGINT cancels the running action and skips the remaining ones") {
+        HW::DefineAction("interrupt", 0, true, "test-action", "no help",
+                         [](HW::ActionContext context) -> int {
+                            std::raise(SIGINT);
+                            while (!context.cancelled()) {
+                                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+                            }
+                            return 0; },
+                         nullptr);
+        auto session_codes = [](const HW::Session& session) {
+            std::vector<HW::DiagnosticCode> result {};
+            for (auto& diagnostic : session.getDiagnostics()) {
+                result.push_back(diagnostic.code);
+            }
+            return result;
+        };
+        HW::SetCancelOnSignals(true);
+        const char* cli[] = { "test-app", "interrupt", "+", "wait", "a" };
+        HW::Session session {};
+        REQUIRE(session.parse(5, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(session.start() == 1);
+        REQUIRE(session_codes(session) == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled,
+            HW::DiagnosticCode::ActionSkipped }));
+
+        // The next command line handles the next signal
+        const char* next_cli[] = { "test-app", "wait", "a", "+", "wait", "quick",
+                                   "+", "interrupt" };
+        HW::Session next_session {};
+        REQUIRE(next_session.parse(8, const_cast<char**>(next_cli)) == HW::PARSE_OK);
+        std::thread interrupter { []() {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20));
+            std::raise(SIGINT);
+        } };
+        REQUIRE(next_session.start() == 1);
+        interrupter.join();
+        HW::SetCancelOnSignals(false);
+        REQUIRE(cancelled_runs == 101);
+        REQUIRE(session_codes(next_session) == (std::vector<HW::DiagnosticCode> {
+            HW::DiagnosticCode::ActionCancelled,
+            HW::DiagnosticCode::ActionSkipped,
+            HW::DiagnosticCode::ActionSkipped }));
+    }
+
+    SECTION("sessions starting on several threads rearm the handlers") {
+        HW::SetCancelOnSignals(true);
+        unsigned signals { HW::Watchdog::signalCount().load() };
+        std::raise(SIGINT);
+        std::atomic<int> failures { 0 };
+        std::vector<std::thread> threads {};
+        for (int t = 0; t < 4; t++) {
+            threads.emplace_back([&failures]() {
+                for (int round = 0; round < 20; round++) {
+                    const char* cli[] = { "test-app", "wait", "quick" };
+                    HW::Session session {};
+                    if (session.parse(3, const_cast<char**>(cli)) != HW::PARSE_OK
+                            || session.start() != 0) {
+                        failures++;
+                    }
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        // Handled, instead of terminating the process
+        std::raise(SIGINT);
+        unsigned handled { HW::Watchdog::signalCount().load() - signals };
+        HW::SetCancelOnSignals(false);
+        REQUIRE(failures == 0);
+        REQUIRE(handled == 2);
+    }
+}
+
+TEST_CASE("ShowHelp", "[help]") {
+    HW::Reset();
+    HW::SetAppName("test-app");
+    HW::SetHelpBanner("Usage: test-app <action>");
+    HW::DefineAction("help_test", 0, true, "a test action", "Help of help_test\n",
+                     [](const HW::Arguments&) -> int { return 0; });
+    HW::DefineActionFlag<int>("help_test", "l level", "the level", 0, nullptr);
+
+    auto help = [](std::vector<std::string> command_line) {
+        std::vector<std::string> tokens { command_line };
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        REQUIRE(session.parse(argv.size(), argv.data()) == HW::PARSE_HELP);
+        std::ostringstream out {};
+        auto buf = std::cout.rdbuf(out.rdbuf());
+        session.showHelp();
+        std::cout.rdbuf(buf);
+        return out.str();
+    };
+
+    SECTION("it displays the global help") {
+        std::string text { help({ "--help" }) };
+        REQUIRE(text.find("Usage: test-app <action>\n\nGlobal options:\n   -h") == 0);
+        REQUIRE(text.find("\n  help_test                   a test action                 \n")
+                != std::string::npos);
+        REQUIRE(text.find("\nFor action specific help run \"test-app <action> --help\"\n")
+                != std::string::npos);
+    }
+
+    SECTION("it displays the action help") {
+        REQUIRE(help({ "help_test", "--help" }) ==
+                "Help of help_test\n\n  help_test specific flags:\n\n"
+                "   -l, --level <int>          the level\n\n");
+    }
+
+    SECTION("the help is rendered again once the definitions change") {
+        std::string text { help({ "--help" }) };
+        REQUIRE(help({ "--help" }) == text);
+        HW::DefineAction("help_test_2", 0, true, "another action", "",
+                         [](const HW::Arguments&) -> int { return 0; });
+        REQUIRE(help({ "--help" }).find("another action") != std::string::npos);
+    }
+
+    SECTION("the help is rendered again once the margins change") {
+        // Cache the help rendered with the default margins
+        help({ "help_test", "--help" });
+        HW::SetHelpMargins(20, 60);
+        REQUIRE(help({ "help_test", "--help" }) ==
+                "Help of help_test\n\n  help_test specific flags:\n\n"
+                "   -l, --level <int>\n"
+                "                    the level\n\n");
+    }
+}
+
+// Help rendered by HorseWhisperer 0.8.0, before the help was cached, for
+// the definitions of "help layout" and the global flags built in since;
+// the aliases of a flag are now listed on one line, single character
+// aliases always with one dash ("-j, --jobs <int>", not "--j <int>")
+static const std::string golden_global_help {
+    "Usage: golden-app [options] <action> [arguments]\n"
+    "\n"
+    "Global options:\n"
+    "   -h, --help                 Show this message\n"
+    "  --verbose                   Set verbose output\n"
+    "  --batch <str>               Execute the command lines read from a file ('-'\n"
+    "                              for stdin)\n"
+    "   -j, --jobs <int>           Maximum number of actions run in parallel (0 for\n"
+    "                              one per core)\n"
+    "  --trace <str>               Write a Chrome trace of the parse and the actions\n"
+    "                              to a file\n"
+    "  --timeout <int>             Cancel the actions still running after this many\n"
+    "                              milliseconds (0 for no limit)\n"
+    "  --action-timeout <int>      Cancel each action running for more than this many\n"
+    "                              milliseconds (0 for no limit)\n"
+    "  --watch                     Run the actions again when their input files\n"
+    "                              change\n"
+    "   -n, --name <str>           the name\n"
+    "   -r, --ratio <float>        a ratio\n"
+    "   -q                         be quiet\n"
+    "  --a-very-long-global-flag-name <int>\n"
+    "                              a flag whose aliases do not fit in the margin,\n"
+    "                              with a description long enough to be wrapped on\n"
+    "                              several lines\n"
+    "\n"
+    "Actions:\n"
+    "  an_action_with_a_very_long_name\n"
+    "                              its description               \n"
+    "  golden                      the golden action             \n"
+    "\n"
+    "For action specific help run \"golden-app <action> --help\"\n" };
+
+static const std::string golden_action_help {
+    "Help of golden\n"
+    "\n"
+    "  golden specific flags:\n"
+    "\n"
+    "   -l, --level <int>          the level\n"
+    "   -x <str>                   a single character alias\n"
+    "   -f, --force                force it\n"
+    "\n" };
+
+TEST_CASE("help layout", "[help]") {
+    HW::Reset();
+    HW::SetAppName("golden-app");
+    HW::SetHelpBanner("Usage: golden-app [options] <action> [arguments]");
+    HW::DefineGlobalFlag<std::string>("n name", "the name", "", nullptr);
+    HW::DefineGlobalFlag<double>("r ratio", "a ratio", 0.5, nullptr);
+    HW::DefineGlobalFlag<bool>("q", "be quiet", false, nullptr);
+    HW::DefineGlobalFlag<int>("a-very-long-global-flag-name", "a flag whose "
+                              "aliases do not fit in the margin, with a description "
+                              "long enough to be wrapped on several lines", 0, nullptr);
+    HW::DefineAction("golden", 0, true, "the golden action", "Help of golden\n",
+                     [](const HW::Arguments&) -> int { return 0; });
+    HW::DefineAction("an_action_with_a_very_long_name", 0, true, "its description",
+                     "", [](const HW::Arguments&) -> int { return 0; });
+    HW::DefineActionFlag<int>("golden", "l level", "the level", 0, nullptr);
+    HW::DefineActionFlag<std::string>("golden", "x", "a single character alias", "",
+                                      nullptr);
+    HW::DefineActionFlag<bool>("golden", "f force", "force it", false, nullptr);
+
+    auto help = [](std::vector<std::string> command_line) {
+        std::vector<std::string> tokens { command_line };
+        tokens.insert(tokens.begin(), "golden-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        REQUIRE(session.parse(argv.size(), argv.data()) == HW::PARSE_HELP);
+        std::ostringstream out {};
+        auto buf = std::cout.rdbuf(out.rdbuf());
+        session.showHelp();
+        std::cout.rdbuf(buf);
+        return out.str();
+    };
+
+    SECTION("the global help is unchanged, rendered or cached") {
+        REQUIRE(help({ "--help" }) == golden_global_help);
+        REQUIRE(help({ "--help" }) == golden_global_help);
+    }
+
+    SECTION("the action help is unchanged, rendered or cached") {
+        REQUIRE(help({ "golden", "--help" }) == golden_action_help);
+        REQUIRE(help({ "golden", "--help" }) == golden_action_help);
+    }
+}
+
+TEST_CASE("tracing", "[trace]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineAction("trace_test", 1, true, "test-action", "no help",
+                     [](const HW::ArgumentsView& arguments) -> int {
+                        return arguments[0] == "fail"; },
+                     [](const HW::ArgumentsView&) { return true; });
+    HW::DefineActionFlag<int>("trace_test", "level", "test", 0,
+                              [](int& level) { return level >= 0; });
+
+    auto trace = []() {
+        std::ostringstream output {};
+        HW::WriteTrace(output);
+        return output.str();
+    };
+    auto contains = [](const std::string& text, const std::string& part) {
+        return text.find(part) != std::string::npos;
+    };
+
+    SECTION("nothing is recorded unless tracing") {
+        const char* cli[] = { "test-app", "trace_test", "one" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(trace() == "{\"traceEvents\":[\n],\"displayTimeUnit\":\"ns\"}\n");
+    }
+
+    SECTION("it records the phases, tokens, callbacks and actions") {
+        HW::StartTracing();
+        const char* cli[] = { "test-app", "trace_test", "one", "--level", "2",
+                              "+", "trace_test", "fail" };
+        REQUIRE(HW::Parse(8, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::ValidateActionArguments());
+        REQUIRE(HW::Start() == 1);
+        HW::StopTracing();
+
+        std::string json { trace() };
+        REQUIRE(contains(json, "{\"name\":\"parse\",\"cat\":\"phase\",\"ph\":\"X\""));
+        REQUIRE(contains(json, "{\"name\":\"validate\",\"cat\":\"phase\""));
+        REQUIRE(contains(json, "{\"name\":\"start\",\"cat\":\"phase\""));
+        REQUIRE(contains(json, "\"cat\":\"token\",\"ph\":\"X\""));
+        REQUIRE(contains(json, "{\"name\":\"delimiter\",\"cat\":\"token\""));
+        REQUIRE(contains(json, "\"args\":{\"token\":\"--level\"}"));
+        REQUIRE(contains(json, "{\"name\":\"level\",\"cat\":\"flag callback\""));
+        REQUIRE(contains(json, "{\"name\":\"trace_test\",\"cat\":\"arguments callback\""));
+        REQUIRE(contains(json, "\"args\":{\"arguments\":[\"one\"],\"result\":0}"));
+        REQUIRE(contains(json, "\"args\":{\"arguments\":[\"fail\"],\"result\":1}"));
+    }
+
+    SECTION("StopTracing stops recording") {
+        HW::StartTracing();
+        HW::StopTracing();
+        const char* cli[] = { "test-app", "trace_test", "one" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(!contains(trace(), "\"name\""));
+    }
+
+    SECTION("--trace writes the trace once Start returns") {
+        std::string path { "horsewhisperer_trace_test.json" };
+        const char* cli[] = { "test-app", "--trace", path.c_str(),
+                              "trace_test", "\"quoted\"" };
+        REQUIRE(HW::Parse(5, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        std::ifstream file { path };
+        std::string json { std::istreambuf_iterator<char>(file),
+                           std::istreambuf_iterator<char>() };
+        REQUIRE(contains(json, "\"arguments\":[\"\\\"quoted\\\"\"],\"result\":0"));
+        REQUIRE(contains(json, "{\"name\":\"start\",\"cat\":\"phase\""));
+        std::remove(path.c_str());
+    }
+}
+
+// Collects what is written, counting the writes
+class CapturingSink : public HW::OutputSink {
+  public:
+    void write(HW::StringView text) override {
+        text_.append(text.data(), text.size());
+        writes_++;
+    }
+
+    void flush() override {
+        flushes_++;
+    }
+
+    std::string text_;
+    int writes_ { 0 };
+    int flushes_ { 0 };
+};
+
+TEST_CASE("output sink", "[output]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineAction("output_test", 1, true, "test-action", "Help of output_test\n",
+                     [](const HW::ArgumentsView&) -> int { return 1; });
+    HW::DefineActionFlag<int>("output_test", "level", "test", 0, nullptr);
+
+    CapturingSink sink {};
+    HW::SetOutputSink(&sink);
+    auto parse = [](std::vector<std::string> command_line) -> int {
+        static std::vector<std::string> tokens {};
+        tokens = command_line;
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::Parse(argv.size(), argv.data());
+    };
+    auto only = [](HW::DiagnosticCode code, std::string token, size_t position) {
+        std::vector<HW::Diagnostic> diagnostics { HW::GetDiagnostics() };
+        REQUIRE(diagnostics.size() == 1);
+        REQUIRE(diagnostics[0].code == code);
+        REQUIRE(diagnostics[0].token == token);
+        REQUIRE(diagnostics[0].position == position);
+    };
+
+    SECTION("parse errors are reported with their token and position") {
+        REQUIRE(parse({ "output_test", "a", "+", "unknown" }) == HW::PARSE_ERROR);
+        only(HW::DiagnosticCode::UnknownAction, "unknown", 4);
+        REQUIRE(sink.text_ == "Unknown action: unknown\n");
+        REQUIRE(sink.writes_ == 1);
+
+        REQUIRE(parse({ "output_test", "--bogus", "a" }) == HW::PARSE_ERROR);
+        only(HW::DiagnosticCode::UnknownFlag, "--bogus", 2);
+
+        REQUIRE(parse({ "output_test", "a", "--level", "x" }) == HW::PARSE_INVALID_FLAG);
+        only(HW::DiagnosticCode::InvalidFlagValue, "--level", 3);
+
+        REQUIRE(parse({ "output_test" }) == HW::PARSE_ERROR);
+        only(HW::DiagnosticCode::MissingArguments, "output_test", 1);
+    }
+
+    SECTION("each parse starts with no diagnostics") {
+        REQUIRE(parse({ "unknown" }) == HW::PARSE_ERROR);
+        REQUIRE(parse({ "output_test", "a" }) == HW::PARSE_OK);
+        REQUIRE(HW::GetDiagnostics().empty());
+    }
+
+    SECTION("response file errors are reported") {
+        REQUIRE(parse({ "output_test", "@hw_output_missing.txt" }) == HW::PARSE_ERROR);
+        REQUIRE(HW::GetDiagnostics().front().code
+                == HW::DiagnosticCode::InvalidResponseFile);
+    }
+
+    SECTION("start errors are reported") {
+        REQUIRE(parse({ "output_test", "a", "+", "output_test", "b" }) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 1);
+        only(HW::DiagnosticCode::ActionNotStarted, "output_test", 0);
+    }
+
+    SECTION("the help is written to the sink with a single write") {
+        REQUIRE(parse({ "output_test", "--help" }) == HW::PARSE_HELP);
+        HW::ShowHelp();
+        REQUIRE(sink.text_.find("Help of output_test\n") == 0);
+        REQUIRE(sink.writes_ == 1);
+    }
+
+    SECTION("nothing is flushed implicitly") {
+        REQUIRE(parse({ "unknown" }) == HW::PARSE_ERROR);
+        REQUIRE(sink.flushes_ == 0);
+        HW::Flush();
+        REQUIRE(sink.flushes_ == 1);
+    }
+
+    HW::SetOutputSink(nullptr);
+}
+
+TEST_CASE("BufferedSink", "[output]") {
+    std::ostringstream out {};
+
+    SECTION("it writes on flush") {
+        HW::BufferedSink sink { out };
+        sink.write("one\n");
+        sink.write("two\n");
+        REQUIRE(out.str().empty());
+        sink.flush();
+        REQUIRE(out.str() == "one\ntwo\n");
+    }
+
+    SECTION("it writes when full and when destroyed") {
+        {
+            HW::BufferedSink sink { out, 8 };
+            sink.write("one\n");
+            sink.write("two\n");
+            REQUIRE(out.str().empty());
+            sink.write("three\n");
+            REQUIRE(out.str() == "one\ntwo\n");
+        }
+        REQUIRE(out.str() == "one\ntwo\nthree\n");
+    }
+}
+
+TEST_CASE("result cache", "[cache]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    std::string directory { "hw_cache_test" };
+    HW::SetCacheDirectory(directory);
+
+    // Writes the contents of its input, prefixed by its prefix flag
+    int runs { 0 };
+    HW::DefineAction("render", 1, true, "test-action", "no help",
+                     [&runs](const HW::ActionContext& context) -> int {
+                        runs++;
+                        std::ifstream file { context.arguments()[0].str() };
+                        std::string content {};
+                        std::getline(file, content);
+                        context.write(context.getFlag<std::string>("prefix") + content);
+                        return content == "fail" ? 3 : 0; },
+                     nullptr);
+    HW::DefineActionFlag<std::string>("render", "prefix", "test", "", nullptr);
+    HW::SetActionCacheable("render", true);
+    HW::SetActionInputs("render", [](const HW::ActionContext& context) {
+                            return context.arguments().toArguments(); });
+
+    auto write = [](std::string path, std::string content) {
+        std::ofstream file { path };
+        file << content;
+    };
+    write("hw_cache_input_1.txt", "one");
+    write("hw_cache_input_2.txt", "two");
+
+    CapturingSink sink {};
+    HW::SetOutputSink(&sink);
+    auto run = [](std::vector<std::string> command_line) -> int {
+        std::vector<std::string> tokens { command_line };
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        REQUIRE(session.parse(argv.size(), argv.data()) == HW::PARSE_OK);
+        return session.start();
+    };
+
+    SECTION("results are replayed without running the action") {
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(runs == 1);
+        REQUIRE(sink.text_ == "one\none\n");
+    }
+
+    SECTION("the exit code is replayed") {
+        write("hw_cache_input_1.txt", "fail");
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 1);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt", "+", "render",
+                      "hw_cache_input_2.txt" }) == 1);
+        REQUIRE(runs == 1);
+    }
+
+    SECTION("the key covers the arguments, the flags and the inputs") {
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_input_2.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt", "--prefix", "> " }) == 0);
+        REQUIRE(run({ "--global-get", "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(runs == 4);
+        write("hw_cache_input_1.txt", "changed");
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(runs == 5);
+        REQUIRE(sink.text_ == "one\ntwo\n> one\none\nchanged\n");
+    }
+
+    SECTION("actions run when an input can't be read") {
+        REQUIRE(run({ "render", "hw_cache_missing.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_missing.txt" }) == 0);
+        REQUIRE(runs == 2);
+    }
+
+    SECTION("the execution flags are not part of the key") {
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "-j", "4", "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "--timeout", "10000", "--action-timeout", "10000",
+                      "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(runs == 1);
+        REQUIRE(sink.text_ == "one\none\none\n");
+    }
+
+    SECTION("only actions taking an ActionContext can be cacheable") {
+        HW::DefineAction("print", 0, true, "test-action", "no help",
+                         [](const HW::Arguments&) -> int { return 0; });
+        HW::DefineAction("print_view", 0, true, "test-action", "no help",
+                         [](const HW::ArgumentsView&) -> int { return 0; });
+        REQUIRE_THROWS_AS(HW::SetActionCacheable("print", true), HW::horsewhisperer_error);
+        REQUIRE_THROWS_AS(HW::SetActionCacheable("print_view", true),
+                          HW::horsewhisperer_error);
+        HW::SetActionCacheable("print", false);
+    }
+
+    SECTION("actions run when not cacheable or without a cache directory") {
+        HW::SetActionCacheable("render", false);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        HW::SetActionCacheable("render", true);
+        HW::SetCacheDirectory("");
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(run({ "render", "hw_cache_input_1.txt" }) == 0);
+        REQUIRE(runs == 4);
+    }
+
+    HW::SetOutputSink(nullptr);
+    std::remove("hw_cache_input_1.txt");
+    std::remove("hw_cache_input_2.txt");
+    if (DIR* entries = opendir(directory.c_str())) {
+        while (dirent* entry = readdir(entries)) {
+            std::string name { entry->d_name };
+            if (name != "." && name != "..") {
+                std::remove((directory + "/" + name).c_str());
+            }
+        }
+        closedir(entries);
+    }
+    std::remove(directory.c_str());
+}
+
+TEST_CASE("watch mode", "[watch]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::SetWatchDebounce(50);
+
+    // Each action records its name and the contents of its input
+    std::mutex runs_mutex {};
+    std::vector<std::string> runs {};
+    auto record = [&runs_mutex, &runs](const HW::ActionContext& context) -> int {
+        std::ifstream file { context.arguments()[0].str() };
+        std::string content {};
+        std::getline(file, content);
+        std::lock_guard<std::mutex> lock { runs_mutex };
+        runs.push_back(context.actionName() + ":" + content);
+        return 0;
+    };
+    HW::DefineAction("first", 1, true, "test-action", "no help", record, nullptr);
+    HW::DefineAction("second", 1, true, "test-action", "no help", record, nullptr);
+    for (auto name : { "first", "second" }) {
+        HW::SetActionInputs(name, [](const HW::ActionContext& context) {
+                                return context.arguments().toArguments(); });
+    }
+
+    auto write = [](std::string path, std::string content) {
+        std::ofstream file { path };
+        file << content;
+    };
+    write("hw_watch_input_1.txt", "one");
+    write("hw_watch_input_2.txt", "two");
+
+    // Wait up to a second for count runs, and return the runs recorded
+    auto waitForRuns = [&runs_mutex, &runs](size_t count) -> std::vector<std::string> {
+        for (int i = 0; i < 100; i++) {
+            {
+                std::lock_guard<std::mutex> lock { runs_mutex };
+                if (runs.size() >= count) {
+                    return runs;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::lock_guard<std::mutex> lock { runs_mutex };
+        return runs;
+    };
+
+    CapturingSink sink {};
+    HW::SetOutputSink(&sink);
+    int result { -1 };
+    std::thread watching { [&result]() {
+        std::vector<std::string> tokens { "test-app", "--watch",
+                                          "first", "hw_watch_input_1.txt", "+",
+                                          "second", "hw_watch_input_2.txt" };
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        if (session.parse(argv.size(), argv.data()) == HW::PARSE_OK) {
+            result = session.start();
+        }
+    } };
+
+    std::vector<std::string> expected { "first:one", "second:two" };
+    REQUIRE(waitForRuns(2) == expected);
+
+    // Only the actions from the first one with changed inputs run again
+    write("hw_watch_input_2.txt", "three");
+    expected.push_back("second:three");
+    REQUIRE(waitForRuns(3) == expected);
+
+    write("hw_watch_input_1.txt", "four");
+    expected.push_back("first:four");
+    expected.push_back("second:three");
+    REQUIRE(waitForRuns(5) == expected);
+
+    // A burst of changes runs the actions once
+    for (auto content : { "five", "six", "seven" }) {
+        write("hw_watch_input_2.txt", content);
+    }
+    expected.push_back("second:seven");
+    REQUIRE(waitForRuns(6) == expected);
+
+    // Rewriting the same contents runs nothing
+    write("hw_watch_input_1.txt", "four");
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(waitForRuns(6) == expected);
+
+    HW::StopWatching();
+    watching.join();
+    REQUIRE(result == 0);
+    REQUIRE(sink.text_.find("Inputs of action 'second' changed: running it again.")
+            != std::string::npos);
+
+    SECTION("watch mode is not available with StartAsync") {
+        std::vector<std::string> tokens { "test-app", "--watch", "first",
+                                          "hw_watch_input_1.txt" };
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        REQUIRE(session.parse(argv.size(), argv.data()) == HW::PARSE_OK);
+        REQUIRE(session.startAsync() != 0);
+        REQUIRE(session.getDiagnostics().back().code == HW::DiagnosticCode::InvalidWatch);
+    }
+
+    HW::SetOutputSink(nullptr);
+    HW::SetWatchDebounce(HW::WATCH_DEBOUNCE_MS_DEFAULT);
+    std::remove("hw_watch_input_1.txt");
+    std::remove("hw_watch_input_2.txt");
+}
+
+TEST_CASE("watch mode with generated inputs", "[watch]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::SetWatchDebounce(50);
+
+    // generate writes the input of validate; both record their runs
+    std::mutex runs_mutex {};
+    std::vector<std::string> runs {};
+    auto generate = [&runs_mutex, &runs](const HW::ActionContext& context) -> int {
+        std::ifstream source { context.arguments()[0].str() };
+        std::string content {};
+        std::getline(source, content);
+        std::ofstream generated { context.arguments()[1].str() };
+        generated << "generated " << content;
+        std::lock_guard<std::mutex> lock { runs_mutex };
+        runs.push_back("generate:" + content);
+        return 0;
+    };
+    auto validate = [&runs_mutex, &runs](const HW::ActionContext& context) -> int {
+        std::ifstream generated { context.arguments()[0].str() };
+        std::string content {};
+        std::getline(generated, content);
+        std::lock_guard<std::mutex> lock { runs_mutex };
+        runs.push_back("validate:" + content);
+        return 0;
+    };
+    HW::DefineAction("generate", 2, true, "test-action", "no help", generate, nullptr);
+    HW::DefineAction("validate", 1, true, "test-action", "no help", validate, nullptr);
+    HW::SetActionInputs("generate", [](const HW::ActionContext& context) {
+                            return std::vector<std::string> { context.arguments()[0].str() }; });
+    HW::SetActionInputs("validate", [](const HW::ActionContext& context) {
+                            return context.arguments().toArguments(); });
+
+    {
+        std::ofstream source { "hw_watch_source.txt" };
+        source << "one";
+    }
+    std::remove("hw_watch_generated.txt");
+
+    // Wait up to a second for count runs, and return the runs recorded
+    auto waitForRuns = [&runs_mutex, &runs](size_t count) -> std::vector<std::string> {
+        for (int i = 0; i < 100; i++) {
+            {
+                std::lock_guard<std::mutex> lock { runs_mutex };
+                if (runs.size() >= count) {
+                    return runs;
+                }
+            }
+            std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        }
+        std::lock_guard<std::mutex> lock { runs_mutex };
+        return runs;
+    };
+
+    CapturingSink sink {};
+    HW::SetOutputSink(&sink);
+    int result { -1 };
+    std::thread watching { [&result]() {
+        std::vector<std::string> tokens { "test-app", "--watch",
+                                          "generate", "hw_watch_source.txt",
+                                          "hw_watch_generated.txt", "+",
+                                          "validate", "hw_watch_generated.txt" };
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        HW::Session session {};
+        if (session.parse(argv.size(), argv.data()) == HW::PARSE_OK) {
+            result = session.start();
+        }
+    } };
+
+    std::vector<std::string> expected { "generate:one", "validate:generated one" };
+    REQUIRE(waitForRuns(2) == expected);
+
+    // The input written by generate doesn't run validate once more
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(waitForRuns(3) == expected);
+
+    // An edit of the source runs each action once
+    {
+        std::ofstream source { "hw_watch_source.txt" };
+        source << "two";
+    }
+    expected.push_back("generate:two");
+    expected.push_back("validate:generated two");
+    REQUIRE(waitForRuns(4) == expected);
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    REQUIRE(waitForRuns(5) == expected);
+
+    HW::StopWatching();
+    watching.join();
+    REQUIRE(result == 0);
+
+    HW::SetOutputSink(nullptr);
+    HW::SetWatchDebounce(HW::WATCH_DEBOUNCE_MS_DEFAULT);
+    std::remove("hw_watch_source.txt");
+    std::remove("hw_watch_generated.txt");
+}
+
+static int static_action_runs { 0 };
+
+static int staticAction(const HW::ArgumentsView&) {
+    static_action_runs++;
+    return HW::GetFlag<std::string>("static-name") == "changed" ? 0 : 1;
+}
+
+static bool staticArguments(const HW::ArgumentsView& arguments) {
+    return arguments[0] != "invalid";
+}
+
+static bool staticLevel(int& level) {
+    return level >= 0;
+}
+
+constexpr HW::StaticFlagDefinition static_global_flags[] = {
+    HW::StaticFlag<std::string>("static-name", "a static flag", "default"),
+    HW::StaticFlag<double>("static-ratio", "another static flag", 0.5),
+};
+
+constexpr HW::StaticFlagDefinition static_action_flags[] = {
+    HW::StaticFlag<int>("l static-level", "a static action flag", 0, staticLevel),
+};
+
+constexpr HW::StaticActionDefinition static_actions[] = {
+    HW::StaticAction("static_one", 1, true, "first static action", "one help\n",
+                     staticAction)
+        .withFlags(static_action_flags)
+        .withArgumentsCallback(staticArguments),
+    HW::StaticAction("static_two", 0, true, "second static action", "two help\n",
+                     staticAction),
+};
+
+constexpr HW::StaticSchema static_schema =
+    HW::MakeStaticSchema(static_global_flags, static_actions);
+
+static_assert(static_schema.hasDistinctActionNames(),
+              "the static actions have distinct names");
+static_assert(static_actions[1].name_hash == HW::staticNameHash("static_two"),
+              "action names are hashed at compile time");
+
+TEST_CASE("static schema", "[static]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::SetDelimiters(std::vector<std::string> { "+" });
+    HW::DefineStaticSchema(static_schema);
+    static_action_runs = 0;
+
+    SECTION("it hashes names at compile time as at run time") {
+        REQUIRE(HW::nameHash("static_one") == HW::staticNameHash("static_one"));
+        REQUIRE(HW::nameHash("") == HW::staticNameHash(""));
+    }
+
+    SECTION("it detects duplicate action names") {
+        constexpr HW::StaticActionDefinition duplicates[] = {
+            HW::StaticAction("same", 0, true, "", "", staticAction),
+            HW::StaticAction("other", 0, true, "", "", staticAction),
+            HW::StaticAction("same", 0, true, "", "", staticAction),
+        };
+        static_assert(!HW::MakeStaticSchema(duplicates).hasDistinctActionNames(),
+                      "duplicate action names are detected");
+        REQUIRE(HW::MakeStaticSchema(static_actions).hasDistinctActionNames());
+    }
+
+    SECTION("it parses and runs the static actions") {
+        const char* cli[] = { "test-app", "static_one", "one", "--static-level", "2",
+                              "+", "static_two", "--static-name", "changed" };
+        REQUIRE(HW::Parse(9, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::GetFlag<std::string>("static-name") == "changed");
+        REQUIRE(HW::GetFlag<double>("static-ratio") == 0.5);
+        REQUIRE(HW::ValidateActionArguments());
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(static_action_runs == 2);
+    }
+
+    SECTION("it applies the static callbacks") {
+        const char* invalid[] = { "test-app", "static_one", "invalid" };
+        REQUIRE(HW::Parse(3, const_cast<char**>(invalid)) == HW::PARSE_OK);
+        REQUIRE_FALSE(HW::ValidateActionArguments());
+
+        const char* negative[] = { "test-app", "static_one", "one", "-l", "-1" };
+        REQUIRE_THROWS_AS(HW::Parse(5, const_cast<char**>(negative)),
+                          HW::flag_validation_error);
+    }
+
+    SECTION("it defines the static actions when looked up") {
+        REQUIRE(HW::IsActionFlag("static_one", "static-level"));
+        REQUIRE_FALSE(HW::IsActionFlag("static_two", "static-level"));
+        REQUIRE_FALSE(HW::IsActionFlag("undefined", "static-level"));
+        HW::DefineActionFlag<bool>("static_two", "extra", "a runtime flag",
+                                   false, nullptr);
+        REQUIRE(HW::IsActionFlag("static_two", "extra"));
+    }
+
+    SECTION("an action defined at run time replaces the static one") {
+        static bool runtime_run { false };
+        runtime_run = false;
+        HW::DefineAction("static_two", 0, true, "runtime action", "no help",
+                         [](const HW::Arguments&) -> int {
+                             runtime_run = true;
+                             return 0; }, nullptr);
+        HW::Seal();
+        const char* cli[] = { "test-app", "static_two" };
+        REQUIRE(HW::Parse(2, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(runtime_run);
+        REQUIRE(static_action_runs == 0);
+    }
+
+    SECTION("it shows the static definitions in the help") {
+        HW::Seal();
+        const char* cli[] = { "test-app", "--help" };
+        REQUIRE(HW::Parse(2, const_cast<char**>(cli)) == HW::PARSE_HELP);
+        std::ostringstream output {};
+        std::streambuf* cout_buffer { std::cout.rdbuf(output.rdbuf()) };
+        HW::ShowHelp();
+        std::cout.rdbuf(cout_buffer);
+        REQUIRE(output.str().find("--static-name <str>") != std::string::npos);
+        REQUIRE(output.str().find("static_two") != std::string::npos);
+    }
+
+    SECTION("sessions materialize an unsealed static schema at the same time") {
+        std::atomic<int> failures { 0 };
+        for (int round = 0; round < 50; round++) {
+            HW::Reset();
+            prepareGlobal();
+            HW::DefineStaticSchema(static_schema);
+            std::vector<std::thread> threads {};
+            for (int t = 0; t < 4; t++) {
+                threads.emplace_back([&failures, t]() {
+                    std::vector<std::string> tokens { "test-app", "--static-name", "x" };
+                    if (t % 2) {
+                        tokens.insert(tokens.end(), { "static_one", "one", "-l", "2" });
+                    } else {
+                        tokens.insert(tokens.end(), { "static_two" });
+                    }
+                    std::vector<char*> argv {};
+                    for (auto& token : tokens) {
+                        argv.push_back(&token[0]);
+                    }
+                    HW::Session session {};
+                    if (session.parse(argv.size(), argv.data()) != HW::PARSE_OK
+                            || session.getFlag<std::string>("static-name") != "x") {
+                        failures++;
+                    }
+                });
+            }
+            for (auto& thread : threads) {
+                thread.join();
+            }
+        }
+        REQUIRE(failures == 0);
+        REQUIRE(HW::IsActionFlag("static_one", "static-level"));
+    }
+
+    SECTION("only one static schema can be defined") {
+        REQUIRE_THROWS_AS(HW::DefineStaticSchema(static_schema),
+                          HW::horsewhisperer_error);
+    }
+
+    SECTION("Reset removes the static schema") {
+        HW::Reset();
+        REQUIRE_THROWS_AS(HW::GetFlag<std::string>("static-name"),
+                          HW::undefined_flag_error);
+        HW::DefineStaticSchema(static_schema);
+        REQUIRE(HW::GetFlag<std::string>("static-name") == "default");
+    }
+}
+
+TEST_CASE("Session", "[session]") {
+    HW::Reset();
+    prepareGlobal();
+
+    HW::HorseWhisperer parser {};
+    parser.setDelimiters(std::vector<std::string> { "+" });
+    parser.defineGlobalFlag<int>("count", "test", 1, nullptr);
+    parser.defineAction("greet", 1, true, "test-action", "no help",
+                        [](const HW::Arguments& args) -> int {
+                           // Succeed if the argument is the value of the
+                           // flags of the session
+                           return args[0] != std::to_string(HW::GetFlag<int>("count"))
+                                             + (HW::GetFlag<bool>("loud") ? "!" : "");
+                        }, nullptr);
+    parser.defineActionFlag<bool>("greet", "loud", "test", false, nullptr);
+
+    auto toArgv = [](std::vector<std::string>& tokens) -> std::vector<char*> {
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return argv;
+    };
+
+    SECTION("sessions keep their own state") {
+        HW::Session first { parser };
+        HW::Session second { parser };
+        std::vector<std::string> first_tokens { "test-app", "--count", "3",
+                                                "greet", "3!", "--loud" };
+        std::vector<std::string> second_tokens { "test-app", "greet", "1", "+",
+                                                 "greet", "1" };
+        auto first_argv = toArgv(first_tokens);
+        auto second_argv = toArgv(second_tokens);
+        REQUIRE(first.parse(first_argv.size(), first_argv.data()) == HW::PARSE_OK);
+        REQUIRE(second.parse(second_argv.size(), second_argv.data()) == HW::PARSE_OK);
+
+        REQUIRE(first.getFlag<int>("count") == 3);
+        REQUIRE(second.getFlag<int>("count") == 1);
+        REQUIRE(first.getParsedActions() == (std::vector<std::string> { "greet" }));
+        REQUIRE(second.getParsedActions()
+                == (std::vector<std::string> { "greet", "greet" }));
+        REQUIRE(HW::GetParsedActions().empty());
+
+        REQUIRE(first.start() == 0);
+        REQUIRE(second.start() == 0);
+    }
+
+    SECTION("execute starts from the default flag values") {
+        HW::Session session { parser };
+        std::vector<std::string> tokens { "test-app", "--count", "2", "greet", "2" };
+        auto argv = toArgv(tokens);
+        REQUIRE(session.execute(argv.size(), argv.data()) == 0);
+        tokens = { "test-app", "greet", "1" };
+        argv = toArgv(tokens);
+        REQUIRE(session.execute(argv.size(), argv.data()) == 0);
+        REQUIRE(session.getFlag<int>("count") == 1);
+    }
+
+    SECTION("sessions run command lines on many threads at the same time") {
+        parser.seal();
+        std::atomic<int> failures { 0 };
+        std::vector<std::thread> threads {};
+        for (int t = 0; t < 8; t++) {
+            threads.emplace_back([&parser, &failures, &toArgv, t]() {
+                HW::Session session { parser };
+                for (int i = 0; i < 200; i++) {
+                    std::string count { std::to_string(t * 1000 + i) };
+                    std::vector<std::string> tokens { "test-app", "--count", count,
+                                                      "greet", count, "+",
+                                                      "greet", count + "!", "--loud" };
+                    auto argv = toArgv(tokens);
+                    failures += session.execute(argv.size(), argv.data());
+                }
+            });
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+        REQUIRE(failures == 0);
+    }
+
+    SECTION("sessions of the singleton don't change its flags") {
+        HW::Session session {};
+        session.setFlag<bool>("global-get", true);
+        REQUIRE(session.getFlag<bool>("global-get"));
+        REQUIRE_FALSE(HW::GetFlag<bool>("global-get"));
+    }
+}
+
+TEST_CASE("RunBatch", "[batch]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::DefineGlobalFlag<int>("global-int", "test", 1, nullptr);
+    std::vector<std::string> calls {};
+    HW::DefineAction("batch_test", 1, true, "test-action", "no help",
+                     [&calls](const HW::Arguments& args) -> int {
+                        calls.push_back(args[0] + ":"
+                                        + std::to_string(HW::GetFlag<int>("global-int")));
+                        return args[0] == "fail"; });
+
+    SECTION("it executes each line and records its exit code") {
+        std::istringstream input {
+            "batch_test one --global-int 5\n"
+            "\n"
+            "# a comment\n"
+            "batch_test 'two words'\n"
+            "batch_test fail\n"
+            "unknown_action\n"
+            "batch_test three --global-int foo\n"
+            "batch_test \"unterminated\n" };
+        HW::BatchResult result = HW::RunBatch(input);
+
+        REQUIRE(calls == (std::vector<std::string> { "one:5", "two words:1",
+                                                     "fail:1" }));
+        std::vector<std::pair<size_t, int>> expected {
+            { 1, 0 }, { 4, 0 }, { 5, 1 }, { 6, 1 }, { 7, 2 }, { 8, 1 } };
+        REQUIRE(result.exit_codes == expected);
+        REQUIRE(result.failures == 4);
+    }
+
+    SECTION("lines start from the global flags set on the batch command line") {
+        HW::SetFlag<int>("global-int", 3);
+        std::istringstream input { "batch_test one --global-int 5\n"
+                                   "batch_test two\n" };
+        HW::BatchResult result = HW::RunBatch(input);
+        REQUIRE(result.failures == 0);
+        REQUIRE(calls == (std::vector<std::string> { "one:5", "two:3" }));
+        REQUIRE(HW::GetFlag<int>("global-int") == 3);
+    }
+
+    SECTION("the contexts of each line are released") {
+        long first { 0 };
+        long last { 0 };
+        HW::DefineAction("count", 1, true, "test-action", "no help",
+                         [&first, &last](const HW::Arguments& args) -> int {
+                            if (args[0] == "first") {
+                                first = live_allocations;
+                            } else if (args[0] == "last") {
+                                last = live_allocations;
+                            }
+                            return 0; });
+        // Measured once the buffers reused by each line have grown
+        std::string lines {};
+        for (int i = 0; i < 10000; i++) {
+            lines += "count " + std::to_string(i) + " --global-int 2\n";
+            if (i == 100) {
+                lines += "count first --global-int 2\n";
+            }
+        }
+        lines += "count last --global-int 2\n";
+        // The arena of the contexts keeps its blocks once grown
+        std::istringstream warm_up { "count 1 --global-int 2\n" };
+        REQUIRE(HW::RunBatch(warm_up).failures == 0);
+        std::istringstream input { lines };
+        long allocations { live_allocations };
+        {
+            HW::BatchResult result = HW::RunBatch(input);
+            REQUIRE(result.failures == 0);
+        }
+        // Read before REQUIRE, which allocates
+        long growth { live_allocations - allocations };
+        REQUIRE(last == first);
+        REQUIRE(growth == 0);
+    }
+
+    SECTION("Start runs the batch file given with --batch") {
+        std::string path { "horsewhisperer_batch_test.txt" };
+        {
+            std::ofstream file { path };
+            file << "batch_test one\nbatch_test two\n";
+        }
+        const char* cli[] = { "test-app", "--batch", path.c_str() };
+        REQUIRE(HW::Parse(3, const_cast<char**>(cli)) == HW::PARSE_OK);
+        REQUIRE(HW::Start() == 0);
+        REQUIRE(calls == (std::vector<std::string> { "one:1", "two:1" }));
+        std::remove(path.c_str());
+    }
+}
+
+// Terminates the forked daemon when a test section ends
+struct DaemonProcess {
+    pid_t pid;
+    std::string socket_path;
+
+    ~DaemonProcess() {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        std::remove(socket_path.c_str());
+    }
+};
+
+TEST_CASE("daemon socket path", "[daemon]") {
+    HW::Reset();
+    CapturingSink sink {};
+    HW::SetOutputSink(&sink);
+    std::string path { "hw_daemon_not_a_socket.txt" };
+    {
+        std::ofstream file { path };
+        file << "keep me";
+    }
+
+    REQUIRE(HW::StartDaemon(path) == 1);
+    REQUIRE(sink.text_ == "Cannot listen on " + path
+                          + ": the file exists and is not a socket\n");
+    std::ifstream file { path };
+    std::string content {};
+    std::getline(file, content);
+    REQUIRE(content == "keep me");
+
+    HW::SetOutputSink(nullptr);
+    std::remove(path.c_str());
+}
+
+TEST_CASE("daemon", "[daemon]") {
+    HW::Reset();
+    prepareGlobal();
+    HW::DefineGlobalFlag<int>("global-int", "test", 1, nullptr);
+    HW::DefineAction("equal", 2, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        return args[0] != args[1]; });
+    HW::DefineAction("flag", 1, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        return HW::GetFlag<int>("global-int") != std::stoi(args[0]); });
+    HW::DefineAction("env", 2, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        const char* value = getenv(args[0].c_str());
+                        return args[1] != (value ? value : "unset"); });
+    HW::DefineAction("cwd", 1, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        char* cwd = getcwd(nullptr, 0);
+                        int result = args[0] != cwd;
+                        free(cwd);
+                        return result; });
+    HW::DefineAction("say", 1, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        std::cout << args[0] << "\n";
+                        return 0; });
+    HW::DefineAction("wait", 1, true, "test-action", "no help",
+                     [](const HW::Arguments& args) -> int {
+                        while (access(args[0].c_str(), F_OK) != 0) {
+                            usleep(1000);
+                        }
+                        return 0; });
+
+    std::string socket_path { "/tmp/horsewhisperer_daemon_test_"
+                              + std::to_string(getpid()) + ".sock" };
+
+    auto forward = [&socket_path](std::vector<std::string> tokens,
+                                  std::vector<std::string> environment) -> int {
+        tokens.insert(tokens.begin(), "test-app");
+        std::vector<char*> argv {};
+        for (auto& token : tokens) {
+            argv.push_back(&token[0]);
+        }
+        return HW::ForwardToDaemon(socket_path, argv.size(), argv.data(),
+                                   environment);
+    };
+
+    REQUIRE(forward({ "equal", "a", "a" }, {}) == HW::DAEMON_UNAVAILABLE);
+
+    pid_t daemon_pid = fork();
+    if (daemon_pid == 0) {
+        _exit(HW::StartDaemon(socket_path));
+    }
+    REQUIRE(daemon_pid > 0);
+    DaemonProcess daemon { daemon_pid, socket_path };
+    int exit_code { HW::DAEMON_UNAVAILABLE };
+    for (int attempt = 0; attempt < 5000 && exit_code == HW::DAEMON_UNAVAILABLE;
+            attempt++) {
+        usleep(1000);
+        exit_code = forward({ "equal", "a", "a" }, {});
+    }
+
+    SECTION("it returns the exit code of the command line") {
+        REQUIRE(exit_code == 0);
+        REQUIRE(forward({ "equal", "a", "b" }, {}) == 1);
+        REQUIRE(forward({ "unknown_action" }, {}) == 1);
+        REQUIRE(forward({ "equal", "a", "a", "--global-int", "foo" }, {}) == 2);
+    }
+
+    SECTION("sessions do not share the parse state") {
+        REQUIRE(forward({ "flag", "5", "--global-int", "5" }, {}) == 0);
+        REQUIRE(forward({ "flag", "1" }, {}) == 0);
+    }
+
+    SECTION("it forwards the working directory and the environment") {
+        char* cwd = getcwd(nullptr, 0);
+        REQUIRE(forward({ "cwd", cwd }, {}) == 0);
+        free(cwd);
+
+        setenv("HW_DAEMON_TEST", "pony", 1);
+        REQUIRE(forward({ "env", "HW_DAEMON_TEST", "pony" },
+                        { "HW_DAEMON_TEST" }) == 0);
+        unsetenv("HW_DAEMON_TEST");
+        REQUIRE(forward({ "env", "HW_DAEMON_TEST", "unset" },
+                        { "HW_DAEMON_TEST" }) == 0);
+    }
+
+    SECTION("the output goes to the standard streams of the client") {
+        std::string output_path { socket_path + ".out" };
+        int output_fd = open(output_path.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0600);
+        std::cout.flush();
+        int stdout_fd = dup(STDOUT_FILENO);
+        dup2(output_fd, STDOUT_FILENO);
+        exit_code = forward({ "say", "neigh" }, {});
+        dup2(stdout_fd, STDOUT_FILENO);
+        close(stdout_fd);
+        close(output_fd);
+
+        std::ifstream output { output_path };
+        std::string line {};
+        std::getline(output, line);
+        REQUIRE(exit_code == 0);
+        REQUIRE(line == "neigh");
+        std::remove(output_path.c_str());
+    }
+
+    SECTION("sessions run concurrently") {
+        std::string release_path { socket_path + ".release" };
+        pid_t client_pid = fork();
+        if (client_pid == 0) {
+            _exit(forward({ "wait", release_path }, {}));
+        }
+        REQUIRE(client_pid > 0);
+        REQUIRE(forward({ "equal", "a", "a" }, {}) == 0);
+        int status { 0 };
+        REQUIRE(waitpid(client_pid, &status, WNOHANG) == 0);
+        std::ofstream { release_path };
+        waitpid(client_pid, &status, 0);
+        REQUIRE(WIFEXITED(status));
+        REQUIRE(WEXITSTATUS(status) == 0);
+        std::remove(release_path.c_str());
+    }
 }